@@ -19,12 +19,16 @@
  * Usage:     $ autoscroll [-s secs] textfile
  *            where secs is a positive integer < 60
  *
- * Build with: gcc -o autoscroll autoscroll.c -lm
+ * Build with: gcc -o autoscroll autoscroll.c outbuf.c -lm
  */
 
 #define _XOPEN_SOURCE
 #define _POSIX_C_SOURCE 200809L
 
+#include "multicall.h"
+#include "outbuf.h"
+#include "probes.h"
+
 #include <errno.h>
 #include <math.h> // must build with -lm
 #include <signal.h>
@@ -51,7 +55,7 @@ struct Line
     struct Line *next;
 };
 
-int main(int argc, char *argv[])
+int MAIN(autoscroll)(int argc, char *argv[])
 {
     // -------------------------------- setup --------------------------------
 
@@ -294,6 +298,10 @@ int main(int argc, char *argv[])
 
     int signal_number;
 
+    // a whole frame is written at once, so the screen doesn't flicker
+    struct outbuf frame;
+    outbuf_init(&frame, STDOUT_FILENO);
+
     while (true)
     {
         errno = 0;
@@ -308,8 +316,7 @@ int main(int argc, char *argv[])
         {
         case SIGALRM: // update the screen
             // wipe screen, history, and move to home
-            printf(ESC "[2J" ESC "[3J" ESC "[H");
-            fflush(stdout);
+            outbuf_string(&frame, ESC "[2J" ESC "[3J" ESC "[H");
 
             if (!paused)
             { // not ctrl-z'ed
@@ -371,7 +378,8 @@ int main(int argc, char *argv[])
                 {
                     // if the line can fit, print it
 
-                    printf("%s", line_walker->content);
+                    outbuf_write(&frame, line_walker->content,
+                                 line_walker->length);
 
                     // update tracking
                     lines_printed++;
@@ -403,8 +411,9 @@ int main(int argc, char *argv[])
             // print status bar: time and line count
 
             // go to left most of bottom row
-            printf(ESC "[%d;1f", terminal_dimensions.ws_row);
-            fflush(stdout);
+            outbuf_string(&frame, ESC "[");
+            outbuf_integer(&frame, terminal_dimensions.ws_row, 0);
+            outbuf_string(&frame, ";1f");
 
             // get time string
 
@@ -434,14 +443,26 @@ int main(int argc, char *argv[])
                 exit(EXIT_FAILURE);
             }
 
-            printf("%s Lines: %d-%d", time_string, start_line_number,
-                   start_line_number + lines_printed - 1);
+            outbuf_string(&frame, time_string);
+            outbuf_string(&frame, " Lines: ");
+            outbuf_integer(&frame, start_line_number, 0);
+            outbuf_char(&frame, '-');
+            outbuf_integer(&frame, start_line_number + lines_printed - 1, 0);
 
             // park cursor at (R, C - 2)
 
-            printf(ESC "[%dG", terminal_dimensions.ws_col - 2);
+            outbuf_string(&frame, ESC "[");
+            outbuf_integer(&frame, terminal_dimensions.ws_col - 2, 0);
+            outbuf_char(&frame, 'G');
+
+            PROBE3(autoscroll, frame, start_line_number, lines_printed,
+                   frame.length);
 
-            fflush(stdout);
+            if (-1 == outbuf_flush(&frame))
+            {
+                perror("write()");
+                exit(EXIT_FAILURE);
+            }
 
             // reset for next iteration
 
@@ -464,7 +485,8 @@ int main(int argc, char *argv[])
 
         default: // terminating signal: clean up and close
             // wipe screen, history, and move to home
-            printf(ESC "[2J" ESC "[3J" ESC "[H");
+            outbuf_string(&frame, ESC "[2J" ESC "[3J" ESC "[H");
+            outbuf_close(&frame);
 
             errno = 0;
             fclose(file_content);
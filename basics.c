@@ -6,18 +6,1076 @@
  *                The second line will include the path to the user's shell
  *                if the UID is even. Else, include the value of the DISPLAY
  *                env var.
- * Usage:         ./basics
- * Build with:    gcc -o basics basics.c
+ *                Given UIDs, it reports their identities instead, one line
+ *                each in passwd(5) order plus the supplementary groups:
+ *                name:uid:gid:home:shell:gid,gid,...
+ *                Lookups go through an idcache (see idcache.h), so repeated
+ *                runs against slow NSS backends (LDAP, sssd) are answered
+ *                from the cache file. The cache hit rate goes to stderr.
+ *                With -o, it prints a snapshot of the process instead:
+ *                real/effective/saved/filesystem UIDs and GIDs,
+ *                supplementary groups, capabilities, resource limits,
+ *                cgroups and a few environment variables, as one record
+ *                for fleet inventory. /proc/self/status, limits and cgroup
+ *                are each read once and the record goes out in one write.
+ *                With -a, it reports every account of the host, enumerated
+ *                once with getpwent(3), or read from a passwd(5) file with
+ *                -p, which skips NSS. With -p or -g, accounts are
+ *                formatted on several threads and written by one writer,
+ *                in enumeration order; getpwent(3) alone is serial and
+ *                written as it goes.
+ * Usage:         ./basics [-c <cache file>] [-t <seconds>] [uid ...]
+ *                ./basics -o json|binary
+ *                ./basics -a [-p <passwd file>] [-j <threads>] [-g]
+ *                -c <cache file> to keep lookups in, defaults to $IDCACHE,
+ *                in memory if neither is set
+ *                -t <seconds> a cached lookup stays fresh, default 600
+ *                List UIDs to report the identities of.
+ *                Omit to describe the user's environment.
+ *                -o json for one line of JSON, -o binary for a binary record
+ *                (layout at snapshot_binary())
+ *                -a to print name:uid:gid:home:shell for every account
+ *                -p <passwd file> to read accounts from, mmapped, instead
+ *                of going through NSS
+ *                -j <threads> to format accounts on, default one per CPU,
+ *                only used with -p or -g
+ *                -g to also print each account's supplementary groups
+ * Build with:    gcc -o basics basics.c idcache.c outbuf.c -pthread
  */
 
+#define USAGE \
+    "Usage:\n\
+$ %s [-c <cache file>] [-t <seconds>] [uid ...]\n\
+$ %s -o json|binary\n\
+$ %s -a [-p <passwd file>] [-j <threads>] [-g]\n\
+-c <cache file> to keep lookups in, defaults to $IDCACHE,\n\
+in memory if neither is set\n\
+-t <seconds> a cached lookup stays fresh, default 600\n\
+List UIDs to report the identities of.\n\
+Omit to describe the user's environment.\n\
+-o json for one line of JSON, -o binary for a binary record\n\
+-a to print name:uid:gid:home:shell for every account\n\
+-p <passwd file> to read accounts from instead of going through NSS\n\
+-j <threads> to format accounts on with -p or -g, default one per CPU\n\
+-g to also print each account's supplementary groups\n"
+
+#define _GNU_SOURCE
+#include "idcache.h"
+#include "multicall.h"
+#include "outbuf.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <stdarg.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
-int main()
+/**
+ * Parses a non-negative decimal number, exiting on malformed input.
+ * @param text Number to parse
+ * @param what Name of the number for the error message
+ * @param max Largest value allowed
+ */
+static unsigned long parse_number(const char *text, const char *what,
+                                  unsigned long max)
+{
+    char *end;
+    errno = 0;
+    const unsigned long value = strtoul(text, &end, 10);
+
+    if (errno != 0 || end == text || *end != '\0' || text[0] == '-' ||
+        value > max)
+    {
+        fprintf(stderr, "Invalid %s: %s\n", what, text);
+        exit(EXIT_FAILURE);
+    }
+
+    return value;
+}
+
+/**
+ * Prints the identities of UIDs, looked up in one batch.
+ * @param uids UID arguments, as text
+ * @param count Number of uids
+ * @param cache_path Cache file, NULL to cache in memory only
+ * @param ttl Seconds a cached lookup stays fresh
+ * @returns 0 if every UID has a passwd entry, 1 otherwise
+ */
+static int report_identities(char *const uids[], int count,
+                             const char *cache_path, time_t ttl)
+{
+    uid_t *batch = malloc(sizeof(uid_t) * count);
+    struct identity *identities = malloc(sizeof(struct identity) * count);
+    if (batch == NULL || identities == NULL)
+    {
+        fprintf(stderr, "malloc(): error allocating memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < count; i++)
+        batch[i] = parse_number(uids[i], "UID", (uid_t)-1 - 1);
+
+    struct idcache cache;
+    char error[IDCACHE_ERROR_LENGTH];
+
+    if (idcache_open(&cache, cache_path, ttl, error, sizeof(error)) == -1)
+    {
+        fprintf(stderr, "idcache: %s\n", error);
+        exit(EXIT_FAILURE);
+    }
+
+    if (idcache_lookup_batch(&cache, batch, count, identities) == -1)
+    {
+        perror("idcache_lookup_batch()");
+        exit(EXIT_FAILURE);
+    }
+
+    const struct idcache_stats stats = cache.stats;
+    idcache_close(&cache);
+
+    int status = 0;
+    struct outbuf output;
+    outbuf_init(&output, STDOUT_FILENO);
+
+    for (int i = 0; i < count; i++)
+    {
+        const struct identity *identity = &identities[i];
+
+        if (!identity->found)
+        {
+            fprintf(stderr, "UID %u: no such user\n", identity->uid);
+            status = 1;
+            continue;
+        }
+
+        outbuf_string(&output, identity->name);
+        outbuf_char(&output, ':');
+        outbuf_unsigned(&output, identity->uid, 0);
+        outbuf_char(&output, ':');
+        outbuf_unsigned(&output, identity->gid, 0);
+        outbuf_char(&output, ':');
+        outbuf_string(&output, identity->home);
+        outbuf_char(&output, ':');
+        outbuf_string(&output, identity->shell);
+        outbuf_char(&output, ':');
+
+        for (uint32_t g = 0; g < identity->group_count; g++)
+        {
+            if (g != 0)
+                outbuf_char(&output, ',');
+            outbuf_unsigned(&output, identity->groups[g], 0);
+        }
+        outbuf_char(&output, '\n');
+    }
+
+    if (outbuf_close(&output) == -1)
+    {
+        perror("write()");
+        exit(EXIT_FAILURE);
+    }
+
+    fprintf(stderr,
+            "idcache: %lu lookups, %lu hits (%.1f%%), %lu misses "
+            "(%lu expired)\n",
+            stats.lookups, stats.hits,
+            stats.lookups == 0 ? 0.0 : 100.0 * stats.hits / stats.lookups,
+            stats.misses, stats.expired);
+
+    free(batch);
+    free(identities);
+    return status;
+}
+
+// ------------------------------- snapshot ---------------------------------
+
+#define SNAPSHOT_MAGIC "BSNP"
+#define SNAPSHOT_VERSION 1
+
+/**
+ * Resource limits in the order of /proc/self/limits, with their JSON keys.
+ */
+static const struct
+{
+    const char *proc_name; // as /proc/self/limits names it
+    const char *key;       // JSON key
+    int resource;          // for getrlimit() without /proc
+} limit_names[] = {
+    {"Max cpu time", "cpu", RLIMIT_CPU},
+    {"Max file size", "fsize", RLIMIT_FSIZE},
+    {"Max data size", "data", RLIMIT_DATA},
+    {"Max stack size", "stack", RLIMIT_STACK},
+    {"Max core file size", "core", RLIMIT_CORE},
+    {"Max resident set", "rss", RLIMIT_RSS},
+    {"Max processes", "nproc", RLIMIT_NPROC},
+    {"Max open files", "nofile", RLIMIT_NOFILE},
+    {"Max locked memory", "memlock", RLIMIT_MEMLOCK},
+    {"Max address space", "as", RLIMIT_AS},
+    {"Max file locks", "locks", RLIMIT_LOCKS},
+    {"Max pending signals", "sigpending", RLIMIT_SIGPENDING},
+    {"Max msgqueue size", "msgqueue", RLIMIT_MSGQUEUE},
+    {"Max nice priority", "nice", RLIMIT_NICE},
+    {"Max realtime priority", "rtprio", RLIMIT_RTPRIO},
+    {"Max realtime timeout", "rttime", RLIMIT_RTTIME},
+};
+
+#define LIMIT_COUNT (sizeof(limit_names) / sizeof(limit_names[0]))
+
+/**
+ * Capabilities lines of /proc/self/status, with their JSON keys.
+ */
+static const char *const capability_names[][2] = {
+    {"CapInh:", "inh"}, {"CapPrm:", "prm"}, {"CapEff:", "eff"},
+    {"CapBnd:", "bnd"}, {"CapAmb:", "amb"},
+};
+
+#define CAPABILITY_COUNT 5
+
+/**
+ * Environment variables included in a snapshot.
+ */
+static const char *const snapshot_variables[] = {
+    "LOGNAME", "USER", "HOME", "SHELL", "PATH", "LANG", "TERM", "DISPLAY",
+};
+
+#define VARIABLE_COUNT \
+    (sizeof(snapshot_variables) / sizeof(snapshot_variables[0]))
+
+/**
+ * Credentials, limits and cgroup of the process.
+ */
+struct snapshot
+{
+    uint32_t uids[4]; // real, effective, saved, filesystem
+    uint32_t gids[4]; // real, effective, saved, filesystem
+    uint32_t *groups; // supplementary groups
+    uint32_t group_count;
+    uint64_t capabilities[CAPABILITY_COUNT]; // in capability_names order
+    uint64_t limits[LIMIT_COUNT][2];         // soft, hard; UINT64_MAX if none
+    char *cgroup;                            // /proc/self/cgroup, one per line
+};
+
+/**
+ * Appends a little-endian unsigned integer of size bytes.
+ */
+static void append_little_endian(struct outbuf *record, uint64_t value, int size)
+{
+    unsigned char bytes[8];
+    for (int i = 0; i < size; i++)
+        bytes[i] = value >> (8 * i);
+    outbuf_write(record, bytes, size);
+}
+
+/**
+ * Appends a JSON string, escaping quotes, backslashes and control bytes.
+ * @param text String to append, NULL for null
+ */
+static void append_json_string(struct outbuf *record, const char *text)
+{
+    if (text == NULL)
+    {
+        outbuf_write(record, "null", 4);
+        return;
+    }
+
+    outbuf_write(record, "\"", 1);
+    for (const char *c = text; *c != '\0'; c++)
+    {
+        if (*c == '"' || *c == '\\')
+        {
+            outbuf_write(record, "\\", 1);
+            outbuf_write(record, c, 1);
+        }
+        else if ((unsigned char)*c < 0x20)
+            outbuf_printf(record, "\\u%04x", *c);
+        else
+            outbuf_write(record, c, 1);
+    }
+    outbuf_write(record, "\"", 1);
+}
+
+/**
+ * Reads a whole file with open(2)/read(2), as /proc files have no size.
+ * @returns the NUL-terminated contents, NULL with errno set on error
+ */
+static char *read_whole_file(const char *path)
+{
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return NULL;
+
+    size_t size = 4096; // /proc/self/status fits in one read
+    size_t length = 0;
+    char *contents = malloc(size);
+
+    while (contents != NULL)
+    {
+        const ssize_t bytes = read(fd, contents + length, size - length - 1);
+        if (bytes <= 0)
+        {
+            if (bytes == -1)
+            {
+                free(contents);
+                contents = NULL;
+            }
+            break;
+        }
+
+        length += bytes;
+        if (length + 1 == size)
+        {
+            char *larger = realloc(contents, size *= 2);
+            if (larger == NULL)
+                free(contents);
+            contents = larger;
+        }
+    }
+
+    const int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+
+    if (contents != NULL)
+        contents[length] = '\0';
+    return contents;
+}
+
+/**
+ * Fills credentials, groups and capabilities from /proc/self/status.
+ */
+static void parse_status(char *status, struct snapshot *snapshot)
+{
+    char *saveptr;
+
+    for (char *line = strtok_r(status, "\n", &saveptr); line != NULL;
+         line = strtok_r(NULL, "\n", &saveptr))
+    {
+        if (strncmp(line, "Uid:", 4) == 0)
+        {
+            sscanf(line + 4, "%u %u %u %u", &snapshot->uids[0],
+                   &snapshot->uids[1], &snapshot->uids[2], &snapshot->uids[3]);
+        }
+        else if (strncmp(line, "Gid:", 4) == 0)
+        {
+            sscanf(line + 4, "%u %u %u %u", &snapshot->gids[0],
+                   &snapshot->gids[1], &snapshot->gids[2], &snapshot->gids[3]);
+        }
+        else if (strncmp(line, "Groups:", 7) == 0)
+        { // at most one group per two characters
+            snapshot->groups = malloc(sizeof(uint32_t) * (strlen(line) / 2));
+            if (snapshot->groups == NULL)
+            {
+                fprintf(stderr, "malloc(): error allocating memory\n");
+                exit(EXIT_FAILURE);
+            }
+
+            char *c = line + 7;
+            char *end;
+            while (true)
+            {
+                const unsigned long gid = strtoul(c, &end, 10);
+                if (end == c)
+                    break;
+                snapshot->groups[snapshot->group_count++] = gid;
+                c = end;
+            }
+        }
+        else
+        {
+            for (int i = 0; i < CAPABILITY_COUNT; i++)
+            {
+                const char *name = capability_names[i][0];
+                if (strncmp(line, name, strlen(name)) == 0)
+                {
+                    snapshot->capabilities[i] =
+                        strtoull(line + strlen(name), NULL, 16);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Parses a limit value of /proc/self/limits.
+ */
+static uint64_t parse_limit(const char *text)
+{
+    return strncmp(text, "unlimited", 9) == 0 ? UINT64_MAX
+                                              : strtoull(text, NULL, 10);
+}
+
+/**
+ * Fills resource limits from /proc/self/limits in one read, or from
+ * getrlimit() without /proc.
+ */
+static void read_limits(struct snapshot *snapshot)
+{
+    char *limits = read_whole_file("/proc/self/limits");
+
+    for (size_t i = 0; i < LIMIT_COUNT; i++)
+    {
+        const char *line = NULL;
+        const size_t name_length = strlen(limit_names[i].proc_name);
+
+        // lines are in table order, but don't rely on it
+        for (const char *c = limits; c != NULL && *c != '\0';
+             c = strchr(c, '\n'), c = c == NULL ? NULL : c + 1)
+        {
+            if (strncmp(c, limit_names[i].proc_name, name_length) == 0 &&
+                c[name_length] == ' ')
+            {
+                line = c + name_length;
+                break;
+            }
+        }
+
+        if (line != NULL)
+        {
+            line += strspn(line, " ");
+            snapshot->limits[i][0] = parse_limit(line);
+            line += strcspn(line, " ");
+            line += strspn(line, " ");
+            snapshot->limits[i][1] = parse_limit(line);
+        }
+        else
+        {
+            struct rlimit limit = {RLIM_INFINITY, RLIM_INFINITY};
+            getrlimit(limit_names[i].resource, &limit);
+            snapshot->limits[i][0] =
+                limit.rlim_cur == RLIM_INFINITY ? UINT64_MAX : limit.rlim_cur;
+            snapshot->limits[i][1] =
+                limit.rlim_max == RLIM_INFINITY ? UINT64_MAX : limit.rlim_max;
+        }
+    }
+
+    free(limits);
+}
+
+/**
+ * Gathers a snapshot of the process, reading /proc/self/status,
+ * /proc/self/limits and /proc/self/cgroup once each.
+ */
+static void take_snapshot(struct snapshot *snapshot)
+{
+    memset(snapshot, 0, sizeof(struct snapshot));
+
+    char *status = read_whole_file("/proc/self/status");
+    if (status != NULL)
+    {
+        parse_status(status, snapshot);
+        free(status);
+    }
+    else
+    { // no /proc: what the system calls can tell
+        uid_t ruid, euid, suid;
+        gid_t rgid, egid, sgid;
+        getresuid(&ruid, &euid, &suid);
+        getresgid(&rgid, &egid, &sgid);
+
+        snapshot->uids[0] = ruid;
+        snapshot->uids[1] = euid;
+        snapshot->uids[2] = suid;
+        snapshot->uids[3] = euid;
+        snapshot->gids[0] = rgid;
+        snapshot->gids[1] = egid;
+        snapshot->gids[2] = sgid;
+        snapshot->gids[3] = egid;
+
+        const int count = getgroups(0, NULL);
+        gid_t *groups = malloc(sizeof(gid_t) * (count + 1));
+        snapshot->groups = malloc(sizeof(uint32_t) * (count + 1));
+        if (groups == NULL || snapshot->groups == NULL)
+        {
+            fprintf(stderr, "malloc(): error allocating memory\n");
+            exit(EXIT_FAILURE);
+        }
+
+        const int got = getgroups(count, groups);
+        for (int i = 0; i < got; i++)
+            snapshot->groups[i] = groups[i];
+        snapshot->group_count = got < 0 ? 0 : got;
+        free(groups);
+    }
+
+    read_limits(snapshot);
+
+    snapshot->cgroup = read_whole_file("/proc/self/cgroup");
+    if (snapshot->cgroup != NULL)
+    {
+        const size_t length = strlen(snapshot->cgroup);
+        if (length > 0 && snapshot->cgroup[length - 1] == '\n')
+            snapshot->cgroup[length - 1] = '\0';
+    }
+}
+
+/**
+ * Renders a snapshot as one line of JSON.
+ */
+static void snapshot_json(const struct snapshot *snapshot,
+                          struct outbuf *record)
+{
+    outbuf_printf(record, "{\"uid\":[%u,%u,%u,%u]", snapshot->uids[0],
+                  snapshot->uids[1], snapshot->uids[2], snapshot->uids[3]);
+    outbuf_printf(record, ",\"gid\":[%u,%u,%u,%u]", snapshot->gids[0],
+                  snapshot->gids[1], snapshot->gids[2], snapshot->gids[3]);
+
+    outbuf_printf(record, ",\"groups\":[");
+    for (uint32_t i = 0; i < snapshot->group_count; i++)
+        outbuf_printf(record, i == 0 ? "%u" : ",%u", snapshot->groups[i]);
+
+    // hexadecimal strings, JSON numbers lose precision past 2^53
+    outbuf_printf(record, "],\"cap\":{");
+    for (int i = 0; i < CAPABILITY_COUNT; i++)
+    {
+        outbuf_printf(record, "%s\"%s\":\"%016" PRIx64 "\"", i == 0 ? "" : ",",
+                      capability_names[i][1], snapshot->capabilities[i]);
+    }
+
+    outbuf_printf(record, "},\"rlimit\":{");
+    for (size_t i = 0; i < LIMIT_COUNT; i++)
+    {
+        outbuf_printf(record, "%s\"%s\":[", i == 0 ? "" : ",",
+                      limit_names[i].key);
+        for (int j = 0; j < 2; j++)
+        { // null for unlimited
+            if (snapshot->limits[i][j] == UINT64_MAX)
+                outbuf_printf(record, j == 0 ? "null" : ",null");
+            else
+                outbuf_printf(record, j == 0 ? "%" PRIu64 : ",%" PRIu64,
+                              snapshot->limits[i][j]);
+        }
+        outbuf_printf(record, "]");
+    }
+
+    outbuf_printf(record, "},\"cgroup\":[");
+    if (snapshot->cgroup != NULL && snapshot->cgroup[0] != '\0')
+    {
+        const char *line = snapshot->cgroup;
+        while (true)
+        {
+            const char *end = strchr(line, '\n');
+            char *copy = strndup(line, end == NULL ? strlen(line)
+                                                   : (size_t)(end - line));
+            if (copy == NULL)
+            {
+                fprintf(stderr, "strndup(): error allocating memory\n");
+                exit(EXIT_FAILURE);
+            }
+            append_json_string(record, copy);
+            free(copy);
+
+            if (end == NULL)
+                break;
+            outbuf_write(record, ",", 1);
+            line = end + 1;
+        }
+    }
+
+    outbuf_printf(record, "],\"env\":{");
+    for (size_t i = 0; i < VARIABLE_COUNT; i++)
+    {
+        outbuf_printf(record, "%s\"%s\":", i == 0 ? "" : ",",
+                      snapshot_variables[i]);
+        append_json_string(record, getenv(snapshot_variables[i]));
+    }
+    outbuf_printf(record, "}}\n");
+}
+
+/**
+ * Appends a length-prefixed string, length UINT32_MAX for NULL.
+ */
+static void append_binary_string(struct outbuf *record, const char *text)
+{
+    if (text == NULL)
+    {
+        append_little_endian(record, UINT32_MAX, 4);
+        return;
+    }
+
+    const size_t length = strlen(text);
+    append_little_endian(record, length, 4);
+    outbuf_write(record, text, length);
+}
+
+/**
+ * Renders a snapshot as a binary record, all integers little-endian:
+ * magic "BSNP", u32 version, u32 record length, u32 uids[4], u32 gids[4],
+ * u64 capabilities[5] (inh, prm, eff, bnd, amb), u32 limit count and that
+ * many u64 soft/hard pairs (UINT64_MAX unlimited) in /proc/self/limits
+ * order, u32 group count and u32 groups, the cgroup string, u32 variable
+ * count and as many name/value string pairs. Strings are a u32 length
+ * (UINT32_MAX for none) and as many bytes.
+ */
+static void snapshot_binary(const struct snapshot *snapshot,
+                            struct outbuf *record)
+{
+    const size_t start = record->length;
+
+    outbuf_write(record, SNAPSHOT_MAGIC, 4);
+    append_little_endian(record, SNAPSHOT_VERSION, 4);
+    append_little_endian(record, 0, 4); // record length, filled in at the end
+
+    for (int i = 0; i < 4; i++)
+        append_little_endian(record, snapshot->uids[i], 4);
+    for (int i = 0; i < 4; i++)
+        append_little_endian(record, snapshot->gids[i], 4);
+    for (int i = 0; i < CAPABILITY_COUNT; i++)
+        append_little_endian(record, snapshot->capabilities[i], 8);
+
+    append_little_endian(record, LIMIT_COUNT, 4);
+    for (size_t i = 0; i < LIMIT_COUNT; i++)
+    {
+        append_little_endian(record, snapshot->limits[i][0], 8);
+        append_little_endian(record, snapshot->limits[i][1], 8);
+    }
+
+    append_little_endian(record, snapshot->group_count, 4);
+    for (uint32_t i = 0; i < snapshot->group_count; i++)
+        append_little_endian(record, snapshot->groups[i], 4);
+
+    append_binary_string(record, snapshot->cgroup);
+
+    append_little_endian(record, VARIABLE_COUNT, 4);
+    for (size_t i = 0; i < VARIABLE_COUNT; i++)
+    {
+        append_binary_string(record, snapshot_variables[i]);
+        append_binary_string(record, getenv(snapshot_variables[i]));
+    }
+
+    if (record->error != 0)
+        return; // the record may be cut short, or not allocated at all
+
+    const uint32_t length = record->length - start;
+    for (int i = 0; i < 4; i++)
+        record->data[start + 8 + i] = length >> (8 * i);
+}
+
+/**
+ * Prints a snapshot of the process with a single write(2).
+ * @param binary true for the binary record, false for JSON
+ */
+static void report_snapshot(bool binary)
+{
+    struct snapshot snapshot;
+    take_snapshot(&snapshot);
+
+    struct outbuf record;
+    outbuf_init(&record, -1);
+    if (binary)
+        snapshot_binary(&snapshot, &record);
+    else
+        snapshot_json(&snapshot, &record);
+
+    if (record.error != 0)
+    {
+        errno = record.error;
+        perror("snapshot");
+        exit(EXIT_FAILURE);
+    }
+
+    struct outbuf output; // larger than its buffer, goes out in one write
+    outbuf_init(&output, STDOUT_FILENO);
+    outbuf_write(&output, record.data, record.length);
+    if (outbuf_close(&output) == -1)
+    {
+        perror("write()");
+        exit(EXIT_FAILURE);
+    }
+
+    outbuf_close(&record);
+    free(snapshot.groups);
+    free(snapshot.cgroup);
+}
+
+// -------------------------------- batch -----------------------------------
+
+/**
+ * A slice of passwd(5) lines for one thread to format.
+ */
+struct batch_chunk
+{
+    const char *start;
+    const char *end;      // one past the last byte
+    bool groups;          // append supplementary groups, see -g
+    struct outbuf output; // formatted lines
+    pthread_t thread;
+};
+
+/**
+ * Formats one passwd(5) line as name:uid:gid:home:shell[:groups].
+ * Comments, NIS +/- entries and malformed lines are skipped.
+ */
+static void format_account(const char *line, const char *end, bool groups,
+                           struct outbuf *output)
+{
+    const char *fields[7];
+    size_t lengths[7];
+    int count = 0;
+
+    for (const char *field = line; count < 7;)
+    {
+        const char *colon = memchr(field, ':', end - field);
+        fields[count] = field;
+        lengths[count] = (colon == NULL ? end : colon) - field;
+        count++;
+
+        if (colon == NULL)
+            break;
+        field = colon + 1;
+    }
+
+    if (count != 7 || lengths[0] == 0 || line[0] == '#' || line[0] == '+' ||
+        line[0] == '-')
+        return;
+
+    char *number_end;
+    const unsigned long uid = strtoul(fields[2], &number_end, 10);
+    if (number_end != fields[2] + lengths[2] || lengths[2] == 0)
+        return;
+    const unsigned long gid = strtoul(fields[3], &number_end, 10);
+    if (number_end != fields[3] + lengths[3] || lengths[3] == 0)
+        return;
+
+    outbuf_write(output, fields[0], lengths[0]);
+    outbuf_write(output, ":", 1);
+    outbuf_unsigned(output, uid, 0);
+    outbuf_write(output, ":", 1);
+    outbuf_unsigned(output, gid, 0);
+    outbuf_write(output, ":", 1);
+    outbuf_write(output, fields[5], lengths[5]);
+    outbuf_write(output, ":", 1);
+    outbuf_write(output, fields[6], lengths[6]);
+
+    if (groups)
+    {
+        char name[lengths[0] + 1];
+        memcpy(name, fields[0], lengths[0]);
+        name[lengths[0]] = '\0';
+
+        gid_t list[IDCACHE_MAX_GROUPS];
+        int group_count = IDCACHE_MAX_GROUPS;
+        getgrouplist(name, gid, list, &group_count);
+        if (group_count > IDCACHE_MAX_GROUPS)
+            group_count = IDCACHE_MAX_GROUPS;
+
+        outbuf_write(output, ":", 1);
+        for (int i = 0; i < group_count; i++)
+        {
+            if (i != 0)
+                outbuf_write(output, ",", 1);
+            outbuf_unsigned(output, list[i], 0);
+        }
+    }
+
+    outbuf_write(output, "\n", 1);
+}
+
+/**
+ * Thread body: formats every line of a chunk into its output.
+ */
+static void *format_chunk(void *argument)
+{
+    struct batch_chunk *chunk = argument;
+
+    for (const char *line = chunk->start; line < chunk->end;)
+    {
+        const char *newline = memchr(line, '\n', chunk->end - line);
+        const char *line_end = newline == NULL ? chunk->end : newline;
+
+        format_account(line, line_end, chunk->groups, &chunk->output);
+        line = line_end + 1;
+    }
+
+    return NULL;
+}
+
+/**
+ * Enumerates accounts through NSS with getpwent(3).
+ * @param formatted true to write them as name:uid:gid:home:shell lines,
+ *                  false as passwd(5) lines for format_account()
+ */
+static void enumerate_accounts(struct outbuf *accounts, bool formatted)
+{
+    setpwent();
+
+    while (true)
+    {
+        errno = 0;
+        const struct passwd *entry = getpwent();
+        if (entry == NULL)
+        {
+            if (errno != 0 && errno != ENOENT)
+            {
+                perror("getpwent()");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        }
+
+        if (entry->pw_name[0] == '\0')
+            continue; // as format_account() skips it
+
+        outbuf_write(accounts, entry->pw_name, strlen(entry->pw_name));
+        if (formatted)
+            outbuf_write(accounts, ":", 1);
+        else
+            outbuf_write(accounts, ":x:", 3);
+        outbuf_unsigned(accounts, entry->pw_uid, 0);
+        outbuf_write(accounts, ":", 1);
+        outbuf_unsigned(accounts, entry->pw_gid, 0);
+        if (formatted)
+            outbuf_write(accounts, ":", 1);
+        else
+            outbuf_write(accounts, "::", 2);
+        outbuf_write(accounts, entry->pw_dir, strlen(entry->pw_dir));
+        outbuf_write(accounts, ":", 1);
+        outbuf_write(accounts, entry->pw_shell, strlen(entry->pw_shell));
+        outbuf_write(accounts, "\n", 1);
+    }
+
+    endpwent();
+}
+
+/**
+ * Prints every account, name:uid:gid:home:shell[:groups] per line.
+ * Accounts come from getpwent(3), or straight from a mmapped passwd(5) file
+ * when one is given, which skips NSS entirely. Either way they end up as
+ * passwd(5) lines, split into one chunk per thread; each thread formats
+ * its chunk into its own buffer and the buffers are written in order as
+ * the threads finish, so the output order matches the input.
+ * getpwent(3) itself is serial, so without groups to look up its accounts
+ * are written as they are enumerated, and threads are not used.
+ * @param passwd_path passwd(5) file to read, NULL to use getpwent(3)
+ * @param threads Number of formatting threads
+ * @param groups true to append supplementary groups
+ */
+static void report_all_accounts(const char *passwd_path, int threads,
+                                bool groups)
+{
+    struct outbuf accounts;
+    outbuf_init(&accounts, -1);
+    const char *text;
+    size_t length;
+
+    if (passwd_path == NULL && !groups)
+    { // formatting as enumerated leaves the threads nothing to do
+        struct outbuf output;
+        outbuf_init(&output, STDOUT_FILENO);
+        enumerate_accounts(&output, true);
+        if (outbuf_close(&output) == -1)
+        {
+            perror("write()");
+            exit(EXIT_FAILURE);
+        }
+        outbuf_close(&accounts);
+        return;
+    }
+
+    if (passwd_path == NULL)
+    {
+        enumerate_accounts(&accounts, false);
+        if (accounts.error != 0)
+        {
+            errno = accounts.error;
+            perror("getpwent()");
+            exit(EXIT_FAILURE);
+        }
+        text = accounts.data;
+        length = accounts.length;
+    }
+    else
+    {
+        const int fd = open(passwd_path, O_RDONLY | O_CLOEXEC);
+        struct stat status;
+        if (fd == -1 || fstat(fd, &status) == -1)
+        {
+            perror(passwd_path);
+            exit(EXIT_FAILURE);
+        }
+
+        length = status.st_size;
+        text = NULL;
+        if (length > 0)
+        {
+            text = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (text == MAP_FAILED)
+            {
+                perror("mmap()");
+                exit(EXIT_FAILURE);
+            }
+            madvise((void *)text, length, MADV_SEQUENTIAL);
+        }
+        close(fd);
+    }
+
+    struct batch_chunk *chunks = calloc(threads, sizeof(struct batch_chunk));
+    if (chunks == NULL)
+    {
+        fprintf(stderr, "calloc(): error allocating memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // split at line boundaries into roughly equal chunks
+    const char *start = text;
+    const char *end = text + length;
+    for (int i = 0; i < threads; i++)
+    {
+        const char *chunk_end = i == threads - 1
+                                    ? end
+                                    : text + length / threads * (i + 1);
+        if (chunk_end < start)
+            chunk_end = start;
+        if (chunk_end < end)
+        {
+            const char *newline = memchr(chunk_end, '\n', end - chunk_end);
+            chunk_end = newline == NULL ? end : newline + 1;
+        }
+
+        chunks[i].start = start;
+        chunks[i].end = chunk_end;
+        chunks[i].groups = groups;
+        outbuf_init(&chunks[i].output, -1);
+        start = chunk_end;
+
+        const int error = pthread_create(&chunks[i].thread, NULL,
+                                         format_chunk, &chunks[i]);
+        if (error != 0)
+        {
+            fprintf(stderr, "pthread_create(): %s\n", strerror(error));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    struct outbuf output; // the single writer, in chunk order
+    outbuf_init(&output, STDOUT_FILENO);
+
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_join(chunks[i].thread, NULL);
+
+        if (chunks[i].output.error != 0)
+        {
+            errno = chunks[i].output.error;
+            perror("format_chunk()");
+            exit(EXIT_FAILURE);
+        }
+
+        outbuf_write(&output, chunks[i].output.data, chunks[i].output.length);
+        outbuf_close(&chunks[i].output);
+    }
+
+    if (outbuf_close(&output) == -1)
+    {
+        perror("write()");
+        exit(EXIT_FAILURE);
+    }
+
+    free(chunks);
+    if (passwd_path != NULL && length > 0)
+        munmap((void *)text, length);
+    outbuf_close(&accounts);
+}
+
+int MAIN(basics)(int argc, char *argv[])
 {
-    int return_code;
+    // ---------------------- command option parsing -------------------------
+
+    opterr = 0;                                   // turn off getopt() errors
+    int option;                                   // current option
+    const char *cache_path = getenv("IDCACHE");   // -c argument
+    time_t ttl = IDCACHE_DEFAULT_TTL;             // -t argument
+    const char *o_value = NULL;                   // -o argument
+    bool all_accounts = false;                    // -a option
+    const char *passwd_path = NULL;               // -p argument
+    long threads = sysconf(_SC_NPROCESSORS_ONLN); // -j argument
+    bool groups = false;                          // -g option
+
+    while (-1 != (option = getopt(argc, argv, ":c:t:o:ap:j:g")))
+    {
+        switch (option)
+        {
+        case 'c':
+            cache_path = optarg;
+            break;
+        case 't':
+            ttl = parse_number(optarg, "TTL", INT_MAX);
+            break;
+        case 'o':
+            o_value = optarg;
+            break;
+        case 'a':
+            all_accounts = true;
+            break;
+        case 'p':
+            passwd_path = optarg;
+            break;
+        case 'j':
+            threads = parse_number(optarg, "thread count", 1024);
+            if (threads == 0)
+            {
+                fprintf(stderr, "Invalid thread count: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'g':
+            groups = true;
+            break;
+        case ':': // missing argument
+            fprintf(stderr, "Missing argument for %c\n" USAGE, optopt,
+                    argv[0], argv[0], argv[0]);
+            exit(EXIT_FAILURE);
+        case '?': // unknown option
+            fprintf(stderr, "Unknown option: %c\n" USAGE, optopt, argv[0],
+                    argv[0], argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (all_accounts)
+    { // batch over every account
+        if (optind < argc || o_value != NULL)
+        {
+            fprintf(stderr, "Invalid -a usage\n" USAGE, argv[0], argv[0],
+                    argv[0]);
+            exit(EXIT_FAILURE);
+        }
+
+        report_all_accounts(passwd_path, threads < 1 ? 1 : threads, groups);
+        return 0;
+    }
+
+    if (o_value != NULL)
+    { // snapshot
+        if (optind < argc ||
+            (strcmp(o_value, "json") != 0 && strcmp(o_value, "binary") != 0))
+        {
+            fprintf(stderr, "Invalid -o usage\n" USAGE, argv[0], argv[0],
+                    argv[0]);
+            exit(EXIT_FAILURE);
+        }
+
+        report_snapshot(strcmp(o_value, "binary") == 0);
+        return 0;
+    }
+
+    if (optind < argc)
+    { // identity reporter
+        return report_identities(argv + optind, argc - optind, cache_path,
+                                 ttl);
+    }
+
+    // ---- line 1 ----
 
     // to print: My username is <username>, my userid is <UID>, and my
     //           home directory is <path>.
@@ -31,15 +1089,16 @@ int main()
     if (NULL == home_directory_absolute_path)
         home_directory_absolute_path = "NULL";
 
-    return_code = printf(
-        "My username is %s, my userid is %d, and my home directory is %s.\n",
-        username, uid, home_directory_absolute_path);
+    struct outbuf output; // both lines, checked once at the end
+    outbuf_init(&output, STDOUT_FILENO);
 
-    if (return_code < 0)
-    {
-        printf("The call to printf() failed.\n");
-        return 1;
-    }
+    outbuf_string(&output, "My username is ");
+    outbuf_string(&output, username);
+    outbuf_string(&output, ", my userid is ");
+    outbuf_integer(&output, (int)uid, 0);
+    outbuf_string(&output, ", and my home directory is ");
+    outbuf_string(&output, home_directory_absolute_path);
+    outbuf_string(&output, ".\n");
 
     // ---- line 2 ----
 
@@ -51,13 +1110,9 @@ int main()
         if (NULL == shell_path)
             shell_path = "NULL";
 
-        return_code = printf("My SHELL is %s.\n", shell_path);
-
-        if (return_code < 0)
-        {
-            printf("The call to printf() failed.\n");
-            return 1;
-        }
+        outbuf_string(&output, "My SHELL is ");
+        outbuf_string(&output, shell_path);
+        outbuf_string(&output, ".\n");
     }
     else
     { // odd UID
@@ -67,14 +1122,15 @@ int main()
         if (NULL == display_value)
             display_value = "NULL";
 
-        return_code =
-            printf("The value of my DISPLAY variable is %s.\n", display_value);
+        outbuf_string(&output, "The value of my DISPLAY variable is ");
+        outbuf_string(&output, display_value);
+        outbuf_string(&output, ".\n");
+    }
 
-        if (return_code < 0)
-        {
-            printf("The call to printf() failed.\n");
-            return 1;
-        }
+    if (outbuf_close(&output) == -1)
+    {
+        fprintf(stderr, "The call to write() failed.\n");
+        return 1;
     }
 
     return 0;
@@ -0,0 +1,120 @@
+/**
+ * Title:         wtmpgen.c
+ * Description:   Writes a synthetic wtmp file for benchmarking logdata
+ * Purpose:       Generates login and logout records of a number of users
+ *                over a number of terminal lines, the way login(1) and
+ *                init would, with a reboot every so often. The same
+ *                arguments always give the same file.
+ * Usage:         $ wtmpgen <file> <sessions> [users]
+ *                sessions: number of login/logout pairs
+ *                users: number of distinct users, default 100
+ * Build with:    gcc -o wtmpgen wtmpgen.c
+ */
+
+#define USAGE \
+    "Usage:\n\
+$ %s <file> <sessions> [users]\n\
+sessions: number of login/logout pairs\n\
+users: number of distinct users, default 100\n"
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utmpx.h>
+
+#define LINES 64              // terminal lines sessions rotate over
+#define REBOOT_INTERVAL 50000 // sessions between reboots
+
+/**
+ * Deterministic pseudo-random numbers (xorshift64).
+ */
+static uint64_t next_random(uint64_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+/**
+ * Appends one record.
+ */
+static void write_record(FILE *file, short type, const char *user,
+                         const char *line, int64_t seconds)
+{
+    struct utmpx record;
+    memset(&record, 0, sizeof(record));
+
+    record.ut_type = type;
+    record.ut_pid = 1000 + (seconds & 0x7fff);
+    strncpy(record.ut_user, user, sizeof(record.ut_user));
+    strncpy(record.ut_line, line, sizeof(record.ut_line));
+    record.ut_tv.tv_sec = seconds;
+
+    if (1 != fwrite(&record, sizeof(record), 1, file))
+    {
+        perror("fwrite()");
+        exit(EXIT_FAILURE);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3 || argc > 4)
+    {
+        fprintf(stderr, USAGE, argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    const long sessions = strtol(argv[2], NULL, 10);
+    const long users = (argc == 4) ? strtol(argv[3], NULL, 10) : 100;
+    if (sessions < 0 || users < 1)
+    {
+        fprintf(stderr, "Invalid counts\n" USAGE, argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    FILE *file = fopen(argv[1], "w");
+    if (NULL == file)
+    {
+        perror(argv[1]);
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t state = 0x9e3779b97f4a7c15;
+    int64_t now = 1600000000;
+    char logged_in[LINES] = {0}; // whether each line has a session open
+
+    for (long i = 0; i < sessions; i++)
+    {
+        if (i % REBOOT_INTERVAL == REBOOT_INTERVAL - 1)
+        { // closes every open session
+            write_record(file, BOOT_TIME, "reboot", "~", now);
+            memset(logged_in, 0, sizeof(logged_in));
+        }
+
+        const int line_number = next_random(&state) % LINES;
+        char line[16];
+        snprintf(line, sizeof(line), "pts/%d", line_number);
+
+        if (logged_in[line_number])
+            write_record(file, DEAD_PROCESS, "", line, now);
+
+        char user[32];
+        snprintf(user, sizeof(user), "user%ld",
+                 (long)(next_random(&state) % users));
+        now += 1 + next_random(&state) % 600;
+        write_record(file, USER_PROCESS, user, line, now);
+        logged_in[line_number] = 1;
+    }
+
+    if (0 != fclose(file))
+    {
+        perror("fclose()");
+        exit(EXIT_FAILURE);
+    }
+
+    return 0;
+}
@@ -10,32 +10,2002 @@
  *                and also include the time only if the interval involves
  *                units that are less than a day.
  *                Format of dates and times will follow locale settings.
- * Usage:         $ datelist [-c <count>] <schedule>
+ *                Several schedules can be supplied at once. They are
+ *                generated lazily and merged through a min-heap into one
+ *                time-ordered stream, so memory use only grows with the
+ *                number of schedules.
+ * Usage:         $ datelist [-c <count>] [-u] [-e] [-r] [-z <zones>] [-o <mode>]
+ *                           [-H <holiday file>]
+ *                           <schedule> [<schedule> ...]
+ *                $ datelist -S <socket> [-o <mode>] [-e] [-H <holiday file>]
+ *                $ datelist -B
  *                Omitting the count implies a count of 10.
+ *                The count is the number of lines printed in total.
+ *                -u to print coincident instants of several schedules once
  *                The schedule is made of a number, space, time unit,
  *                multiple of these can be supplied, each space seperated.
  *                Time units cannot repeat.
+ *                A schedule can be prefixed by `label:`, in which case the
+ *                label is printed after each of its instants.
+ *                `business day[s]` (or bday[s]) steps over weekends and the
+ *                holidays listed in the file given with -H <file>, one
+ *                YYYY-MM-DD date per line. Holidays are kept as per-year
+ *                bitmaps and skipped 64 days at a time by popcount.
+ *                Business days are counted from the date before any other
+ *                unit of the schedule is added.
+ *                millisecond[s] (ms), microsecond[s] (us) and
+ *                nanosecond[s] (ns) give sub-second schedules, whose
+ *                instants are printed with 9 fractional digits.
+ *                Schedules step on the wall clock by default: units are
+ *                added to the local date and time fields, so "1 day" keeps
+ *                the time of day across DST changes.
+ *                -e to step by exact elapsed durations instead: the
+ *                schedule's total duration is added with timespec
+ *                arithmetic, without struct tm, so "1 hour" is always 3600
+ *                seconds. Years, months and business days can't be exact.
+ *                -r to print each instant at the moment it happens, as a
+ *                tick generator feeding a pipe: datelist sleeps until each
+ *                instant with clock_nanosleep(TIMER_ABSTIME), and the
+ *                merge heap serves as the single timer for all schedules.
+ *                Lateness mean/max/jitter is reported on stderr at the end
+ *                or on SIGINT/SIGTERM.
+ *                -z zone[,zone...] to print each instant in every listed
+ *                time zone, one tab separated column per zone. The zones'
+ *                TZif files are loaded once into in-memory transition
+ *                tables, each instant costs a binary search per zone.
+ *                Schedules still step in the local time zone (TZ).
+ *                -o mode to pick the output format, skipping strftime(3)
+ *                for all but the default:
+ *                  locale     dates/times per locale settings (default)
+ *                  epoch      decimal seconds since the epoch
+ *                  epoch-ns   decimal nanoseconds since the epoch
+ *                  iso        ISO-8601 in UTC, e.g. 2024-02-29T13:00:00Z
+ *                  binary     little-endian int64 seconds since the epoch
+ *                  binary-ns  little-endian int64 nanoseconds since the epoch
+ *                Binary modes write neither labels nor newlines.
+ *                -S socket to run as a daemon answering queries on a Unix
+ *                socket instead, one per line:
+ *                  [@<start epoch seconds>] <count> <schedule>
+ *                The reply is count instants, one per line, then an empty
+ *                line (or "error: <message>" then an empty line). Replies
+ *                default to epoch seconds. Parsed schedules are cached
+ *                across queries. Only the daemon's user can connect to
+ *                the socket. A client that doesn't read its replies only
+ *                stalls itself. SIGINT/SIGTERM stop the daemon.
+ *                -B to check datelist's engine against the plain mktime(3)/
+ *                localtime(3)/strftime(3) path over a corpus of zones
+ *                (DST in both hemispheres, 30 minute DST, UTC), month ends,
+ *                leap years and DST eves, then report instants/sec and
+ *                bytes/sec of every output mode. Exits with failure if any
+ *                result differs from the reference.
+ *                Schedule parsing and generation live in schedule.c, see
+ *                schedule.h to use them from other programs.
+ * Build with:    gcc -o datelist datelist.c schedule.c outbuf.c -lm
  */
 
-#define _XOPEN_SOURCE
+#define _XOPEN_SOURCE 700
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <locale.h>
+#include <math.h> // must build with -lm
+#include <poll.h>
+#include <signal.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "multicall.h"
+#include "outbuf.h"
+#include "probes.h"
+#include "schedule.h"
+
 #define USAGE \
     "Usage: \
-%s [-c <count>] <schedule>\nWhere schedule consists of one or \
-more of: <number> year[s] | month[s] | week[s] | day[s] | hour[s] | \
-minute[s]"
+%s [-c <count>] [-u] [-e] [-r] [-z <zones>] [-o <mode>] [-H <file>] \
+<schedule> [<schedule> ...]\nWhere schedule is \
+[<label>:] followed by one or more of: <number> year[s] | month[s] | \
+week[s] | day[s] | business day[s] | hour[s] | minute[s] | second[s] | \
+millisecond[s] (ms) | microsecond[s] (us) | nanosecond[s] (ns)\n\
+-e to step by exact elapsed durations instead of on the wall clock\n\
+-r to print each instant when it happens, lateness goes to stderr\n\
+-H <file> to read holidays (YYYY-MM-DD lines) for business days\n\
+-u to print coincident instants once\n\
+-z <zone>[,<zone>...] to print each instant in every listed time zone\n\
+-o locale | epoch | epoch-ns | iso | binary | binary-ns for the output mode\n\
+-S <socket> to answer \"[@<start>] <count> <schedule>\" queries on a socket\n\
+   instead, taking only -o, -e and -H\n\
+-B to check the engine against mktime/localtime/strftime and benchmark it"
+
+enum output_mode
+{
+    OUTPUT_LOCALE,   // strftime(3) with the locale's date (and time)
+    OUTPUT_EPOCH,    // decimal seconds since the epoch
+    OUTPUT_EPOCH_NS, // decimal nanoseconds since the epoch
+    OUTPUT_ISO,      // ISO-8601 in UTC, e.g. 2024-02-29T13:00:00Z
+    OUTPUT_BINARY,   // little-endian int64 seconds since the epoch
+    OUTPUT_BINARY_NS // little-endian int64 nanoseconds since the epoch
+};
+
+/**
+ * A schedule being merged with the others.
+ */
+struct stream
+{
+    struct schedule schedule;
+    struct schedule_iterator iterator; // instant is used as the heap key
+    int index; // position on the command line, breaks ties
+};
+
+static char *program_name; // argv[0], for USAGE
+
+static volatile sig_atomic_t stop_requested = 0; // set by SIGINT/SIGTERM
+
+static void handle_stop(int signal_number)
+{
+    stop_requested = 1;
+}
+
+/**
+ * Makes SIGINT and SIGTERM set stop_requested and interrupt blocking calls.
+ */
+static void catch_stop_signals(void)
+{
+    struct sigaction action = {0};
+    action.sa_handler = handle_stop;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+}
+
+// --------------------------------- heap -----------------------------------
+
+/**
+ * Moves a stream on to its schedule's next instant.
+ * Exits if the instant can't be represented.
+ */
+static void advance_stream(struct stream *stream)
+{
+    if (-1 == schedule_next(&stream->iterator, NULL))
+    {
+        perror("error with mktime() after adding time adjustment: ");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Orders streams by their next instant, then by command line position.
+ * @returns true if a comes out of the heap before b
+ */
+static bool stream_before(const struct stream *a, const struct stream *b)
+{
+    int order = timespec_compare(a->iterator.instant, b->iterator.instant);
+    if (order != 0)
+        return order < 0;
+    return a->index < b->index;
+}
+
+/**
+ * Restores the min-heap property downwards from position i.
+ * @param heap Array of streams forming a binary min-heap
+ * @param size Number of streams in the heap
+ * @param i Position of the stream that may be out of place
+ */
+static void sift_down(struct stream **heap, int size, int i)
+{
+    while (true)
+    {
+        int smallest = i;
+        int left = 2 * i + 1;
+        int right = 2 * i + 2;
+
+        if (left < size && stream_before(heap[left], heap[smallest]))
+            smallest = left;
+        if (right < size && stream_before(heap[right], heap[smallest]))
+            smallest = right;
+
+        if (smallest == i)
+            break;
+
+        struct stream *temp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = temp;
+        i = smallest;
+    }
+}
+
+// ------------------------------- time zones -------------------------------
+
+/**
+ * A local time type of a zone, as stored in TZif files.
+ */
+struct tz_type
+{
+    int32_t utoff; // seconds east of UTC
+    bool isdst;
+    char abbr[16];
+};
+
+/**
+ * A POSIX TZ rule date: Jn, n, or Mm.w.d, plus the local time of day the
+ * change happens at.
+ */
+struct tz_rule_date
+{
+    char kind;   // 'J' (1-365, no leap day), 'D' (0-365), 'M' (month rule)
+    int day;     // day for 'J' and 'D', weekday for 'M'
+    int week;    // 'M' only, 5 means last
+    int month;   // 'M' only, 1-12
+    int32_t time; // seconds after local midnight
+};
+
+/**
+ * The POSIX TZ string found at the end of a TZif file. It describes the
+ * zone for instants after the last transition in the file.
+ */
+struct tz_rule
+{
+    struct tz_type std;
+    struct tz_type dst;
+    bool has_dst;
+    struct tz_rule_date start; // change to daylight time
+    struct tz_rule_date end;   // change back to standard time
+};
+
+/**
+ * A zone loaded once from its TZif file into in-memory transition arrays.
+ */
+struct zone
+{
+    char *name;
+    int64_t *transitions;      // sorted instants of offset changes
+    uint8_t *transition_types; // index into types, per transition
+    int transition_count;
+    struct tz_type *types;
+    int type_count;
+    bool has_rule; // whether rule applies after the last transition
+    struct tz_rule rule;
+};
+
+/**
+ * Reads a big-endian signed integer of the given width from a TZif file.
+ */
+static int64_t read_big_endian(const unsigned char *bytes, int width)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < width; i++)
+        value = (value << 8) | bytes[i];
+
+    if (width == 4)
+        return (int32_t)value;
+    return (int64_t)value;
+}
+
+/**
+ * Parses a zone abbreviation of a POSIX TZ string, either alphabetic or
+ * quoted in <>.
+ * @returns pointer past the abbreviation, or NULL if malformed
+ */
+static const char *parse_tz_abbr(const char *text, char *abbr)
+{
+    size_t length = 0;
+
+    if (*text == '<')
+    {
+        text++;
+        while (*text != '\0' && *text != '>' && length < 15)
+            abbr[length++] = *text++;
+        if (*text != '>')
+            return NULL;
+        text++;
+    }
+    else
+    {
+        while (((*text >= 'A' && *text <= 'Z') ||
+                (*text >= 'a' && *text <= 'z')) &&
+               length < 15)
+            abbr[length++] = *text++;
+    }
+
+    abbr[length] = '\0';
+    return length < 3 ? NULL : text;
+}
+
+/**
+ * Parses [+-]hh[:mm[:ss]] of a POSIX TZ string.
+ * @returns pointer past the time, or NULL if malformed
+ */
+static const char *parse_tz_time(const char *text, int32_t *seconds)
+{
+    int sign = 1;
+    if (*text == '+' || *text == '-')
+    {
+        sign = (*text == '-') ? -1 : 1;
+        text++;
+    }
+
+    if (*text < '0' || *text > '9')
+        return NULL;
+
+    char *end_ptr;
+    long hours = strtol(text, &end_ptr, 10);
+    long minutes = 0;
+    long secs = 0;
+
+    if (*end_ptr == ':')
+    {
+        minutes = strtol(end_ptr + 1, &end_ptr, 10);
+        if (*end_ptr == ':')
+            secs = strtol(end_ptr + 1, &end_ptr, 10);
+    }
+
+    *seconds = sign * (hours * 3600 + minutes * 60 + secs);
+    return end_ptr;
+}
+
+/**
+ * Parses a ,date[/time] part of a POSIX TZ string.
+ * @returns pointer past the date, or NULL if malformed
+ */
+static const char *parse_tz_rule_date(const char *text,
+                                      struct tz_rule_date *date)
+{
+    char *end_ptr;
+
+    if (*text == 'M')
+    {
+        date->kind = 'M';
+        date->month = strtol(text + 1, &end_ptr, 10);
+        if (*end_ptr != '.')
+            return NULL;
+        date->week = strtol(end_ptr + 1, &end_ptr, 10);
+        if (*end_ptr != '.')
+            return NULL;
+        date->day = strtol(end_ptr + 1, &end_ptr, 10);
+        if (date->month < 1 || date->month > 12 || date->week < 1 ||
+            date->week > 5 || date->day < 0 || date->day > 6)
+            return NULL;
+    }
+    else if (*text == 'J')
+    {
+        date->kind = 'J';
+        date->day = strtol(text + 1, &end_ptr, 10);
+    }
+    else if (*text >= '0' && *text <= '9')
+    {
+        date->kind = 'D';
+        date->day = strtol(text, &end_ptr, 10);
+    }
+    else
+    {
+        return NULL;
+    }
+
+    date->time = 2 * 3600; // default 02:00:00
+    text = end_ptr;
+
+    if (*text == '/')
+        text = parse_tz_time(text + 1, &date->time);
+
+    return text;
+}
+
+/**
+ * Parses the POSIX TZ string footer of a TZif file, such as
+ * "EST5EDT,M3.2.0,M11.1.0".
+ * @returns true if the rule could be parsed
+ */
+static bool parse_tz_rule(const char *text, struct tz_rule *rule)
+{
+    int32_t offset;
+
+    memset(rule, 0, sizeof(struct tz_rule));
+
+    if (NULL == (text = parse_tz_abbr(text, rule->std.abbr)))
+        return false;
+    if (NULL == (text = parse_tz_time(text, &offset)))
+        return false;
+    rule->std.utoff = -offset; // POSIX offsets are positive west of UTC
+
+    if (*text == '\0')
+        return true; // no daylight time
+
+    if (NULL == (text = parse_tz_abbr(text, rule->dst.abbr)))
+        return false;
+    rule->has_dst = true;
+    rule->dst.isdst = true;
+    rule->dst.utoff = rule->std.utoff + 3600; // default one hour ahead
+
+    if (*text != ',' && *text != '\0')
+    {
+        if (NULL == (text = parse_tz_time(text, &offset)))
+            return false;
+        rule->dst.utoff = -offset;
+    }
+
+    if (*text != ',')
+        return false; // rule-less daylight time is not used by tzdata
+    if (NULL == (text = parse_tz_rule_date(text + 1, &rule->start)))
+        return false;
+    if (*text != ',')
+        return false;
+    if (NULL == (text = parse_tz_rule_date(text + 1, &rule->end)))
+        return false;
+
+    return *text == '\0';
+}
+
+/**
+ * Instant, in UTC, at which a rule date happens in the given year.
+ * @param utoff Offset of the local time the rule date is expressed in
+ */
+static int64_t tz_rule_instant(int64_t year, const struct tz_rule_date *date,
+                               int32_t utoff)
+{
+    int64_t days = days_from_civil(year, 1, 1);
+
+    switch (date->kind)
+    {
+    case 'J': // 1-365, February 29th is never counted
+        days += date->day - 1;
+        if (is_leap_year(year) && date->day >= 60)
+            days++;
+        break;
+    case 'D': // 0-365, counting February 29th
+        days += date->day;
+        break;
+    case 'M': // day d of week w of month m
+    {
+        int64_t first = days_from_civil(year, date->month, 1);
+        int first_weekday = (int)(((first + 4) % 7 + 7) % 7); // 1970: Thu
+        int month_day = 1 + (date->day - first_weekday + 7) % 7 +
+                        (date->week - 1) * 7;
+        while (month_day > days_in_month(year, date->month))
+            month_day -= 7; // week 5 means the last one
+        days = first + month_day - 1;
+        break;
+    }
+    }
+
+    return days * 86400 + date->time - utoff;
+}
+
+/**
+ * Evaluates a POSIX TZ rule at an instant.
+ * @returns the local time type in effect
+ */
+static const struct tz_type *tz_rule_lookup(const struct tz_rule *rule,
+                                            int64_t instant)
+{
+    if (!rule->has_dst)
+        return &rule->std;
+
+    // year of the instant in standard time
+    int64_t days = (instant + rule->std.utoff) / 86400;
+    if ((instant + rule->std.utoff) % 86400 < 0)
+        days--;
+    int64_t year = 1970 + days / 365;
+    while (days_from_civil(year, 1, 1) > days)
+        year--;
+    while (days_from_civil(year + 1, 1, 1) <= days)
+        year++;
+
+    // daylight time starts in standard time, ends in daylight time
+    int64_t start = tz_rule_instant(year, &rule->start, rule->std.utoff);
+    int64_t end = tz_rule_instant(year, &rule->end, rule->dst.utoff);
+
+    bool in_dst;
+    if (start < end)
+    { // northern hemisphere
+        in_dst = start <= instant && instant < end;
+    }
+    else
+    { // southern hemisphere, daylight time spans the new year
+        in_dst = !(end <= instant && instant < start);
+    }
+
+    return in_dst ? &rule->dst : &rule->std;
+}
+
+/**
+ * Counts of a TZif header, as unsigned 32-bit numbers.
+ */
+struct tzif_counts
+{
+    uint32_t isutcnt, isstdcnt, leapcnt, timecnt, typecnt, charcnt;
+    uint64_t length; // bytes of the data block after the 44-byte header
+};
+
+/**
+ * Reads the counts of a TZif header and checks that the data block they
+ * describe fits in what is left of the file.
+ * @param header Start of the header
+ * @param time_width Bytes of a transition time: 4 in version 1 blocks, 8
+ *                   in the 64-bit block of later versions
+ * @param available Bytes from header to the end of the file
+ * @returns true if the header and its data block fit
+ */
+static bool read_tzif_counts(const unsigned char *header, int time_width,
+                             size_t available, struct tzif_counts *counts)
+{
+    if (available < 44)
+        return false;
+
+    counts->isutcnt = (uint32_t)read_big_endian(header + 20, 4);
+    counts->isstdcnt = (uint32_t)read_big_endian(header + 24, 4);
+    counts->leapcnt = (uint32_t)read_big_endian(header + 28, 4);
+    counts->timecnt = (uint32_t)read_big_endian(header + 32, 4);
+    counts->typecnt = (uint32_t)read_big_endian(header + 36, 4);
+    counts->charcnt = (uint32_t)read_big_endian(header + 40, 4);
+
+    // at most 12 times 2^32 per section, no overflow in 64 bits
+    counts->length = (uint64_t)counts->timecnt * (time_width + 1) +
+                     (uint64_t)counts->typecnt * 6 + counts->charcnt +
+                     (uint64_t)counts->leapcnt * (time_width + 4) +
+                     counts->isstdcnt + counts->isutcnt;
+
+    return counts->length <= available - 44;
+}
+
+/**
+ * Loads a zone's TZif file into in-memory transition arrays.
+ * Looks the name up under $TZDIR (/usr/share/zoneinfo by default) unless it
+ * is an absolute path. Exits if the file can't be read or is malformed.
+ * @param name Zone name, e.g. Europe/Paris
+ * @param zone Zone to fill out
+ */
+static void load_zone(const char *name, struct zone *zone)
+{
+    // locating and reading the file
+
+    const char *directory = getenv("TZDIR");
+    if (NULL == directory)
+        directory = "/usr/share/zoneinfo";
+
+    char path[PATH_MAX];
+    if (name[0] == '/')
+        snprintf(path, sizeof(path), "%s", name);
+    else
+        snprintf(path, sizeof(path), "%s/%s", directory, name);
+
+    FILE *file = fopen(path, "rb");
+    if (NULL == file)
+    {
+        fprintf(stderr, "fopen(): could not open zone file %s: %s\n", path,
+                strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    unsigned char *data = NULL;
+    size_t size = 0;
+    size_t capacity = 0;
+
+    while (true)
+    {
+        if (size == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 4096;
+            data = realloc(data, capacity + 1);
+            if (NULL == data)
+            {
+                fprintf(stderr, "realloc(): failed to allocate memory\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        size_t read = fread(data + size, 1, capacity - size, file);
+        size += read;
+        if (read == 0)
+            break;
+    }
+
+    if (ferror(file))
+    {
+        fprintf(stderr, "fread(): error reading zone file %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    fclose(file);
+    data[size] = '\0'; // terminates the footer
+
+    // header: magic, version, 15 reserved bytes, six counts
+
+    if (size < 44 || memcmp(data, "TZif", 4) != 0)
+    {
+        fprintf(stderr, "%s is not a TZif file\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    const unsigned char *header = data;
+    int time_width = 4;
+    struct tzif_counts counts;
+
+    if (!read_tzif_counts(header, time_width, size, &counts))
+    {
+        fprintf(stderr, "%s: malformed TZif file\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    if (data[4] >= '2')
+    { // skip the 32-bit data block, use the 64-bit one that follows
+        const size_t skip = 44 + counts.length;
+        if (skip + 44 > size || memcmp(data + skip, "TZif", 4) != 0 ||
+            !read_tzif_counts(data + skip, 8, size - skip, &counts))
+        {
+            fprintf(stderr, "%s: malformed TZif file\n", path);
+            exit(EXIT_FAILURE);
+        }
+
+        header = data + skip;
+        time_width = 8;
+    }
+
+    // each section is within the file, read_tzif_counts() checked
+    const uint32_t timecnt = counts.timecnt;
+    const uint32_t typecnt = counts.typecnt;
+    const uint32_t charcnt = counts.charcnt;
+    const unsigned char *times = header + 44;
+    const unsigned char *indices = times + (size_t)timecnt * time_width;
+    const unsigned char *types = indices + timecnt;
+    const unsigned char *chars = types + (size_t)typecnt * 6;
+    const unsigned char *footer = header + 44 + counts.length;
+
+    if (typecnt < 1)
+    {
+        fprintf(stderr, "%s: malformed TZif file\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    // transition arrays
+
+    zone->name = strdup(name);
+    zone->transition_count = timecnt;
+    zone->transitions = malloc((timecnt + 1) * sizeof(int64_t));
+    zone->transition_types = malloc(timecnt + 1);
+    zone->type_count = typecnt;
+    zone->types = calloc(typecnt, sizeof(struct tz_type));
+
+    if (NULL == zone->name || NULL == zone->transitions ||
+        NULL == zone->transition_types || NULL == zone->types)
+    {
+        fprintf(stderr, "malloc(): failed to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (uint32_t i = 0; i < timecnt; i++)
+    {
+        zone->transitions[i] =
+            read_big_endian(times + i * time_width, time_width);
+        zone->transition_types[i] = indices[i];
+        if (indices[i] >= typecnt)
+        {
+            fprintf(stderr, "%s: malformed TZif file\n", path);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for (uint32_t i = 0; i < typecnt; i++)
+    {
+        const unsigned char *type = types + i * 6;
+        zone->types[i].utoff = read_big_endian(type, 4);
+        zone->types[i].isdst = type[4];
+        if (type[5] < charcnt)
+            snprintf(zone->types[i].abbr, sizeof(zone->types[i].abbr), "%s",
+                     (const char *)chars + type[5]);
+    }
+
+    // footer: newline, POSIX TZ string, newline
+
+    zone->has_rule = false;
+
+    if (time_width == 8 && footer < data + size && *footer == '\n')
+    {
+        char *rule_text = (char *)footer + 1;
+        char *newline = strchr(rule_text, '\n');
+        if (NULL != newline)
+        {
+            *newline = '\0';
+            zone->has_rule =
+                *rule_text != '\0' && parse_tz_rule(rule_text, &zone->rule);
+        }
+    }
+
+    free(data);
+}
+
+/**
+ * Finds the local time type of a zone at an instant, by binary search over
+ * the zone's transitions.
+ */
+static const struct tz_type *zone_lookup(const struct zone *zone,
+                                         int64_t instant)
+{
+    int count = zone->transition_count;
+
+    if (count == 0 || instant < zone->transitions[0])
+    { // before any transition: the zone's first type
+        if (count == 0 && zone->has_rule)
+            return tz_rule_lookup(&zone->rule, instant);
+        return &zone->types[0];
+    }
+
+    if (instant >= zone->transitions[count - 1] && zone->has_rule)
+        return tz_rule_lookup(&zone->rule, instant);
+
+    // last transition at or before instant
+    int low = 0;
+    int high = count - 1;
+    while (low < high)
+    {
+        int middle = low + (high - low + 1) / 2;
+        if (zone->transitions[middle] <= instant)
+            low = middle;
+        else
+            high = middle - 1;
+    }
+
+    return &zone->types[zone->transition_types[low]];
+}
+
+// -------------------------------- output ----------------------------------
+
+/**
+ * Writes a two digit, zero padded number.
+ */
+static void format_two_digits(int value, char *buffer)
+{
+    buffer[0] = '0' + value / 10;
+    buffer[1] = '0' + value % 10;
+}
+
+/**
+ * Writes an instant as ISO-8601 in UTC (YYYY-MM-DDTHH:MM:SSZ).
+ * @param seconds Seconds since the epoch
+ * @param buffer Destination, at least 32 bytes, not null terminated
+ * @returns number of bytes written
+ */
+static size_t format_iso8601(int64_t seconds, char *buffer)
+{
+    struct tm utc;
+    civil_from_seconds(seconds, &utc);
+
+    int64_t year = utc.tm_year + 1900LL;
+    size_t length;
+
+    if (year >= 0 && year <= 9999)
+    {
+        buffer[0] = '0' + year / 1000;
+        buffer[1] = '0' + year / 100 % 10;
+        buffer[2] = '0' + year / 10 % 10;
+        buffer[3] = '0' + year % 10;
+        length = 4;
+    }
+    else
+    { // expanded representation
+        length = format_integer(year, buffer);
+    }
+
+    buffer[length] = '-';
+    format_two_digits(utc.tm_mon + 1, buffer + length + 1);
+    buffer[length + 3] = '-';
+    format_two_digits(utc.tm_mday, buffer + length + 4);
+    buffer[length + 6] = 'T';
+    format_two_digits(utc.tm_hour, buffer + length + 7);
+    buffer[length + 9] = ':';
+    format_two_digits(utc.tm_min, buffer + length + 10);
+    buffer[length + 12] = ':';
+    format_two_digits(utc.tm_sec, buffer + length + 13);
+    buffer[length + 15] = 'Z';
+
+    return length + 16;
+}
+
+/**
+ * Writes the 9 digit fraction of a second, dot included.
+ * @returns number of bytes written
+ */
+static size_t format_fraction(long nanoseconds, char *buffer)
+{
+    buffer[0] = '.';
+    for (int digit = 9; digit >= 1; digit--)
+    {
+        buffer[digit] = '0' + nanoseconds % 10;
+        nanoseconds /= 10;
+    }
+    return 10;
+}
+
+/**
+ * Nanoseconds since the epoch of an instant, as an int64 (years 1678-2262).
+ */
+static int64_t instant_nanoseconds(struct timespec instant)
+{
+    return (int64_t)instant.tv_sec * 1000000000 + instant.tv_nsec;
+}
+
+/**
+ * Formats an instant per a text output mode.
+ * @param mode Output mode, not a binary one
+ * @param date_format strftime(3) format for OUTPUT_LOCALE
+ * @param local Broken-down local time of the instant, for OUTPUT_LOCALE
+ * @param instant Instant to format
+ * @param subsecond Whether to show fractions of a second
+ * @param buffer Destination, at least 48 bytes, not null terminated
+ * @param size Size of buffer
+ * @returns number of bytes written, 0 if the buffer is too small
+ */
+static size_t format_instant(enum output_mode mode, const char *date_format,
+                             const struct tm *local, struct timespec instant,
+                             bool subsecond, char *buffer, size_t size)
+{
+    size_t length = 0;
+
+    switch (mode)
+    {
+    case OUTPUT_EPOCH:
+        if (subsecond && instant.tv_sec < 0 && instant.tv_nsec > 0)
+        { // -1 s + 0.25 s is -0.75 s
+            buffer[length++] = '-';
+            length += format_integer(-(instant.tv_sec + 1), buffer + length);
+            length += format_fraction(1000000000 - instant.tv_nsec,
+                                      buffer + length);
+            break;
+        }
+        length = format_integer((int64_t)instant.tv_sec, buffer);
+        if (subsecond)
+            length += format_fraction(instant.tv_nsec, buffer + length);
+        break;
+    case OUTPUT_EPOCH_NS:
+        length = format_integer(instant_nanoseconds(instant), buffer);
+        break;
+    case OUTPUT_ISO:
+        length = format_iso8601((int64_t)instant.tv_sec, buffer);
+        if (subsecond)
+        { // fraction goes before the Z
+            length += format_fraction(instant.tv_nsec, buffer + length - 1);
+            buffer[length - 1] = 'Z';
+        }
+        break;
+    case OUTPUT_LOCALE:
+        length = strftime(buffer, size - 10, date_format, local);
+        if (length != 0 && subsecond)
+            length += format_fraction(instant.tv_nsec, buffer + length);
+        break;
+    default: // binary modes aren't text
+        break;
+    }
+
+    return length;
+}
+
+// ------------------------------- real time --------------------------------
+
+/**
+ * How late instants were emitted, in nanoseconds.
+ */
+struct lateness
+{
+    long count;
+    double sum;
+    double sum_of_squares;
+    int64_t max;
+};
+
+/**
+ * Sleeps until an instant of CLOCK_REALTIME, then records how late the
+ * wake-up was. Instants already past are not waited for.
+ * @returns false if interrupted by SIGINT/SIGTERM
+ */
+static bool wait_until(struct timespec instant, struct lateness *lateness)
+{
+    int error;
+    while (0 != (error = clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME,
+                                         &instant, NULL)))
+    {
+        if (error != EINTR)
+        {
+            fprintf(stderr, "clock_nanosleep(): %s\n", strerror(error));
+            exit(EXIT_FAILURE);
+        }
+        if (stop_requested)
+            return false;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    int64_t late = (int64_t)(now.tv_sec - instant.tv_sec) * 1000000000 +
+                   (now.tv_nsec - instant.tv_nsec);
+
+    lateness->count++;
+    lateness->sum += late;
+    lateness->sum_of_squares += (double)late * late;
+    if (late > lateness->max)
+        lateness->max = late;
+
+    return !stop_requested;
+}
+
+/**
+ * Prints lateness statistics to stderr, in microseconds.
+ */
+static void report_lateness(const struct lateness *lateness)
+{
+    if (lateness->count == 0)
+        return;
+
+    double mean = lateness->sum / lateness->count;
+    double variance = lateness->sum_of_squares / lateness->count - mean * mean;
+
+    fprintf(stderr,
+            "%ld instants, lateness mean %.1f us, max %.1f us, "
+            "jitter (stddev) %.1f us\n",
+            lateness->count, mean / 1000, lateness->max / 1000.0,
+            sqrt(variance > 0 ? variance : 0) / 1000);
+}
+
+// -------------------------------- daemon ----------------------------------
+
+#define CACHE_BUCKETS 1024  // hash buckets of the parsed schedule cache
+#define CACHE_LIMIT 16384   // parsed schedules kept before starting over
+#define MAX_CLIENTS 256     // connections served at once
+#define QUERY_LENGTH 4096   // longest query line
+#define MAX_QUERY_COUNT 1000000 // most instants per query
+#define REPLY_LENGTH 16384  // reply bytes generated at once for a client
+#define INSTANT_LENGTH 1024 // room for one formatted instant and newline
+
+/**
+ * A parsed schedule, cached by its text.
+ */
+struct cached_schedule
+{
+    char *text;
+    uint64_t hash;
+    struct schedule schedule;
+    long users;                   // queries being answered from it
+    struct cached_schedule *next; // same bucket
+};
+
+static struct cached_schedule *cache[CACHE_BUCKETS];
+static long cache_size = 0;
+static long cache_hits = 0;
+
+/**
+ * A connection to the daemon: the part of a query read so far, and the
+ * query being answered. Replies are generated REPLY_LENGTH bytes at a time,
+ * each chunk once the previous one was written, so a client that doesn't
+ * read holds up no one but itself.
+ */
+struct client
+{
+    int fd; // non-blocking
+    char buffer[QUERY_LENGTH];
+    size_t length;
+    char reply[REPLY_LENGTH];
+    size_t reply_length;
+    size_t reply_sent;
+    struct cached_schedule *answering; // NULL between queries
+    struct schedule_iterator iterator;
+    long remaining; // instants still to generate
+    bool closing;   // hang up once the reply is written
+};
+
+/**
+ * 64-bit FNV-1a hash of a string.
+ */
+static uint64_t hash_text(const char *text)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    while (*text != '\0')
+    {
+        hash ^= (unsigned char)*text++;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * Drops every cached schedule but those queries are being answered from.
+ */
+static void clear_cache(void)
+{
+    cache_size = 0;
+    for (int bucket = 0; bucket < CACHE_BUCKETS; bucket++)
+    {
+        struct cached_schedule **link = &cache[bucket];
+        while (NULL != *link)
+        {
+            struct cached_schedule *entry = *link;
+            if (entry->users > 0)
+            {
+                cache_size++;
+                link = &entry->next;
+                continue;
+            }
+            *link = entry->next;
+            schedule_free(&entry->schedule);
+            free(entry->text);
+            free(entry);
+        }
+    }
+}
+
+/**
+ * Looks a schedule up in the cache, parsing and caching it on a miss.
+ * The daemon's stepping mode is fixed, so it is not part of the key.
+ * @returns the schedule, NULL if it is malformed (error is filled out)
+ */
+static struct cached_schedule *cached_parse(const char *text, bool exact,
+                                            char *error, size_t error_size)
+{
+    uint64_t hash = hash_text(text);
+    struct cached_schedule **bucket = &cache[hash % CACHE_BUCKETS];
+
+    for (struct cached_schedule *entry = *bucket; NULL != entry;
+         entry = entry->next)
+    {
+        if (entry->hash == hash && strcmp(entry->text, text) == 0)
+        {
+            cache_hits++;
+            return entry;
+        }
+    }
+
+    struct cached_schedule *entry = malloc(sizeof(struct cached_schedule));
+    if (NULL == entry)
+    {
+        snprintf(error, error_size, "failed to allocate memory");
+        return NULL;
+    }
+
+    if (-1 == schedule_parse(text, &entry->schedule, error, error_size))
+    {
+        free(entry);
+        return NULL;
+    }
+
+    if (-1 == schedule_exact(&entry->schedule, exact, error, error_size))
+    {
+        schedule_free(&entry->schedule);
+        free(entry);
+        return NULL;
+    }
+
+    entry->text = strdup(text);
+    if (NULL == entry->text)
+    {
+        snprintf(error, error_size, "failed to allocate memory");
+        schedule_free(&entry->schedule);
+        free(entry);
+        return NULL;
+    }
+
+    if (cache_size >= CACHE_LIMIT)
+    { // unbounded clients could otherwise grow the cache forever
+        clear_cache();
+    }
+
+    entry->hash = hash;
+    entry->users = 0;
+    entry->next = *bucket;
+    *bucket = entry;
+    cache_size++;
+
+    return entry;
+}
+
+/**
+ * Queues "error: <message>" and an empty line after the reply so far,
+ * ending the query being answered, if any.
+ */
+static void reply_error(struct client *client, const char *message)
+{
+    if (NULL != client->answering)
+    {
+        client->answering->users--;
+        client->answering = NULL;
+    }
+
+    int length = snprintf(client->reply + client->reply_length,
+                          sizeof(client->reply) - client->reply_length,
+                          "error: %s\n\n", message);
+    client->reply_length += length;
+}
+
+/**
+ * Starts answering a query: "[@<start>] <count> <schedule>". The reply is
+ * one instant per line followed by an empty line, or "error: <message>"
+ * followed by an empty line.
+ * @pre client->reply is empty
+ */
+static void start_query(struct client *client, char *query, bool exact)
+{
+    char error[SCHEDULE_ERROR_LENGTH];
+
+    // optional start time, then count
+
+    struct timespec start;
+    clock_gettime(CLOCK_REALTIME, &start);
+    char *end_ptr;
+
+    while (*query == ' ' || *query == '\t')
+        query++;
+
+    if (*query == '@')
+    {
+        errno = 0;
+        long long value = strtoll(query + 1, &end_ptr, 10);
+        if (errno != 0 || end_ptr == query + 1)
+        {
+            reply_error(client, "Invalid start time");
+            return;
+        }
+        start.tv_sec = value;
+        start.tv_nsec = 0;
+        query = end_ptr;
+    }
+
+    errno = 0;
+    long count = strtol(query, &end_ptr, 10);
+    if (errno != 0 || end_ptr == query || count < 0 ||
+        count > MAX_QUERY_COUNT)
+    {
+        reply_error(client, "Invalid count");
+        return;
+    }
+
+    // schedule
+
+    struct cached_schedule *entry =
+        cached_parse(end_ptr, exact, error, sizeof(error));
+    if (NULL == entry)
+    {
+        reply_error(client, error);
+        return;
+    }
+
+    if (-1 == schedule_iterator_init(&client->iterator, &entry->schedule,
+                                     start))
+    {
+        reply_error(client, "Invalid start time");
+        return;
+    }
+
+    entry->users++; // kept through cache clears until the reply is done
+    client->answering = entry;
+    client->remaining = count;
+}
+
+/**
+ * Generates the next instants of the query being answered, as many as fit
+ * in the client's reply buffer, and the empty line after the last one.
+ */
+static void continue_query(struct client *client, enum output_mode mode)
+{
+    const struct schedule *schedule = &client->answering->schedule;
+    const char *date_format = schedule->date_portion_only ? "%x" : "%x %X";
+    char error[SCHEDULE_ERROR_LENGTH];
+
+    // leaves room for an error message in any case
+    while (client->remaining > 0 &&
+           sizeof(client->reply) - client->reply_length >=
+               INSTANT_LENGTH + SCHEDULE_ERROR_LENGTH + 16)
+    {
+        if (-1 == schedule_next(&client->iterator, NULL))
+        {
+            snprintf(error, sizeof(error), "schedule_next(): %s",
+                     strerror(errno));
+            reply_error(client, error);
+            return;
+        }
+
+        const struct tm *local = NULL;
+        if (mode == OUTPUT_LOCALE &&
+            NULL == (local = schedule_local_time(&client->iterator)))
+        {
+            snprintf(error, sizeof(error), "localtime(): %s",
+                     strerror(errno));
+            reply_error(client, error);
+            return;
+        }
+
+        size_t formatted = format_instant(
+            mode, date_format, local, client->iterator.instant,
+            schedule->subsecond, client->reply + client->reply_length,
+            INSTANT_LENGTH - 1);
+        if (formatted == 0)
+        {
+            reply_error(client, "Failed to format date-time");
+            return;
+        }
+
+        client->reply_length += formatted;
+        client->reply[client->reply_length++] = '\n';
+        client->remaining--;
+    }
+
+    if (client->remaining == 0)
+    {
+        client->reply[client->reply_length++] = '\n';
+        client->answering->users--;
+        client->answering = NULL;
+    }
+}
+
+/**
+ * Moves a client along as far as it goes without blocking: writes what is
+ * queued, then generates one more chunk of the reply or starts the next
+ * complete query line, and writes that. Stops after one chunk, so one
+ * client's long reply doesn't hold up the others' within a poll round.
+ * @param queries Incremented for each query started
+ * @returns 0 to keep the client, -1 to hang up
+ */
+static int advance_client(struct client *client, enum output_mode mode,
+                          bool exact, long *queries)
+{
+    bool generated = false;
+
+    while (true)
+    {
+        while (client->reply_sent < client->reply_length)
+        {
+            ssize_t written =
+                write(client->fd, client->reply + client->reply_sent,
+                      client->reply_length - client->reply_sent);
+            if (written == -1 && errno == EINTR)
+                continue;
+            if (written == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return 0; // POLLOUT tells when to go on
+            if (written == -1)
+                return -1;
+            client->reply_sent += written;
+        }
+        client->reply_length = 0;
+        client->reply_sent = 0;
+
+        if (generated)
+            return 0; // the next chunk waits for the next round
+
+        if (NULL != client->answering)
+        {
+            continue_query(client, mode);
+            generated = true;
+            continue;
+        }
+
+        if (client->closing)
+            return -1;
+
+        char *newline = memchr(client->buffer, '\n', client->length);
+        if (NULL == newline)
+        {
+            if (client->length == sizeof(client->buffer))
+            { // query too long
+                reply_error(client, "Query too long");
+                client->closing = true;
+                generated = true;
+                continue;
+            }
+            return 0; // waits for the rest of the line
+        }
+
+        *newline = '\0';
+        (*queries)++;
+        start_query(client, client->buffer, exact);
+        if (NULL != client->answering)
+            continue_query(client, mode);
+        generated = true;
+
+        client->length -= newline + 1 - client->buffer;
+        memmove(client->buffer, newline + 1, client->length);
+    }
+}
+
+/**
+ * Tells if a client has something to be written, or to be answered
+ * without reading more.
+ */
+static bool client_busy(const struct client *client)
+{
+    return client->reply_length > 0 || NULL != client->answering ||
+           client->closing ||
+           NULL != memchr(client->buffer, '\n', client->length) ||
+           client->length == sizeof(client->buffer);
+}
+
+/**
+ * Closes a client's connection, ending the query being answered.
+ */
+static void close_client(struct client *client)
+{
+    if (NULL != client->answering)
+        client->answering->users--;
+    close(client->fd);
+    free(client);
+}
+
+/**
+ * Listens on a Unix socket and answers next-N-occurrences queries, one per
+ * line, until SIGINT or SIGTERM. Parsed schedules are cached across
+ * queries and connections. Clients are served from one poll(2) loop on
+ * non-blocking sockets: a client's queries are answered in order, one at a
+ * time, and it is only read from while nothing is left to write to it. The
+ * socket is only accessible to the daemon's user. Exits on setup errors.
+ * @param path Path of the socket to create
+ * @param mode Text output mode of the replies
+ * @param exact Whether schedules step by exact elapsed durations
+ */
+static void serve(const char *path, enum output_mode mode, bool exact)
+{
+    // setup
+
+    struct sockaddr_un address = {0};
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "Socket path is too long: %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    strcpy(address.sun_path, path);
+
+    struct stat stat_result;
+    if (0 == lstat(path, &stat_result) && S_ISSOCK(stat_result.st_mode))
+    { // left over from a previous run
+        unlink(path);
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (-1 == listener)
+    {
+        perror("socket()");
+        exit(EXIT_FAILURE);
+    }
+
+    mode_t old_mask = umask(0077); // only the daemon's user may connect
+    if (-1 == bind(listener, (struct sockaddr *)&address, sizeof(address)))
+    {
+        perror("bind()");
+        exit(EXIT_FAILURE);
+    }
+    umask(old_mask);
+
+    if (-1 == listen(listener, SOMAXCONN))
+    {
+        perror("listen()");
+        exit(EXIT_FAILURE);
+    }
+
+    catch_stop_signals();
+    signal(SIGPIPE, SIG_IGN); // clients hanging up are reported by write()
+
+    struct client *clients[MAX_CLIENTS] = {NULL};
+    struct pollfd fds[MAX_CLIENTS + 1];
+    long queries = 0;
+
+    // serve
+
+    while (!stop_requested)
+    {
+        fds[0].fd = listener;
+        fds[0].events = POLLIN;
+        for (int i = 0; i < MAX_CLIENTS; i++)
+        {
+            const struct client *client = clients[i];
+            fds[i + 1].fd = (NULL != client) ? client->fd : -1;
+            fds[i + 1].events =
+                (NULL != client && client_busy(client)) ? POLLOUT : POLLIN;
+        }
+
+        if (-1 == poll(fds, MAX_CLIENTS + 1, -1))
+        {
+            if (errno == EINTR)
+                continue;
+            perror("poll()");
+            exit(EXIT_FAILURE);
+        }
+
+        if (fds[0].revents & POLLIN)
+        { // new connection
+            int fd = accept(listener, NULL, NULL);
+            int slot = 0;
+            while (slot < MAX_CLIENTS && NULL != clients[slot])
+                slot++;
+
+            if (fd != -1 &&
+                (slot == MAX_CLIENTS ||
+                 -1 == fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK)))
+            { // full, or can't be served without blocking
+                close(fd);
+            }
+            else if (fd != -1)
+            {
+                clients[slot] = calloc(1, sizeof(struct client));
+                if (NULL == clients[slot])
+                {
+                    fprintf(stderr, "calloc(): failed to allocate memory\n");
+                    exit(EXIT_FAILURE);
+                }
+                clients[slot]->fd = fd;
+            }
+        }
+
+        for (int i = 0; i < MAX_CLIENTS; i++)
+        {
+            struct client *client = clients[i];
+            if (NULL == client || 0 == fds[i + 1].revents)
+                continue;
+
+            bool hang_up = false;
+            if (fds[i + 1].events == POLLIN)
+            {
+                ssize_t received =
+                    read(client->fd, client->buffer + client->length,
+                         sizeof(client->buffer) - client->length);
+                if (received > 0)
+                    client->length += received;
+                else
+                    hang_up = received == 0 ||
+                              (errno != EAGAIN && errno != EINTR);
+            }
+            else if (fds[i + 1].revents & (POLLERR | POLLHUP))
+                hang_up = true; // can't be written to anymore
+
+            if (hang_up ||
+                -1 == advance_client(client, mode, exact, &queries))
+            {
+                close_client(client);
+                clients[i] = NULL;
+            }
+        }
+    }
+
+    // cleanup
+
+    for (int i = 0; i < MAX_CLIENTS; i++)
+    {
+        if (NULL != clients[i])
+            close_client(clients[i]);
+    }
+
+    close(listener);
+    unlink(path);
+
+    fprintf(stderr, "%ld queries, %ld schedule cache hits\n", queries,
+            cache_hits);
+    clear_cache();
+}
+
+// ------------------------------- self-check -------------------------------
+
+#define CHECK_STEPS 400            // instants generated per corpus case
+#define BENCH_INSTANTS 1000000     // instants generated per output mode
+#define MISMATCHES_SHOWN 10        // mismatches printed before going quiet
+
+/**
+ * Zones of the self-check corpus: DST in both hemispheres, a 30 minute DST
+ * shift, a zone without DST and UTC.
+ */
+static const char *check_zones[] = {
+    "UTC",           "America/New_York", "Europe/London",
+    "Australia/Lord_Howe", "America/Santiago", "Asia/Kolkata",
+};
+
+/**
+ * Local starting times of the self-check corpus: month ends, leap days,
+ * and the eves of DST changes.
+ */
+static const struct
+{
+    int year, month, day, hour, minute;
+} check_starts[] = {
+    {2024, 1, 31, 12, 0},  // month-end clamping
+    {2024, 2, 29, 9, 30},  // leap day
+    {2023, 2, 28, 23, 59}, // non-leap February end
+    {2024, 3, 10, 1, 30},  // US DST starts
+    {2024, 11, 3, 0, 30},  // eve of US DST end, stepping into the repeat
+    {2024, 11, 3, 1, 30},  // US DST ends
+    {2024, 3, 31, 0, 45},  // EU DST starts
+    {2024, 10, 27, 1, 15}, // EU DST ends
+    {2024, 4, 7, 1, 45},   // southern hemisphere DST ends
+    {1999, 12, 31, 23, 0}, // century leap year ahead
+    {2099, 12, 31, 0, 0},  // 2100 is not a leap year
+};
+
+/**
+ * Schedules of the self-check corpus, each with the step it means written
+ * out by hand: the parser must read exactly that, and the reference steps
+ * by it, so a misread unit can't pass on both sides.
+ */
+static const struct
+{
+    const char *text;
+    const char *label; // NULL for none
+    int years, months, days, business_days, hours, minutes, seconds;
+    bool date_only; // date_portion_only
+} check_schedules[] = {
+    {"1 second", NULL, 0, 0, 0, 0, 0, 0, 1, false},
+    {"7 minutes", NULL, 0, 0, 0, 0, 0, 7, 0, false},
+    {"30 minutes", NULL, 0, 0, 0, 0, 0, 30, 0, false},
+    {"1 hour", NULL, 0, 0, 0, 0, 1, 0, 0, false},
+    {"1 day", NULL, 0, 0, 1, 0, 0, 0, 0, true},
+    {"1 day 1 hour", NULL, 0, 0, 1, 0, 1, 0, 0, false},
+    {"1 week", NULL, 0, 0, 7, 0, 0, 0, 0, true},
+    {"2 weeks 3 days", NULL, 0, 0, 17, 0, 0, 0, 0, true},
+    {"3 business days", NULL, 0, 0, 0, 3, 0, 0, 0, true},
+    {"1 month", NULL, 0, 1, 0, 0, 0, 0, 0, true},
+    {"1 month 1 day", NULL, 0, 1, 1, 0, 0, 0, 0, true},
+    {"13 months", NULL, 0, 13, 0, 0, 0, 0, 0, true},
+    {"1 year", NULL, 1, 0, 0, 0, 0, 0, 0, true},
+    {"payday:2 weeks", "payday", 0, 0, 14, 0, 0, 0, 0, true},
+    {"1 second 2 minutes 3 hours", NULL, 0, 0, 0, 0, 3, 2, 1, false},
+    {"1 year 1 month 1 day 1 hour 1 minute 1 second", NULL, 1, 1, 1, 0, 1,
+     1, 1, false},
+};
+
+/**
+ * Schedules of the self-check corpus stepped by exact elapsed durations,
+ * with their step in nanoseconds.
+ */
+static const struct
+{
+    const char *text;
+    long long nanoseconds;
+} check_exact_schedules[] = {
+    {"1 hour", 3600000000000LL},
+    {"1 day", 86400000000000LL},
+    {"1 week 3 days 5 hours", 882000000000000LL},
+    {"1500 milliseconds", 1500000000LL},
+    {"2 ms", 2000000LL},
+    {"250 us", 250000LL},
+    {"3 microseconds", 3000LL},
+    {"999999999 ns", 999999999LL},
+    {"1 day 1 nanosecond", 86400000000001LL},
+};
+
+/**
+ * Seconds of a monotonic clock.
+ */
+static double monotonic_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * Reports a mismatch between the reference and the engine under check.
+ */
+static void check_mismatch(long *mismatches, const char *what,
+                           const char *zone, const char *schedule,
+                           long long instant, const char *expected,
+                           const char *actual)
+{
+    if (++*mismatches <= MISMATCHES_SHOWN)
+    {
+        fprintf(stderr,
+                "MISMATCH %s: zone %s, schedule \"%s\", instant %lld\n"
+                "  reference: %s\n  engine:    %s\n",
+                what, zone, schedule, instant, expected, actual);
+    }
+}
+
+/**
+ * Checks what a corpus schedule parsed to against its expected step.
+ * @param index Index in check_schedules
+ */
+static void check_parse(long *mismatches, size_t index,
+                        const struct schedule *schedule)
+{
+    char expected[256];
+    char actual[256];
+
+    snprintf(expected, sizeof(expected),
+             "%s: %dy %dmo %dd %dbd %dh %dmin %ds, %s",
+             check_schedules[index].label ? check_schedules[index].label
+                                          : "(no label)",
+             check_schedules[index].years, check_schedules[index].months,
+             check_schedules[index].days,
+             check_schedules[index].business_days,
+             check_schedules[index].hours, check_schedules[index].minutes,
+             check_schedules[index].seconds,
+             check_schedules[index].date_only ? "date only" : "with time");
+    snprintf(actual, sizeof(actual),
+             "%s: %dy %dmo %dd %ldbd %dh %dmin %ds, %s",
+             schedule->label ? schedule->label : "(no label)",
+             schedule->adjustment.tm_year, schedule->adjustment.tm_mon,
+             schedule->adjustment.tm_mday, schedule->business_days,
+             schedule->adjustment.tm_hour, schedule->adjustment.tm_min,
+             schedule->adjustment.tm_sec,
+             schedule->date_portion_only ? "date only" : "with time");
+    if (schedule->nanoseconds != 0)
+        snprintf(actual + strlen(actual), sizeof(actual) - strlen(actual),
+                 ", %ldns", schedule->nanoseconds);
+
+    if (strcmp(expected, actual) != 0)
+        check_mismatch(mismatches, "schedule parse", "-",
+                       check_schedules[index].text, 0, expected, actual);
+}
+
+/**
+ * Compares datelist's engine with the plain mktime(3)/localtime(3)/
+ * strftime(3) path over a corpus of zones, starting times and schedules:
+ * parsing against the step each schedule was written to mean, schedule
+ * stepping by that step against the original mktime(3) loop, zone table
+ * rendering against localtime_r(3), and hand-written formatting against
+ * strftime(3)/snprintf(3).
+ * @returns number of mismatches
+ */
+static long self_check(void)
+{
+    long mismatches = 0;
+    long instants = 0;
+    char expected[256];
+    char actual[256];
+
+    for (size_t z = 0; z < sizeof(check_zones) / sizeof(*check_zones); z++)
+    {
+        const char *zone_name = check_zones[z];
+
+        // the reference runs in the zone through TZ, the engine through
+        // its own transition table
+        setenv("TZ", zone_name, 1);
+        tzset();
 
-int main(int argc, char *argv[])
+        struct zone zone;
+        load_zone(zone_name, &zone);
+
+        for (size_t s = 0;
+             s < sizeof(check_schedules) / sizeof(*check_schedules); s++)
+        {
+            struct schedule schedule;
+            char error[SCHEDULE_ERROR_LENGTH];
+            if (-1 == schedule_parse(check_schedules[s].text, &schedule,
+                                     error, sizeof(error)))
+            {
+                fprintf(stderr, "%s: %s\n", check_schedules[s].text, error);
+                exit(EXIT_FAILURE);
+            }
+            if (z == 0)
+                check_parse(&mismatches, s, &schedule);
+
+            for (size_t t = 0; t < sizeof(check_starts) / sizeof(*check_starts);
+                 t++)
+            {
+                struct tm reference = {0};
+                reference.tm_year = check_starts[t].year - 1900;
+                reference.tm_mon = check_starts[t].month - 1;
+                reference.tm_mday = check_starts[t].day;
+                reference.tm_hour = check_starts[t].hour;
+                reference.tm_min = check_starts[t].minute;
+                reference.tm_isdst = -1;
+                struct timespec start = {mktime(&reference), 0};
+
+                struct schedule_iterator iterator;
+                schedule_iterator_init(&iterator, &schedule, start);
+
+                for (int step = 0; step < CHECK_STEPS; step++)
+                {
+                    // reference: the original datelist loop, by the
+                    // expected step rather than the parsed one. It carried
+                    // tm_isdst from one mktime() to the next, which steps
+                    // evenly through a repeated hour; steps of a day or
+                    // more now keep the time of day across a DST change
+                    // instead
+                    if (check_schedules[s].business_days > 0)
+                    { // count the days to add by stepping a copy day by day
+                        struct tm day = reference;
+                        long left = check_schedules[s].business_days;
+                        int days = 0;
+                        while (left > 0)
+                        {
+                            day.tm_mday++;
+                            day.tm_hour = 12; // clear of DST changes
+                            day.tm_isdst = -1;
+                            mktime(&day);
+                            days++;
+                            if (day.tm_wday != 0 && day.tm_wday != 6)
+                                left--;
+                        }
+                        reference.tm_mday += days;
+                    }
+                    reference.tm_year += check_schedules[s].years;
+                    reference.tm_mon += check_schedules[s].months;
+                    reference.tm_mday += check_schedules[s].days;
+                    reference.tm_hour += check_schedules[s].hours;
+                    reference.tm_min += check_schedules[s].minutes;
+                    reference.tm_sec += check_schedules[s].seconds;
+                    if (check_schedules[s].business_days > 0 ||
+                        check_schedules[s].years != 0 ||
+                        check_schedules[s].months != 0 ||
+                        check_schedules[s].days != 0)
+                        reference.tm_isdst = -1;
+                    time_t reference_instant = mktime(&reference);
+
+                    if (-1 == schedule_next(&iterator, NULL))
+                    {
+                        perror("schedule_next()");
+                        exit(EXIT_FAILURE);
+                    }
+                    time_t instant = iterator.instant.tv_sec;
+                    instants++;
+
+                    if (instant != reference_instant)
+                    {
+                        snprintf(expected, sizeof(expected), "%lld",
+                                 (long long)reference_instant);
+                        snprintf(actual, sizeof(actual), "%lld",
+                                 (long long)instant);
+                        check_mismatch(&mismatches, "schedule step",
+                                       zone_name, check_schedules[s].text,
+                                       (long long)instant, expected, actual);
+                        break; // the rest of the case would differ too
+                    }
+
+                    // zone rendering
+                    struct tm local;
+                    localtime_r(&instant, &local);
+                    int64_t reference_utoff =
+                        days_from_civil(local.tm_year + 1900LL,
+                                        local.tm_mon + 1, local.tm_mday) *
+                            86400 +
+                        local.tm_hour * 3600 + local.tm_min * 60 +
+                        local.tm_sec - (int64_t)instant;
+                    strftime(expected, sizeof(expected),
+                             "%Y-%m-%d %H:%M:%S %Z", &local);
+                    snprintf(expected + strlen(expected),
+                             sizeof(expected) - strlen(expected),
+                             " %+ld dst=%d", (long)reference_utoff,
+                             local.tm_isdst > 0);
+
+                    const struct tz_type *type = zone_lookup(&zone, instant);
+                    struct tm zone_time;
+                    civil_from_seconds((int64_t)instant + type->utoff,
+                                       &zone_time);
+                    strftime(actual, sizeof(actual), "%Y-%m-%d %H:%M:%S",
+                             &zone_time);
+                    snprintf(actual + strlen(actual),
+                             sizeof(actual) - strlen(actual),
+                             " %s %+ld dst=%d", type->abbr, (long)type->utoff,
+                             type->isdst);
+
+                    if (strcmp(expected, actual) != 0)
+                        check_mismatch(&mismatches, "zone rendering",
+                                       zone_name, check_schedules[s].text,
+                                       (long long)instant, expected, actual);
+
+                    // formatting
+                    struct tm utc;
+                    gmtime_r(&instant, &utc);
+                    strftime(expected, sizeof(expected),
+                             "%Y-%m-%dT%H:%M:%SZ", &utc);
+                    actual[format_iso8601((int64_t)instant, actual)] = '\0';
+                    if (strcmp(expected, actual) != 0)
+                        check_mismatch(&mismatches, "ISO-8601 formatting",
+                                       zone_name, check_schedules[s].text,
+                                       (long long)instant, expected, actual);
+
+                    snprintf(expected, sizeof(expected), "%lld",
+                             (long long)instant);
+                    actual[format_integer((int64_t)instant, actual)] = '\0';
+                    if (strcmp(expected, actual) != 0)
+                        check_mismatch(&mismatches, "epoch formatting",
+                                       zone_name, check_schedules[s].text,
+                                       (long long)instant, expected, actual);
+                }
+            }
+
+            schedule_free(&schedule);
+        }
+
+        free(zone.name);
+        free(zone.transitions);
+        free(zone.transition_types);
+        free(zone.types);
+    }
+
+    // exact durations: k steps must land k times the duration away, across
+    // DST changes too
+    setenv("TZ", "America/New_York", 1);
+    tzset();
+
+    for (size_t s = 0;
+         s < sizeof(check_exact_schedules) / sizeof(*check_exact_schedules);
+         s++)
+    {
+        struct schedule schedule;
+        char error[SCHEDULE_ERROR_LENGTH];
+        if (-1 == schedule_parse(check_exact_schedules[s].text, &schedule,
+                                 error, sizeof(error)) ||
+            -1 == schedule_exact(&schedule, true, error, sizeof(error)))
+        {
+            fprintf(stderr, "%s: %s\n", check_exact_schedules[s].text,
+                    error);
+            exit(EXIT_FAILURE);
+        }
+
+        // the parsed duration must be the expected one, which the
+        // reference steps by
+        __int128 duration = check_exact_schedules[s].nanoseconds;
+        __int128 parsed = (__int128)schedule.duration.tv_sec * 1000000000 +
+                          schedule.duration.tv_nsec;
+        if (parsed != duration)
+        {
+            snprintf(expected, sizeof(expected), "%lld ns",
+                     check_exact_schedules[s].nanoseconds);
+            snprintf(actual, sizeof(actual), "%lld ns", (long long)parsed);
+            check_mismatch(&mismatches, "exact duration parse", "-",
+                           check_exact_schedules[s].text, 0, expected,
+                           actual);
+        }
+        struct timespec start = {1710000000, 123456789}; // US DST eve
+
+        struct schedule_iterator iterator;
+        schedule_iterator_init(&iterator, &schedule, start);
+
+        for (int step = 1; step <= CHECK_STEPS; step++)
+        {
+            schedule_next(&iterator, NULL);
+            instants++;
+
+            __int128 expected_ns =
+                (__int128)start.tv_sec * 1000000000 + start.tv_nsec +
+                duration * step;
+            __int128 actual_ns =
+                (__int128)iterator.instant.tv_sec * 1000000000 +
+                iterator.instant.tv_nsec;
+
+            if (expected_ns != actual_ns)
+            {
+                snprintf(expected, sizeof(expected), "%lld.%09lld",
+                         (long long)(expected_ns / 1000000000),
+                         (long long)(expected_ns % 1000000000));
+                snprintf(actual, sizeof(actual), "%lld.%09ld",
+                         (long long)iterator.instant.tv_sec,
+                         iterator.instant.tv_nsec);
+                check_mismatch(&mismatches, "exact step", "America/New_York",
+                               check_exact_schedules[s].text,
+                               (long long)iterator.instant.tv_sec, expected,
+                               actual);
+                break;
+            }
+        }
+
+        schedule_free(&schedule);
+    }
+
+    printf("checked %ld instants: %ld mismatches\n", instants, mismatches);
+    return mismatches;
+}
+
+/**
+ * Measures instants/sec and bytes/sec of every output mode, formatting
+ * into memory so terminal or pipe speed doesn't count.
+ */
+static void benchmark(void)
+{
+    static const struct
+    {
+        const char *name;
+        enum output_mode mode;
+        bool zoned; // render through a zone table instead of localtime
+    } modes[] = {
+        {"locale", OUTPUT_LOCALE, false},
+        {"locale -z", OUTPUT_LOCALE, true},
+        {"epoch", OUTPUT_EPOCH, false},
+        {"epoch-ns", OUTPUT_EPOCH_NS, false},
+        {"iso", OUTPUT_ISO, false},
+        {"binary", OUTPUT_BINARY, false},
+        {"binary-ns", OUTPUT_BINARY_NS, false},
+    };
+
+    setenv("TZ", "America/New_York", 1);
+    tzset();
+
+    struct zone zone;
+    load_zone("America/New_York", &zone);
+
+    struct schedule schedule;
+    char error[SCHEDULE_ERROR_LENGTH];
+    schedule_parse("1 minute", &schedule, error, sizeof(error));
+
+    const struct timespec bench_start = {1700000000, 0};
+    char buffer[1 << 16];
+    volatile size_t sink = 0; // keeps the formatting from being optimized out
+
+    printf("%-12s %14s %14s\n", "mode", "instants/s", "MB/s");
+
+    for (size_t m = 0; m < sizeof(modes) / sizeof(*modes); m++)
+    {
+        struct schedule_iterator iterator;
+        schedule_iterator_init(&iterator, &schedule, bench_start);
+
+        size_t bytes = 0;
+        size_t length = 0;
+        double started = monotonic_seconds();
+
+        for (long i = 0; i < BENCH_INSTANTS; i++)
+        {
+            schedule_next(&iterator, NULL);
+            time_t instant = iterator.instant.tv_sec;
+
+            if (sizeof(buffer) - length < 1024)
+            { // "write" a full buffer
+                sink += buffer[0];
+                bytes += length;
+                length = 0;
+            }
+
+            if (modes[m].mode == OUTPUT_BINARY ||
+                modes[m].mode == OUTPUT_BINARY_NS)
+            {
+                int64_t value = (int64_t)instant;
+                if (modes[m].mode == OUTPUT_BINARY_NS)
+                    value *= 1000000000;
+                for (int b = 0; b < 8; b++)
+                    buffer[length++] = (uint64_t)value >> (8 * b);
+            }
+            else if (modes[m].zoned)
+            {
+                const struct tz_type *type = zone_lookup(&zone, instant);
+                struct tm zone_time;
+                civil_from_seconds((int64_t)instant + type->utoff,
+                                   &zone_time);
+                length += strftime(buffer + length, 1024, "%x %X",
+                                   &zone_time);
+                buffer[length++] = '\n';
+            }
+            else
+            {
+                length += format_instant(modes[m].mode, "%x %X",
+                                         &iterator.current, iterator.instant,
+                                         false, buffer + length, 1024);
+                buffer[length++] = '\n';
+            }
+        }
+
+        bytes += length;
+        double elapsed = monotonic_seconds() - started;
+
+        printf("%-12s %14.0f %14.2f\n", modes[m].name,
+               BENCH_INSTANTS / elapsed, bytes / elapsed / 1e6);
+    }
+
+    // generation alone, the floor every mode above pays, on the wall clock
+    // and by exact durations
+    for (int exact = 0; exact <= 1; exact++)
+    {
+        schedule_exact(&schedule, exact, error, sizeof(error));
+
+        struct schedule_iterator iterator;
+        schedule_iterator_init(&iterator, &schedule, bench_start);
+        double started = monotonic_seconds();
+        for (long i = 0; i < BENCH_INSTANTS; i++)
+        {
+            schedule_next(&iterator, NULL);
+            sink += iterator.instant.tv_sec;
+        }
+        double elapsed = monotonic_seconds() - started;
+        printf("%-12s %14.0f %14s\n", exact ? "(exact)" : "(wall-clock)",
+               BENCH_INSTANTS / elapsed, "-");
+    }
+
+    schedule_free(&schedule);
+    free(zone.name);
+    free(zone.transitions);
+    free(zone.transition_types);
+    free(zone.types);
+}
+
+int MAIN(datelist)(int argc, char *argv[])
 {
+    program_name = argv[0];
+
     // --------------------------- localization -------------------------------
 
     if (NULL == setlocale(LC_TIME, ""))
@@ -50,10 +2020,19 @@ int main(int argc, char *argv[])
     char option;                  // current option found by getopt()
     char *c_value = NULL;         // value for the c option
     bool c_value_defined = false; // whether c is defined
+    bool unique = false;          // -u option
+    char *z_value = NULL;         // value for the z option
+    enum output_mode output_mode = OUTPUT_LOCALE; // -o option
+    bool o_value_defined = false; // whether o is defined
+    char *h_value = NULL;         // value for the H option
+    char *s_value = NULL;         // value for the S option
+    bool b_option = false;        // -B option
+    bool exact = false;           // -e option
+    bool realtime = false;        // -r option
 
     while (true)
     {
-        option = getopt(argc, argv, ":c:"); // get option
+        option = getopt(argc, argv, ":c:uz:o:H:S:Ber"); // get option
         if (-1 == option)
             break; // reached end of options
 
@@ -62,13 +2041,55 @@ int main(int argc, char *argv[])
         case 'c': // count
             c_value_defined = true;
             int string_length = strlen(optarg);
-            c_value = malloc(string_length * sizeof(char));
+            c_value = malloc((string_length + 1) * sizeof(char));
             if (NULL == c_value)
             {
                 fprintf(stderr, "malloc(): failed to allocate memory\n");
                 exit(EXIT_FAILURE);
             }
-            strncpy(c_value, optarg, string_length);
+            strcpy(c_value, optarg);
+            break;
+        case 'u': // de-duplicate coincident instants
+            unique = true;
+            break;
+        case 'z': // time zones
+            z_value = optarg;
+            break;
+        case 'H': // holiday calendar
+            h_value = optarg;
+            break;
+        case 'S': // daemon socket
+            s_value = optarg;
+            break;
+        case 'B': // self-check and benchmark
+            b_option = true;
+            break;
+        case 'e': // exact elapsed durations
+            exact = true;
+            break;
+        case 'r': // emit instants as they happen
+            realtime = true;
+            break;
+        case 'o': // output mode
+            o_value_defined = true;
+            if (strcmp(optarg, "locale") == 0)
+                output_mode = OUTPUT_LOCALE;
+            else if (strcmp(optarg, "epoch") == 0)
+                output_mode = OUTPUT_EPOCH;
+            else if (strcmp(optarg, "epoch-ns") == 0)
+                output_mode = OUTPUT_EPOCH_NS;
+            else if (strcmp(optarg, "iso") == 0)
+                output_mode = OUTPUT_ISO;
+            else if (strcmp(optarg, "binary") == 0)
+                output_mode = OUTPUT_BINARY;
+            else if (strcmp(optarg, "binary-ns") == 0)
+                output_mode = OUTPUT_BINARY_NS;
+            else
+            {
+                fprintf(stderr, "Invalid output mode: %s\n" USAGE "\n",
+                        optarg, argv[0]);
+                exit(EXIT_FAILURE);
+            }
             break;
         case '?': // unknown option
             fprintf(stderr, "Unknown option: %c\n" USAGE "\n", optopt,
@@ -122,234 +2143,314 @@ int main(int argc, char *argv[])
 
     free(c_value);
 
-    // ------------------------- processing schedule -------------------------
-
-    if (optind >= argc)
-    { // schedule missing
-        fprintf(stderr, "Missing schedule\n" USAGE "\n", argv[0]);
-        exit(EXIT_FAILURE);
+    if (NULL != h_value)
+    {
+        char error[SCHEDULE_ERROR_LENGTH];
+        if (-1 == schedule_load_calendar(h_value, error, sizeof(error)))
+        {
+            fprintf(stderr, "%s\n", error);
+            exit(EXIT_FAILURE);
+        }
     }
 
-    struct tm time_adjustment = {0};
-    bool date_portion_only = true;             // will set to false if to modify h/m/s
-    bool units_seen[] = {0, 0, 0, 0, 0, 0, 0}; // y, m, w, d, h, m, s
+    // ------------------------------ self-check -----------------------------
 
-    char *token = strtok(argv[optind], " \t");
-
-    while (NULL != token)
+    if (b_option)
     {
-        // getting number
-
-        errno = 0;
+        long mismatches = self_check();
+        benchmark();
+        schedule_free_calendar();
+        return (mismatches == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
 
-        char *end_ptr;
-        long number = strtol(token, &end_ptr, 0);
+    // -------------------------------- daemon -------------------------------
 
-        if (0 != errno)
-        {
-            perror("error calling strtol:");
+    if (NULL != s_value)
+    {
+        if (optind < argc || NULL != z_value || unique || c_value_defined)
+        { // schedules and their options come with each query
+            fprintf(stderr,
+                    "-S only takes -o, -e and -H options\n" USAGE "\n", argv[0]);
             exit(EXIT_FAILURE);
         }
 
-        if (*end_ptr != '\0')
-        { // non number
-            fprintf(stderr, "A non-number was supplied.\n" USAGE "\n", argv[0]);
+        if (output_mode == OUTPUT_BINARY || output_mode == OUTPUT_BINARY_NS)
+        {
+            fprintf(stderr, "-S needs a text output mode\n" USAGE "\n",
+                    argv[0]);
             exit(EXIT_FAILURE);
         }
 
-        if (number < 0)
-        { // negative
-            fprintf(stderr, "Negative time was supplied\n" USAGE "\n", argv[0]);
-            exit(EXIT_FAILURE);
-        }
+        // replies are meant for programs, default to epoch seconds
+        serve(s_value, o_value_defined ? output_mode : OUTPUT_EPOCH, exact);
+        schedule_free_calendar();
+        return 0;
+    }
 
-        if (number > __INT_MAX__)
-        { // out of int range
-            fprintf(stderr, "Supplied number is out of range\n" USAGE "\n",
-                    argv[0]);
-            exit(EXIT_FAILURE);
-        }
+    // ------------------------- processing schedules ------------------------
+
+    if (optind >= argc)
+    { // schedule missing
+        fprintf(stderr, "Missing schedule\n" USAGE "\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
 
-        // setting up time_adjustment
+    int stream_count = argc - optind;
 
-        token = strtok(NULL, " \t");
+    struct stream *streams = calloc(stream_count, sizeof(struct stream));
+    struct stream **heap = calloc(stream_count, sizeof(struct stream *));
+    if (NULL == streams || NULL == heap)
+    {
+        fprintf(stderr, "calloc(): failed to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    bool date_portion_only = true; // only if every schedule is date-only
+    bool subsecond = false;        // if any schedule has sub-second units
 
-        if (NULL == token)
-        { // missing units
-            fprintf(stderr, "Missing time units.\n" USAGE "\n", argv[0]);
+    for (int i = 0; i < stream_count; i++)
+    {
+        char error[SCHEDULE_ERROR_LENGTH];
+        if (-1 == schedule_parse(argv[optind + i], &streams[i].schedule, error,
+                                 sizeof(error)) ||
+            -1 == schedule_exact(&streams[i].schedule, exact, error,
+                                 sizeof(error)))
+        {
+            fprintf(stderr, "%s\n" USAGE "\n", error, argv[0]);
             exit(EXIT_FAILURE);
         }
 
-        if (strcmp(token, "year") == 0 || strcmp(token, "years") == 0)
+        streams[i].index = i;
+        date_portion_only =
+            date_portion_only && streams[i].schedule.date_portion_only;
+        subsecond = subsecond || streams[i].schedule.subsecond;
+    }
+
+    // ------------------------------ time zones -----------------------------
+
+    struct zone *zones = NULL;
+    int zone_count = 0;
+
+    if (NULL != z_value && output_mode != OUTPUT_LOCALE)
+    { // the other modes are zone independent
+        fprintf(stderr,
+                "-z only applies to locale formatted output\n" USAGE "\n",
+                argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (NULL != z_value)
+    {
+        char *zone_name = strtok(z_value, ",");
+        while (NULL != zone_name)
         {
-            if (units_seen[0])
+            zones = realloc(zones, (zone_count + 1) * sizeof(struct zone));
+            if (NULL == zones)
             {
-                fprintf(stderr, "Supplied year multiple times\n" USAGE "\n",
-                        argv[0]);
+                fprintf(stderr, "realloc(): failed to allocate memory\n");
                 exit(EXIT_FAILURE);
             }
-            else
-            {
-                units_seen[0] = true;
-            }
-            time_adjustment.tm_year += number;
+
+            load_zone(zone_name, &zones[zone_count]);
+            zone_count++;
+
+            zone_name = strtok(NULL, ",");
         }
-        else if (strcmp(token, "month") == 0 ||
-                 strcmp(token, "months") == 0)
+
+        if (zone_count == 0)
         {
-            if (units_seen[1])
-            {
-                fprintf(stderr, "Supplied month multiple times\n" USAGE "\n",
-                        argv[0]);
-                exit(EXIT_FAILURE);
-            }
-            else
-            {
-                units_seen[1] = true;
-            }
-            time_adjustment.tm_mon += number;
+            fprintf(stderr, "Missing time zone\n" USAGE "\n", argv[0]);
+            exit(EXIT_FAILURE);
         }
-        else if (strcmp(token, "week") == 0 || strcmp(token, "weeks") == 0)
+    }
+
+    // ---------------------- printing count # of times ----------------------
+
+    // every schedule starts from now, and is one step ahead once in the heap
+
+    struct timespec time_now;
+    clock_gettime(CLOCK_REALTIME, &time_now);
+    if (!subsecond)
+    { // whole seconds, as before sub-second units
+        time_now.tv_nsec = 0;
+    }
+
+    for (int i = 0; i < stream_count; i++)
+    {
+        if (-1 == schedule_iterator_init(&streams[i].iterator,
+                                         &streams[i].schedule, time_now))
         {
-            if (units_seen[2])
-            {
-                fprintf(stderr, "Supplied week multiple times\n" USAGE "\n",
-                        argv[0]);
-                exit(EXIT_FAILURE);
-            }
-            else
-            {
-                units_seen[2] = true;
-            }
-            time_adjustment.tm_mday += 7 * number;
+            perror("Error with localtime():");
+            exit(EXIT_FAILURE);
         }
-        else if (strcmp(token, "day") == 0 || strcmp(token, "days") == 0)
-        {
-            if (units_seen[3])
-            {
-                fprintf(stderr, "Supplied day multiple times\n" USAGE "\n",
-                        argv[0]);
-                exit(EXIT_FAILURE);
-            }
-            else
-            {
-                units_seen[3] = true;
-            }
-            time_adjustment.tm_mday += number;
+
+        advance_stream(&streams[i]);
+        heap[i] = &streams[i];
+    }
+
+    for (int i = stream_count / 2 - 1; i >= 0; i--)
+    {
+        sift_down(heap, stream_count, i);
+    }
+
+    // take from the heap, format, and print
+
+    char date_string[1024];
+    const char *date_format = date_portion_only ? "%x" : "%x %X";
+
+    struct outbuf output;
+    outbuf_init(&output, STDOUT_FILENO);
+
+    struct lateness lateness = {0};
+    if (realtime)
+    { // stop early on SIGINT/SIGTERM, statistics are still reported
+        catch_stop_signals();
+    }
+
+    for (long i = 0; i < count; i++)
+    {
+        struct stream *earliest = heap[0];
+        struct timespec instant = earliest->iterator.instant;
+
+        // one timer for all schedules: the earliest instant of the heap
+        if (realtime && !wait_until(instant, &lateness))
+            break;
+
+        PROBE2(datelist, instant, instant.tv_sec, instant.tv_nsec);
+
+        if (output_mode == OUTPUT_BINARY || output_mode == OUTPUT_BINARY_NS)
+        { // raw little-endian int64, no labels or newlines
+            int64_t value = (output_mode == OUTPUT_BINARY_NS)
+                                ? instant_nanoseconds(instant)
+                                : (int64_t)instant.tv_sec;
+
+            unsigned char bytes[8];
+            for (int b = 0; b < 8; b++)
+                bytes[b] = (uint64_t)value >> (8 * b);
+
+            outbuf_write(&output, bytes, sizeof(bytes));
         }
-        else if (strcmp(token, "hour") == 0 || strcmp(token, "hours") == 0)
+        else if (zone_count == 0)
         {
-            if (units_seen[4])
+            const struct tm *local = NULL;
+            if (output_mode == OUTPUT_LOCALE &&
+                NULL == (local = schedule_local_time(&earliest->iterator)))
             {
-                fprintf(stderr, "Supplied hour multiple times\n" USAGE "\n",
-                        argv[0]);
+                perror("Error with localtime():");
                 exit(EXIT_FAILURE);
             }
-            else
-            {
-                units_seen[4] = true;
-            }
-            time_adjustment.tm_hour += number;
-            date_portion_only = false;
-        }
-        else if (strcmp(token, "minute") == 0 ||
-                 strcmp(token, "minutes") == 0)
-        {
-            if (units_seen[5])
+
+            size_t length =
+                format_instant(output_mode, date_format, local, instant,
+                               subsecond, date_string, sizeof(date_string));
+            if (0 == length)
             {
-                fprintf(stderr, "Supplied minute multiple times\n" USAGE "\n",
+                fprintf(stderr,
+                        "Failed to format date-time string\n" USAGE "\n",
                         argv[0]);
                 exit(EXIT_FAILURE);
             }
-            else
-            {
-                units_seen[5] = true;
-            }
-            time_adjustment.tm_min += number;
-            date_portion_only = false;
+
+            outbuf_write(&output, date_string, length);
         }
-        else if (strcmp(token, "second") == 0 ||
-                 strcmp(token, "seconds") == 0)
-        {
-            if (units_seen[6])
-            {
-                fprintf(stderr, "Supplied second multiple times\n" USAGE "\n",
-                        argv[0]);
-                exit(EXIT_FAILURE);
-            }
-            else
+        else
+        { // one column per zone
+            for (int z = 0; z < zone_count; z++)
             {
-                units_seen[6] = true;
+                const struct tz_type *type =
+                    zone_lookup(&zones[z], instant.tv_sec);
+
+                struct tm zone_time;
+                civil_from_seconds((int64_t)instant.tv_sec + type->utoff,
+                                   &zone_time);
+                zone_time.tm_isdst = type->isdst;
+
+                size_t length = strftime(date_string, sizeof(date_string) - 10,
+                                         date_format, &zone_time);
+                if (length != 0 && subsecond)
+                {
+                    length += format_fraction(instant.tv_nsec,
+                                              date_string + length);
+                }
+                date_string[length] = '\0';
+
+                if (0 == length)
+                {
+                    fprintf(stderr,
+                            "Failed to format date-time string\n" USAGE "\n",
+                            argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+
+                if (z != 0)
+                    outbuf_char(&output, '\t');
+                outbuf_write(&output, date_string, length);
+                outbuf_char(&output, ' ');
+                outbuf_string(&output, type->abbr);
             }
-            time_adjustment.tm_sec += number;
-            date_portion_only = false;
         }
-        else
+
+        bool textual =
+            output_mode != OUTPUT_BINARY && output_mode != OUTPUT_BINARY_NS;
+        bool label_printed = false;
+
+        do
         {
-            fprintf(stderr, "Invalid unit supplied\n" USAGE "\n", argv[0]);
-            exit(EXIT_FAILURE);
-        }
+            struct stream *popped = heap[0];
 
-        token = strtok(NULL, " \t");
-    }
+            if (textual && NULL != popped->schedule.label)
+            { // labels of coincident schedules are joined by commas
+                outbuf_char(&output, label_printed ? ',' : '\t');
+                outbuf_string(&output, popped->schedule.label);
+                label_printed = true;
+            }
 
-    // ---------------------- printing count # of times ----------------------
+            // generate the popped schedule's next instant
+            advance_stream(popped);
+            sift_down(heap, stream_count, 0);
 
-    // get current time
+            if (0 == timespec_compare(popped->iterator.instant, instant))
+                break; // zero interval, would coincide with itself forever
+        } while (unique &&
+                 0 == timespec_compare(heap[0]->iterator.instant, instant));
 
-    errno = 0;
-    time_t time_now = time(NULL);
-    struct tm *current_time = localtime(&time_now);
-    if (NULL == current_time)
-    {
-        perror("Error with localtime():");
-        exit(EXIT_FAILURE);
-    }
+        if (textual)
+            outbuf_char(&output, '\n');
 
-    // add, format, and print
+        if (realtime && -1 == outbuf_flush(&output))
+        { // the reader gets the instant now, not when the buffer fills
+            perror("write()");
+            exit(EXIT_FAILURE);
+        }
+    }
 
-    char date_string[1024];
-    char *date_format;
-    if (date_portion_only)
+    if (realtime)
     {
-        date_format = "%x";
+        report_lateness(&lateness);
     }
-    else
+
+    if (-1 == outbuf_close(&output))
     {
-        date_format = "%x %X";
+        perror("write()");
+        exit(EXIT_FAILURE);
     }
 
-    for (long i = 0; i < count; i++)
+    for (int z = 0; z < zone_count; z++)
     {
-        // add
-        current_time->tm_year += time_adjustment.tm_year;
-        current_time->tm_mon += time_adjustment.tm_mon;
-        current_time->tm_mday += time_adjustment.tm_mday;
-        current_time->tm_hour += time_adjustment.tm_hour;
-        current_time->tm_min += time_adjustment.tm_min;
-        current_time->tm_sec += time_adjustment.tm_sec;
-
-        errno = 0;
-        mktime(current_time);
-        if (errno != 0)
-        {
-            perror("error with mktime() after adding time adjustment: ");
-            exit(EXIT_FAILURE);
-        }
-
-        // formatting
-
-        if (0 == strftime(date_string, sizeof(date_string), date_format,
-                          current_time))
-        {
-            fprintf(stderr, "Failed to format date-time string\n" USAGE "\n",
-                    argv[0]);
-            exit(EXIT_FAILURE);
-        }
+        free(zones[z].name);
+        free(zones[z].transitions);
+        free(zones[z].transition_types);
+        free(zones[z].types);
+    }
+    free(zones);
+    schedule_free_calendar();
 
-        // print
-        printf("%s\n", date_string);
+    for (int i = 0; i < stream_count; i++)
+    {
+        schedule_free(&streams[i].schedule);
     }
+    free(heap);
+    free(streams);
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,917 @@
+/**
+ * Title:         ext4image.c
+ * Description:   Name and inode queries on ext4 image files, without mounting
+ * Purpose:       See ext4image.h.
+ *                On-disk fields are little endian, and decoded byte by byte,
+ *                so any host reads any image. Everything read is checked
+ *                against the image's size in blocks and inodes: a corrupt
+ *                image fails with EINVAL, or has its broken directory blocks
+ *                skipped, but is never read out of bounds.
+ * Build with:    gcc -c ext4image.c
+ */
+
+#define _XOPEN_SOURCE 700
+#include "ext4image.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define SUPERBLOCK_OFFSET 1024
+#define SUPERBLOCK_SIZE 1024
+#define EXT4_MAGIC 0xEF53
+#define ROOT_INODE 2
+
+#define INCOMPAT_FILETYPE 0x2
+#define INCOMPAT_META_BG 0x10
+#define INCOMPAT_64BIT 0x80
+#define RO_COMPAT_GDT_CSUM 0x10
+#define RO_COMPAT_METADATA_CSUM 0x400
+#define GROUP_INODE_UNINIT 0x1
+#define INODE_EXTENTS 0x80000
+#define INODE_INLINE_DATA 0x10000000
+
+#define EXTENT_MAGIC 0xF30A
+#define EXTENT_MAX_DEPTH 5
+#define EXTENT_UNWRITTEN 32768 // lengths above are preallocated, read as 0s
+#define DIRECT_BLOCKS 12
+#define INLINE_SIZE 60 // bytes of i_block
+#define MAX_PATH_DEPTH 4096
+
+#define READ_SIZE (1 << 20) // bytes read at once, in sequential sweeps
+
+static uint16_t le16(const unsigned char *p)
+{
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t le32(const unsigned char *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+           (uint32_t)p[3] << 24;
+}
+
+/**
+ * Reads exactly length bytes at an offset of the image.
+ * @returns 0 on success, -1 with errno set on error, EINVAL if the image
+ *          ends before
+ */
+static int read_at(const struct ext4_image *image, void *buffer,
+                   size_t length, uint64_t offset)
+{
+    char *p = buffer;
+    while (length > 0)
+    {
+        const ssize_t count = pread(image->fd, p, length, (off_t)offset);
+        if (count == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (count == 0)
+        {
+            errno = EINVAL; // truncated
+            return -1;
+        }
+        p += count;
+        length -= (size_t)count;
+        offset += (uint64_t)count;
+    }
+    return 0;
+}
+
+static int read_blocks(const struct ext4_image *image, void *buffer,
+                       uint64_t block, uint64_t count)
+{
+    if (block >= image->block_count || count > image->block_count - block)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    return read_at(image, buffer, count * image->block_size,
+                   block * image->block_size);
+}
+
+// ---------------------------------- open ----------------------------------
+
+int ext4_open(struct ext4_image *image, const char *path)
+{
+    memset(image, 0, sizeof(*image));
+    image->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (image->fd == -1)
+        return -1;
+
+    unsigned char sb[SUPERBLOCK_SIZE];
+    if (read_at(image, sb, sizeof(sb), SUPERBLOCK_OFFSET) == -1)
+        goto fail;
+
+    const uint32_t log_block_size = le32(sb + 0x18);
+    const uint32_t first_data_block = le32(sb + 0x14);
+    const uint32_t blocks_per_group = le32(sb + 0x20);
+    const uint32_t incompat = le32(sb + 0x60);
+    const uint32_t ro_compat = le32(sb + 0x64);
+    const bool wide = incompat & INCOMPAT_64BIT;
+
+    image->inode_count = le32(sb + 0x0);
+    image->inodes_per_group = le32(sb + 0x28);
+    image->inode_size = (le32(sb + 0x4C) == 0) ? 128 : le16(sb + 0x58);
+    image->block_count = le32(sb + 0x4);
+    if (wide)
+        image->block_count |= (uint64_t)le32(sb + 0x150) << 32;
+    image->file_type = incompat & INCOMPAT_FILETYPE;
+
+    if (le16(sb + 0x38) != EXT4_MAGIC || log_block_size > 6)
+    {
+        errno = EINVAL;
+        goto fail;
+    }
+    image->block_size = 1024U << log_block_size;
+
+    if (blocks_per_group == 0 || image->inodes_per_group == 0 ||
+        image->inode_size < 128 || image->inode_size > image->block_size ||
+        (image->inode_size & (image->inode_size - 1)) != 0 ||
+        first_data_block >= image->block_count)
+    {
+        errno = EINVAL;
+        goto fail;
+    }
+    if (incompat & INCOMPAT_META_BG)
+    {
+        errno = ENOTSUP; // descriptors spread over the groups
+        goto fail;
+    }
+
+    const uint64_t groups = (image->block_count - first_data_block +
+                             blocks_per_group - 1) / blocks_per_group;
+    if (groups > UINT32_MAX ||
+        groups * image->inodes_per_group < image->inode_count)
+    {
+        errno = EINVAL;
+        goto fail;
+    }
+    image->group_count = (uint32_t)groups;
+
+    uint32_t descriptor_size = wide ? le16(sb + 0xFE) : 32;
+    if (descriptor_size < 32)
+        descriptor_size = 32;
+    const uint64_t table_size = (uint64_t)image->group_count * descriptor_size;
+    const uint64_t table_blocks =
+        (table_size + image->block_size - 1) / image->block_size;
+
+    unsigned char *descriptors = malloc(table_blocks * image->block_size);
+    image->inode_tables = malloc(image->group_count * sizeof(uint64_t));
+    image->used_inodes = malloc(image->group_count * sizeof(uint32_t));
+    if (descriptors == NULL || image->inode_tables == NULL ||
+        image->used_inodes == NULL ||
+        read_blocks(image, descriptors, first_data_block + 1,
+                    table_blocks) == -1)
+    {
+        free(descriptors);
+        goto fail;
+    }
+
+    // without checksums, the unused counts and flags aren't kept up to date
+    const bool checksums =
+        ro_compat & (RO_COMPAT_GDT_CSUM | RO_COMPAT_METADATA_CSUM);
+    const uint64_t table_length =
+        ((uint64_t)image->inodes_per_group * image->inode_size +
+         image->block_size - 1) / image->block_size;
+
+    for (uint32_t group = 0; group < image->group_count; group++)
+    {
+        const unsigned char *d = descriptors + group * descriptor_size;
+        uint64_t table = le32(d + 0x8);
+        uint32_t unused = le16(d + 0x1C);
+        if (descriptor_size >= 64)
+        {
+            table |= (uint64_t)le32(d + 0x28) << 32;
+            unused |= (uint32_t)le16(d + 0x32) << 16;
+        }
+
+        uint32_t used = image->inodes_per_group;
+        if (checksums && (le16(d + 0x12) & GROUP_INODE_UNINIT))
+            used = 0;
+        else if (checksums)
+            used -= (unused < used) ? unused : used;
+
+        if (used > 0 && (table >= image->block_count ||
+                         table_length > image->block_count - table))
+        {
+            free(descriptors);
+            errno = EINVAL;
+            goto fail;
+        }
+        image->inode_tables[group] = table;
+        image->used_inodes[group] = used;
+    }
+
+    free(descriptors);
+    return 0;
+
+fail:;
+    const int saved_errno = errno;
+    ext4_close(image);
+    errno = saved_errno;
+    return -1;
+}
+
+void ext4_close(struct ext4_image *image)
+{
+    if (image->fd != -1)
+        close(image->fd);
+    free(image->inode_tables);
+    free(image->used_inodes);
+    image->fd = -1;
+    image->inode_tables = NULL;
+    image->used_inodes = NULL;
+}
+
+// ------------------------------ data blocks -------------------------------
+
+/**
+ * Called with each run of data blocks of an inode, in logical order.
+ * @returns 0 to go on, 1 to stop, -1 with errno set on error
+ */
+typedef int (*blocks_function)(const struct ext4_image *image,
+                               uint64_t block, uint64_t count, void *context);
+
+static int extent_blocks(const struct ext4_image *image,
+                         const unsigned char *node, size_t node_size,
+                         int depth_limit, blocks_function function,
+                         void *context)
+{
+    const uint16_t entries = le16(node + 2);
+    const uint16_t depth = le16(node + 6);
+    if (le16(node) != EXTENT_MAGIC || depth > depth_limit ||
+        12 + (size_t)entries * 12 > node_size)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    unsigned char *child = NULL;
+    int result = 0;
+    for (uint16_t i = 0; result == 0 && i < entries; i++)
+    {
+        const unsigned char *entry = node + 12 + i * 12;
+        if (depth == 0)
+        {
+            const uint16_t length = le16(entry + 4);
+            if (length > EXTENT_UNWRITTEN)
+                continue;
+            const uint64_t start =
+                le32(entry + 8) | (uint64_t)le16(entry + 6) << 32;
+            result = function(image, start, length, context);
+            continue;
+        }
+
+        const uint64_t block = le32(entry + 4) | (uint64_t)le16(entry + 8)
+                                                     << 32;
+        if (child == NULL && NULL == (child = malloc(image->block_size)))
+            result = -1;
+        else if (read_blocks(image, child, block, 1) == -1)
+            result = -1;
+        else
+            result = extent_blocks(image, child, image->block_size,
+                                   depth - 1, function, context);
+    }
+
+    const int saved_errno = errno;
+    free(child);
+    errno = saved_errno;
+    return result;
+}
+
+/**
+ * Goes through a block of an ext2/3 block map.
+ * @param level 0 for a data block, 1 for a block of data block numbers, 2
+ *              for a block of such blocks, and so on
+ */
+static int mapped_blocks(const struct ext4_image *image, uint32_t block,
+                         int level, blocks_function function, void *context)
+{
+    if (block == 0)
+        return 0; // a hole
+    if (level == 0)
+        return function(image, block, 1, context);
+
+    unsigned char *pointers = malloc(image->block_size);
+    if (pointers == NULL)
+        return -1;
+    int result = read_blocks(image, pointers, block, 1);
+    for (uint32_t i = 0; result == 0 && i < image->block_size / 4; i++)
+        result = mapped_blocks(image, le32(pointers + i * 4), level - 1,
+                               function, context);
+
+    const int saved_errno = errno;
+    free(pointers);
+    errno = saved_errno;
+    return result;
+}
+
+/**
+ * Goes through the data blocks of an inode, unless its data is inline.
+ * @param inode The inode as on disk
+ */
+static int inode_blocks(const struct ext4_image *image,
+                        const unsigned char *inode, blocks_function function,
+                        void *context)
+{
+    const uint32_t flags = le32(inode + 0x20);
+    const unsigned char *map = inode + 0x28;
+    if (flags & INODE_INLINE_DATA)
+        return 0;
+    if (flags & INODE_EXTENTS)
+        return extent_blocks(image, map, INLINE_SIZE, EXTENT_MAX_DEPTH,
+                             function, context);
+
+    int result = 0;
+    for (int i = 0; result == 0 && i < DIRECT_BLOCKS; i++)
+        result = mapped_blocks(image, le32(map + i * 4), 0, function,
+                               context);
+    for (int level = 1; result == 0 && level <= 3; level++)
+        result = mapped_blocks(image,
+                               le32(map + (DIRECT_BLOCKS + level - 1) * 4),
+                               level, function, context);
+    return result;
+}
+
+// -------------------------------- entries ---------------------------------
+
+/**
+ * Called with each entry of a directory block but `.` and `..`.
+ * @param name Not null terminated
+ * @returns 0 to go on, 1 to stop, -1 with errno set on error
+ */
+typedef int (*entry_function)(uint32_t inode, const char *name,
+                              size_t name_length, void *context);
+
+/**
+ * Goes through the entries of a directory block, or of inline directory
+ * data. Stops at the first broken entry: the rest of the block can't be
+ * trusted.
+ */
+static int read_entries(const struct ext4_image *image,
+                        const unsigned char *block, size_t length,
+                        entry_function function, void *context)
+{
+    size_t offset = 0;
+    while (length - offset >= 8)
+    {
+        const unsigned char *entry = block + offset;
+        const uint32_t inode = le32(entry);
+        size_t record_length = le16(entry + 4);
+        const size_t name_length =
+            image->file_type ? entry[6] : le16(entry + 6);
+        if (record_length == 0 || record_length == 65535)
+            record_length = 65536; // the whole of a 64 KiB block
+        if (record_length < 8 || record_length > length - offset ||
+            name_length + 8 > record_length)
+            return 0;
+
+        const char *name = (const char *)entry + 8;
+        const bool dots = (name_length == 1 && name[0] == '.') ||
+                          (name_length == 2 && name[0] == '.' &&
+                           name[1] == '.');
+        if (inode != 0 && inode <= image->inode_count && !dots &&
+            name_length > 0)
+        {
+            const int result = function(inode, name, name_length, context);
+            if (result != 0)
+                return result;
+        }
+        offset += record_length;
+    }
+    return 0;
+}
+
+static int read_inode(const struct ext4_image *image, uint32_t number,
+                      unsigned char *inode)
+{
+    if (number == 0 || number > image->inode_count)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    const uint32_t group = (number - 1) / image->inodes_per_group;
+    const uint32_t index = (number - 1) % image->inodes_per_group;
+    return read_at(image, inode, image->inode_size,
+                   image->inode_tables[group] * image->block_size +
+                       (uint64_t)index * image->inode_size);
+}
+
+// --------------------------------- lookup ---------------------------------
+
+struct lookup
+{
+    const char *name;
+    size_t name_length;
+    uint32_t inode; // found, 0 until then
+    unsigned char *block;
+    entry_function function;
+};
+
+static int compare_entry(uint32_t inode, const char *name,
+                         size_t name_length, void *context)
+{
+    struct lookup *lookup = context;
+    if (name_length != lookup->name_length ||
+        memcmp(name, lookup->name, name_length) != 0)
+        return 0;
+    lookup->inode = inode;
+    return 1;
+}
+
+static int search_blocks(const struct ext4_image *image, uint64_t block,
+                         uint64_t count, void *context)
+{
+    struct lookup *lookup = context;
+    for (uint64_t i = 0; i < count; i++)
+    {
+        if (read_blocks(image, lookup->block, block + i, 1) == -1)
+            return -1;
+        const int result = read_entries(image, lookup->block,
+                                        image->block_size, compare_entry,
+                                        lookup);
+        if (result != 0)
+            return result;
+    }
+    return 0;
+}
+
+int ext4_lookup(struct ext4_image *image, const char *path,
+                uint32_t *inode)
+{
+    unsigned char *buffer = malloc(image->inode_size + image->block_size);
+    if (buffer == NULL)
+        return -1;
+    struct lookup lookup = {.block = buffer + image->inode_size};
+
+    uint32_t current = ROOT_INODE;
+    int result = 0;
+    while (result == 0)
+    {
+        while (*path == '/')
+            path++;
+        if (*path == '\0')
+            break;
+
+        if (read_inode(image, current, buffer) == -1)
+        {
+            result = -1;
+            break;
+        }
+        if (!S_ISDIR(le16(buffer)))
+        {
+            errno = ENOTDIR;
+            result = -1;
+            break;
+        }
+
+        lookup.name = path;
+        lookup.name_length = strcspn(path, "/");
+        lookup.inode = 0;
+        path += lookup.name_length;
+
+        if (le32(buffer + 0x20) & INODE_INLINE_DATA)
+            result = read_entries(image, buffer + 0x28 + 4, INLINE_SIZE - 4,
+                                  compare_entry, &lookup);
+        else
+            result = inode_blocks(image, buffer, search_blocks, &lookup);
+        if (result == -1)
+            break;
+        if (lookup.inode == 0)
+        {
+            errno = ENOENT;
+            result = -1;
+            break;
+        }
+        current = lookup.inode;
+        result = 0;
+    }
+
+    const int saved_errno = errno;
+    free(buffer);
+    errno = saved_errno;
+    if (result == 0)
+        *inode = current;
+    return result;
+}
+
+// ---------------------------------- scan ----------------------------------
+
+/**
+ * A run of blocks of a directory.
+ */
+struct extent
+{
+    uint64_t block;
+    uint32_t count;
+    uint32_t directory;
+};
+
+/**
+ * The entries held in an inline-data directory's inode.
+ */
+struct inline_directory
+{
+    uint32_t directory;
+    unsigned char data[INLINE_SIZE - 4];
+};
+
+/**
+ * Where a directory is: its parent and its name, an offset in names.
+ */
+struct parent
+{
+    uint32_t directory; // 0 for a free slot
+    uint32_t parent;
+    size_t name;
+};
+
+struct match
+{
+    uint32_t parent;
+    uint32_t inode;
+    size_t name;
+};
+
+struct scan
+{
+    struct ext4_image *image;
+    ext4_test_function test;
+    void *context;
+
+    unsigned char *directories; // bitmap by inode number
+    size_t directory_count;
+    uint32_t current; // directory whose blocks are being read
+
+    struct extent *extents;
+    size_t extent_count;
+    size_t extent_capacity;
+
+    struct inline_directory *inlines;
+    size_t inline_count;
+    size_t inline_capacity;
+
+    struct parent *parents; // hash table by directory
+    size_t parent_mask;
+
+    struct match *matches;
+    size_t match_count;
+    size_t match_capacity;
+
+    char *names; // null terminated, back to back
+    size_t names_length;
+    size_t names_size;
+};
+
+/**
+ * Makes room for one more element of an array.
+ * @returns 0 on success, -1 with errno set on error
+ */
+static int reserve(void **array, size_t *capacity, size_t count,
+                   size_t element_size)
+{
+    if (count < *capacity)
+        return 0;
+    const size_t grown_capacity = (*capacity == 0) ? 1024 : *capacity * 2;
+    void *grown = realloc(*array, grown_capacity * element_size);
+    if (grown == NULL)
+        return -1;
+    *array = grown;
+    *capacity = grown_capacity;
+    return 0;
+}
+
+static bool is_directory(const struct scan *scan, uint32_t inode)
+{
+    return scan->directories[inode / 8] & (1U << (inode % 8));
+}
+
+static int add_extent(const struct ext4_image *image, uint64_t block,
+                      uint64_t count, void *context)
+{
+    struct scan *scan = context;
+    if (block >= image->block_count || count > image->block_count - block)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (-1 == reserve((void **)&scan->extents, &scan->extent_capacity,
+                      scan->extent_count, sizeof(struct extent)))
+        return -1;
+    scan->extents[scan->extent_count++] = (struct extent){
+        .block = block, .count = (uint32_t)count,
+        .directory = scan->current};
+    return 0;
+}
+
+/**
+ * Notes a directory inode: where its blocks are, or its inline entries.
+ */
+static int add_directory(struct scan *scan, uint32_t number,
+                         const unsigned char *inode)
+{
+    scan->directories[number / 8] |= 1U << (number % 8);
+    scan->directory_count++;
+
+    if (!(le32(inode + 0x20) & INODE_INLINE_DATA))
+    {
+        scan->current = number;
+        return inode_blocks(scan->image, inode, add_extent, scan);
+    }
+
+    if (-1 == reserve((void **)&scan->inlines, &scan->inline_capacity,
+                      scan->inline_count, sizeof(struct inline_directory)))
+        return -1;
+    struct inline_directory *directory = &scan->inlines[scan->inline_count++];
+    directory->directory = number;
+    memcpy(directory->data, inode + 0x28 + 4, sizeof(directory->data));
+    return 0;
+}
+
+/**
+ * Reads all inode tables in order, noting the directories.
+ */
+static int read_inode_tables(struct scan *scan)
+{
+    const struct ext4_image *image = scan->image;
+    const size_t per_read = READ_SIZE / image->inode_size;
+    unsigned char *buffer = malloc(per_read * image->inode_size);
+    if (buffer == NULL)
+        return -1;
+
+    int result = 0;
+    for (uint32_t group = 0; result == 0 && group < image->group_count;
+         group++)
+    {
+        const uint64_t table = image->inode_tables[group] * image->block_size;
+        const uint32_t used = image->used_inodes[group];
+        for (uint32_t first = 0; result == 0 && first < used;
+             first += per_read)
+        {
+            const size_t count =
+                (used - first < per_read) ? used - first : per_read;
+            result = read_at(image, buffer, count * image->inode_size,
+                             table + (uint64_t)first * image->inode_size);
+
+            for (size_t i = 0; result == 0 && i < count; i++)
+            {
+                const uint64_t number =
+                    (uint64_t)group * image->inodes_per_group + first + i + 1;
+                const unsigned char *inode = buffer + i * image->inode_size;
+                if (number > image->inode_count)
+                    break;
+                if (le16(inode + 0x1A) > 0 && S_ISDIR(le16(inode)))
+                    result = add_directory(scan, (uint32_t)number, inode);
+            }
+        }
+    }
+
+    const int saved_errno = errno;
+    free(buffer);
+    errno = saved_errno;
+    return result;
+}
+
+static uint32_t hash_inode(uint32_t inode)
+{
+    return inode * 2654435761U; // Knuth's multiplicative hash
+}
+
+/**
+ * Copies a name to names.
+ * @returns its offset, (size_t)-1 with errno set on error
+ */
+static size_t add_name(struct scan *scan, const char *name,
+                       size_t name_length)
+{
+    if (scan->names_size - scan->names_length < name_length + 1)
+    {
+        size_t size = (scan->names_size == 0) ? 65536 : scan->names_size;
+        while (size - scan->names_length < name_length + 1)
+            size *= 2;
+        char *grown = realloc(scan->names, size);
+        if (grown == NULL)
+            return (size_t)-1;
+        scan->names = grown;
+        scan->names_size = size;
+    }
+
+    const size_t offset = scan->names_length;
+    memcpy(scan->names + offset, name, name_length);
+    scan->names[offset + name_length] = '\0';
+    scan->names_length += name_length + 1;
+    return offset;
+}
+
+/**
+ * Tests an entry of the directory being read, and notes where it is if it
+ * matched or is a directory.
+ */
+static int scan_entry(uint32_t inode, const char *name, size_t name_length,
+                      void *context)
+{
+    struct scan *scan = context;
+    char buffer[256 + 1];
+    if (name_length >= sizeof(buffer))
+        return 0; // not a valid name
+    memcpy(buffer, name, name_length);
+    buffer[name_length] = '\0';
+
+    const bool directory = is_directory(scan, inode);
+    const bool matched = scan->test(buffer, inode, scan->context);
+    if (!directory && !matched)
+        return 0;
+
+    const size_t offset = add_name(scan, name, name_length);
+    if (offset == (size_t)-1)
+        return -1;
+
+    if (directory)
+    {
+        size_t slot = hash_inode(inode) & scan->parent_mask;
+        while (scan->parents[slot].directory != 0 &&
+               scan->parents[slot].directory != inode)
+            slot = (slot + 1) & scan->parent_mask;
+        if (scan->parents[slot].directory == 0) // else a second link: broken
+            scan->parents[slot] = (struct parent){
+                .directory = inode, .parent = scan->current, .name = offset};
+    }
+
+    if (matched)
+    {
+        if (-1 == reserve((void **)&scan->matches, &scan->match_capacity,
+                          scan->match_count, sizeof(struct match)))
+            return -1;
+        scan->matches[scan->match_count++] = (struct match){
+            .parent = scan->current, .inode = inode, .name = offset};
+    }
+    return 0;
+}
+
+static int compare_extents(const void *a, const void *b)
+{
+    const struct extent *x = a;
+    const struct extent *y = b;
+    return (x->block > y->block) - (x->block < y->block);
+}
+
+/**
+ * Reads all directory blocks in block order, testing their entries.
+ */
+static int read_directories(struct scan *scan)
+{
+    const struct ext4_image *image = scan->image;
+
+    size_t slots = 16;
+    while (slots < scan->directory_count * 2)
+        slots *= 2;
+    scan->parents = calloc(slots, sizeof(struct parent));
+    if (scan->parents == NULL)
+        return -1;
+    scan->parent_mask = slots - 1;
+
+    int result = 0;
+    for (size_t i = 0; result == 0 && i < scan->inline_count; i++)
+    {
+        scan->current = scan->inlines[i].directory;
+        result = read_entries(image, scan->inlines[i].data,
+                              sizeof(scan->inlines[i].data), scan_entry,
+                              scan);
+    }
+
+    qsort(scan->extents, scan->extent_count, sizeof(struct extent),
+          compare_extents);
+
+    const uint32_t per_read = READ_SIZE / image->block_size;
+    unsigned char *buffer = malloc((size_t)per_read * image->block_size);
+    if (buffer == NULL)
+        return -1;
+
+    for (size_t i = 0; result == 0 && i < scan->extent_count; i++)
+    {
+        const struct extent *extent = &scan->extents[i];
+        scan->current = extent->directory;
+        for (uint32_t first = 0; result == 0 && first < extent->count;
+             first += per_read)
+        {
+            const uint32_t count = (extent->count - first < per_read)
+                                       ? extent->count - first
+                                       : per_read;
+            result = read_blocks(image, buffer, extent->block + first, count);
+            for (uint32_t j = 0; result == 0 && j < count; j++)
+                result = read_entries(image,
+                                      buffer + (size_t)j * image->block_size,
+                                      image->block_size, scan_entry, scan);
+        }
+    }
+
+    const int saved_errno = errno;
+    free(buffer);
+    errno = saved_errno;
+    return result;
+}
+
+static const struct parent *find_parent(const struct scan *scan,
+                                        uint32_t directory)
+{
+    size_t slot = hash_inode(directory) & scan->parent_mask;
+    while (scan->parents[slot].directory != 0)
+    {
+        if (scan->parents[slot].directory == directory)
+            return &scan->parents[slot];
+        slot = (slot + 1) & scan->parent_mask;
+    }
+    return NULL;
+}
+
+/**
+ * Puts together the path of a match from its directory's chain of parents.
+ * @param path Grown as needed
+ * @returns 1 on success, 0 if the match can't be reached from the root, -1
+ *          with errno set on error
+ */
+static int build_path(const struct scan *scan, const struct match *match,
+                      char **path, size_t *path_size)
+{
+    // names from the match up, then copied in reverse
+    size_t chain[MAX_PATH_DEPTH];
+    size_t depth = 0;
+    size_t length = strlen(scan->names + match->name) + 1;
+    chain[depth++] = match->name;
+
+    for (uint32_t directory = match->parent; directory != ROOT_INODE;)
+    {
+        const struct parent *parent = find_parent(scan, directory);
+        if (parent == NULL || depth == MAX_PATH_DEPTH)
+            return 0; // orphaned, or a loop in a corrupt image
+        chain[depth++] = parent->name;
+        length += strlen(scan->names + parent->name) + 1;
+        directory = parent->parent;
+    }
+
+    if (length + 1 > *path_size)
+    {
+        char *grown = realloc(*path, length + 1);
+        if (grown == NULL)
+            return -1;
+        *path = grown;
+        *path_size = length + 1;
+    }
+
+    char *end = *path;
+    while (depth > 0)
+    {
+        const char *name = scan->names + chain[--depth];
+        const size_t name_length = strlen(name);
+        *end++ = '/';
+        memcpy(end, name, name_length);
+        end += name_length;
+    }
+    *end = '\0';
+    return 1;
+}
+
+int ext4_scan(struct ext4_image *image, ext4_test_function test,
+              ext4_report_function report, void *context)
+{
+    struct scan scan = {.image = image, .test = test, .context = context};
+    scan.directories = calloc(image->inode_count / 8 + 1, 1);
+    if (scan.directories == NULL)
+        return -1;
+
+    int result = read_inode_tables(&scan);
+    if (result == 0)
+        result = read_directories(&scan);
+
+    char *path = NULL;
+    size_t path_size = 0;
+    for (size_t i = 0; result == 0 && i < scan.match_count; i++)
+    {
+        const int built = build_path(&scan, &scan.matches[i], &path,
+                                     &path_size);
+        if (built == -1)
+            result = -1;
+        else if (built == 1)
+            report(path, scan.matches[i].inode, context);
+    }
+
+    const int saved_errno = errno;
+    free(path);
+    free(scan.directories);
+    free(scan.extents);
+    free(scan.inlines);
+    free(scan.parents);
+    free(scan.matches);
+    free(scan.names);
+    errno = saved_errno;
+    return result;
+}
@@ -0,0 +1,95 @@
+/**
+ * Title:         ext4image.h
+ * Description:   Name and inode queries on ext4 image files, without mounting
+ * Purpose:       Answers "which paths have this name" or "which paths link
+ *                to this inode" for an ext2/3/4 file system image, read as
+ *                a plain file: no privileges, no loop device, no VFS, and
+ *                no walk from directory to directory.
+ *                A scan reads the inode tables front to back, in large
+ *                sequential reads, noting each directory and where its
+ *                blocks are (extent trees, or block maps of ext2/3). It
+ *                then reads all directory blocks sorted by block number,
+ *                one sweep across the disk, testing every entry and noting
+ *                each subdirectory's parent and name, so the paths of the
+ *                matches are put together at the end, from the parent links
+ *                alone. Only the directories' layout and the matches stay
+ *                in memory.
+ *                The image is read as it is: a journal that still needs
+ *                recovery is not replayed. Images with meta_bg group
+ *                descriptors are not supported, and inline-data
+ *                directories only have the entries held in the inode
+ *                itself read.
+ * Usage:         struct ext4_image image;
+ *                if (ext4_open(&image, "disk.img") == -1) perror(...) ...
+ *                ext4_lookup(&image, "/etc/passwd", &inode) ...
+ *                ext4_scan(&image, test, report, context) ...
+ *                ext4_close(&image);
+ * Build with:    gcc -c ext4image.c
+ */
+
+#ifndef EXT4IMAGE_H
+#define EXT4IMAGE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct ext4_image
+{
+    int fd;
+    uint32_t block_size;
+    uint64_t block_count;
+    uint32_t inode_count;
+    uint32_t inodes_per_group;
+    uint32_t inode_size;
+    uint32_t group_count;
+    uint64_t *inode_tables; // first block of each group's inode table
+    uint32_t *used_inodes;  // inodes of each group that can be in use, at
+                            // the start of its table
+    bool file_type;         // directory entries have a type byte
+};
+
+/**
+ * Tells if a directory entry matches a query.
+ * @param name The entry's name, null terminated
+ */
+typedef bool (*ext4_test_function)(const char *name, uint32_t inode,
+                                   void *context);
+
+/**
+ * Called for each entry that matched, with its path in the image, starting
+ * with `/`.
+ */
+typedef void (*ext4_report_function)(const char *path, uint32_t inode,
+                                     void *context);
+
+/**
+ * Opens an image and reads its superblock and group descriptors.
+ * @returns 0 on success, -1 with errno set on error: EINVAL if it isn't an
+ *          ext2/3/4 file system or is corrupt, ENOTSUP if it uses features
+ *          that aren't supported
+ */
+int ext4_open(struct ext4_image *image, const char *path);
+
+/**
+ * Finds the inode of a path in the image, following no symbolic links.
+ * @param path Path from the image's root, `/` separated
+ * @returns 0 on success, -1 with errno set on error: ENOENT if there is no
+ *          such path, ENOTDIR if a component before the last isn't a
+ *          directory
+ */
+int ext4_lookup(struct ext4_image *image, const char *path,
+                uint32_t *inode);
+
+/**
+ * Tests every entry of every directory, except `.` and `..`, then reports
+ * those that matched and can be reached from the root, in no particular
+ * order.
+ * @returns 0 on success, -1 with errno set on error
+ */
+int ext4_scan(struct ext4_image *image, ext4_test_function test,
+              ext4_report_function report, void *context);
+
+void ext4_close(struct ext4_image *image);
+
+#endif
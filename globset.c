@@ -0,0 +1,418 @@
+/**
+ * Title:         globset.c
+ * Description:   Matches a name against many fnmatch(3) globs at once
+ * Purpose:       See globset.h.
+ *                The automaton is a complete DFA: every state has a next
+ *                state for every character class, failure links folded in
+ *                at compile time, so a scan is one table lookup per
+ *                character. Characters are mapped to classes first, the
+ *                bytes that appear in no literal all sharing class 0, to
+ *                keep the table at a few dozen columns instead of 256.
+ * Build with:    gcc -c globset.c
+ */
+
+#define _XOPEN_SOURCE 700
+#include "globset.h"
+
+#include <errno.h>
+#include <fnmatch.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// -------------------------------- literals --------------------------------
+
+/**
+ * Finds the end of a bracket expression.
+ * @param p At the opening `[`
+ * @returns the closing `]`, NULL if there is none and the `[` is literal
+ */
+static const char *bracket_end(const char *p)
+{
+    p++;
+    if (*p == '!' || *p == '^')
+        p++;
+    if (*p == ']')
+        p++; // a leading ] is part of the set
+
+    while (*p != '\0' && *p != ']')
+    {
+        if (*p == '[' && (p[1] == ':' || p[1] == '.' || p[1] == '='))
+        { // [:class:], [.symbol.] or [=equivalent=]
+            const char delimiter = p[1];
+            p += 2;
+            while (*p != '\0' && !(*p == delimiter && p[1] == ']'))
+                p++;
+            if (*p == '\0')
+                return NULL;
+            p += 2;
+            continue;
+        }
+        if (*p == '\\' && p[1] != '\0')
+            p++;
+        p++;
+    }
+
+    return (*p == ']') ? p : NULL;
+}
+
+/**
+ * Finds the longest run of characters a glob only matches literally.
+ * @param literal Receives the run, room for strlen(pattern) bytes
+ * @param run Scratch space, room for strlen(pattern) bytes
+ * @returns the length of the run, 0 if the glob has no literal character
+ */
+static size_t longest_literal(const char *pattern, char *literal, char *run)
+{
+    size_t longest = 0;
+    size_t length = 0;
+
+    for (const char *p = pattern;; p++)
+    {
+        const char *end = NULL;
+        const bool wildcard =
+            *p == '\0' || *p == '*' || *p == '?' ||
+            (*p == '[' && NULL != (end = bracket_end(p)));
+
+        if (!wildcard)
+        {
+            if (*p == '\\' && p[1] != '\0')
+                p++; // escaped, matches itself
+            run[length++] = *p;
+            continue;
+        }
+
+        if (length > longest)
+        {
+            memcpy(literal, run, length);
+            longest = length;
+        }
+        length = 0;
+
+        if (*p == '\0')
+            break;
+        if (end != NULL)
+            p = end;
+    }
+
+    return longest;
+}
+
+// ------------------------------- automaton --------------------------------
+
+/**
+ * Grows an array to hold at least count elements.
+ * @returns 0 on success, -1 with errno set on error
+ */
+static int reserve(void **array, size_t *capacity, size_t count,
+                   size_t element_size)
+{
+    if (count <= *capacity)
+        return 0;
+
+    size_t new_capacity = (*capacity == 0) ? 64 : *capacity;
+    while (new_capacity < count)
+        new_capacity *= 2;
+
+    void *grown = realloc(*array, new_capacity * element_size);
+    if (grown == NULL)
+        return -1;
+
+    *array = grown;
+    *capacity = new_capacity;
+    return 0;
+}
+
+/**
+ * Adds a state without transitions.
+ * @returns the state, -1 with errno set on error
+ */
+static int32_t add_state(struct globset *set, size_t *states_capacity,
+                         size_t *delta_capacity)
+{
+    const size_t state = set->state_count;
+
+    if (reserve((void **)&set->outputs, states_capacity, state + 1,
+                sizeof(int32_t)) == -1)
+        return -1;
+    if (reserve((void **)&set->delta, delta_capacity,
+                (state + 1) * set->class_count, sizeof(int32_t)) == -1)
+        return -1;
+
+    set->outputs[state] = -1;
+    for (uint32_t c = 0; c < set->class_count; c++)
+        set->delta[state * set->class_count + c] = -1;
+
+    set->state_count++;
+    return state;
+}
+
+/**
+ * Adds a literal to the trie, ending in the output of its pattern.
+ * @returns 0 on success, -1 with errno set on error
+ */
+static int add_literal(struct globset *set, const char *literal,
+                       size_t length, uint32_t pattern,
+                       size_t *states_capacity, size_t *delta_capacity,
+                       size_t *links_capacity, size_t *links_count)
+{
+    int32_t state = 0;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        const size_t cell =
+            state * set->class_count + set->classes[(uint8_t)literal[i]];
+
+        if (set->delta[cell] == -1)
+        {
+            const int32_t next =
+                add_state(set, states_capacity, delta_capacity);
+            if (next == -1)
+                return -1;
+            set->delta[cell] = next; // add_state() may have moved delta
+        }
+        state = set->delta[cell];
+    }
+
+    if (reserve((void **)&set->output_links, links_capacity,
+                *links_count + 2, sizeof(int32_t)) == -1)
+        return -1;
+
+    set->output_links[*links_count] = pattern;
+    set->output_links[*links_count + 1] = set->outputs[state];
+    set->outputs[state] = *links_count;
+    *links_count += 2;
+    return 0;
+}
+
+/**
+ * Turns the trie into a complete DFA: missing transitions take the
+ * failure link's, and each state gets its dictionary link.
+ * @returns 0 on success, -1 with errno set on error
+ */
+static int link_states(struct globset *set)
+{
+    const uint32_t classes = set->class_count;
+    int32_t *failure = malloc(set->state_count * sizeof(int32_t));
+    int32_t *queue = malloc(set->state_count * sizeof(int32_t));
+    set->dictionary = malloc(set->state_count * sizeof(int32_t));
+    if (failure == NULL || queue == NULL || set->dictionary == NULL)
+    {
+        free(failure);
+        free(queue);
+        return -1;
+    }
+
+    size_t head = 0;
+    size_t tail = 0;
+
+    failure[0] = 0;
+    set->dictionary[0] = -1;
+    for (uint32_t c = 0; c < classes; c++)
+    {
+        const int32_t child = set->delta[c];
+        if (child == -1)
+            set->delta[c] = 0;
+        else
+        {
+            failure[child] = 0;
+            set->dictionary[child] = -1;
+            queue[tail++] = child;
+        }
+    }
+
+    // breadth first, so failure links point to finished states
+    while (head < tail)
+    {
+        const int32_t state = queue[head++];
+
+        for (uint32_t c = 0; c < classes; c++)
+        {
+            const int32_t child = set->delta[state * classes + c];
+            const int32_t fallback = set->delta[failure[state] * classes + c];
+
+            if (child == -1)
+            {
+                set->delta[state * classes + c] = fallback;
+                continue;
+            }
+
+            failure[child] = fallback;
+            set->dictionary[child] = (set->outputs[fallback] != -1)
+                                         ? fallback
+                                         : set->dictionary[fallback];
+            queue[tail++] = child;
+        }
+    }
+
+    free(failure);
+    free(queue);
+    return 0;
+}
+
+// ---------------------------------- set -----------------------------------
+
+void globset_init(struct globset *set)
+{
+    memset(set, 0, sizeof(struct globset));
+}
+
+int32_t globset_add(struct globset *set, const char *pattern)
+{
+    if (set->count == INT32_MAX)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    size_t capacity = set->capacity;
+    if (reserve((void **)&set->patterns, &capacity, set->count + 1,
+                sizeof(char *)) == -1)
+        return -1;
+    set->capacity = capacity;
+
+    char *copy = strdup(pattern);
+    if (copy == NULL)
+        return -1;
+
+    set->patterns[set->count] = copy;
+    return set->count++;
+}
+
+int globset_compile(struct globset *set)
+{
+    size_t longest_pattern = 0;
+    for (uint32_t i = 0; i < set->count; i++)
+    {
+        const size_t length = strlen(set->patterns[i]);
+        if (length > longest_pattern)
+            longest_pattern = length;
+    }
+
+    char *literals = malloc((size_t)set->count * (longest_pattern + 1) + 1);
+    size_t *literal_lengths = malloc(set->count * sizeof(size_t) + 1);
+    char *run = malloc(longest_pattern + 1);
+    set->unfiltered = malloc(set->count * sizeof(uint32_t) + 1);
+    if (literals == NULL || literal_lengths == NULL || run == NULL ||
+        set->unfiltered == NULL)
+    {
+        free(literals);
+        free(literal_lengths);
+        free(run);
+        return -1;
+    }
+
+    // the literals, and the character classes of their bytes
+    memset(set->classes, 0, sizeof(set->classes));
+    set->class_count = 1;
+
+    for (uint32_t i = 0; i < set->count; i++)
+    {
+        char *literal = literals + i * (longest_pattern + 1);
+        literal_lengths[i] = longest_literal(set->patterns[i], literal, run);
+
+        if (literal_lengths[i] == 0)
+            set->unfiltered[set->unfiltered_count++] = i;
+
+        for (size_t j = 0; j < literal_lengths[i]; j++)
+        {
+            if (set->classes[(uint8_t)literal[j]] == 0)
+                set->classes[(uint8_t)literal[j]] = set->class_count++;
+        }
+    }
+    free(run);
+
+    // trie of the literals, then its links
+    size_t states_capacity = 0;
+    size_t delta_capacity = 0;
+    size_t links_capacity = 0;
+    size_t links_count = 0;
+    int result = add_state(set, &states_capacity, &delta_capacity);
+
+    for (uint32_t i = 0; i < set->count && result != -1; i++)
+    {
+        if (literal_lengths[i] != 0)
+            result = add_literal(set, literals + i * (longest_pattern + 1),
+                                 literal_lengths[i], i, &states_capacity,
+                                 &delta_capacity, &links_capacity,
+                                 &links_count);
+    }
+
+    if (result != -1)
+        result = link_states(set);
+
+    free(literals);
+    free(literal_lengths);
+    return (result == -1) ? -1 : 0;
+}
+
+static int compare_indexes(const void *a, const void *b)
+{
+    const uint32_t first = *(const uint32_t *)a;
+    const uint32_t second = *(const uint32_t *)b;
+    return (first > second) - (first < second);
+}
+
+/**
+ * Adds a pattern to the candidates, unless it is one already.
+ */
+static void add_candidate(uint32_t *candidates, size_t *count,
+                          uint32_t pattern)
+{
+    for (size_t i = 0; i < *count; i++)
+    {
+        if (candidates[i] == pattern)
+            return;
+    }
+    candidates[(*count)++] = pattern;
+}
+
+size_t globset_match(const struct globset *set, const char *name,
+                     uint32_t *matches)
+{
+    size_t count = 0;
+    int32_t state = 0;
+
+    // candidates: the patterns whose literal is in the name
+    for (const uint8_t *p = (const uint8_t *)name; *p != '\0'; p++)
+    {
+        state = set->delta[state * set->class_count + set->classes[*p]];
+
+        int32_t found = (set->outputs[state] != -1) ? state
+                                                    : set->dictionary[state];
+        for (; found != -1; found = set->dictionary[found])
+        {
+            for (int32_t link = set->outputs[found]; link != -1;
+                 link = set->output_links[link + 1])
+                add_candidate(matches, &count, set->output_links[link]);
+        }
+    }
+
+    for (uint32_t i = 0; i < set->unfiltered_count; i++)
+        add_candidate(matches, &count, set->unfiltered[i]);
+
+    qsort(matches, count, sizeof(uint32_t), compare_indexes);
+
+    // confirmed by the whole pattern
+    size_t confirmed = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (0 == fnmatch(set->patterns[matches[i]], name, 0))
+            matches[confirmed++] = matches[i];
+    }
+
+    return confirmed;
+}
+
+void globset_free(struct globset *set)
+{
+    for (uint32_t i = 0; i < set->count; i++)
+        free(set->patterns[i]);
+    free(set->patterns);
+    free(set->delta);
+    free(set->outputs);
+    free(set->dictionary);
+    free(set->output_links);
+    free(set->unfiltered);
+    memset(set, 0, sizeof(struct globset));
+}
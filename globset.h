@@ -0,0 +1,80 @@
+/**
+ * Title:         globset.h
+ * Description:   Matches a name against many fnmatch(3) globs at once
+ * Purpose:       Testing a name against thousands of globs one fnmatch(3)
+ *                call at a time costs thousands of calls per name. A glob
+ *                set first scans the name once with an Aho-Corasick
+ *                automaton of literals taken from the globs, the longest
+ *                run of plain characters of each, which any name the glob
+ *                matches must contain. Only the globs whose literal was
+ *                found, and those without any literal (like `*` or `?*`),
+ *                are then confirmed with fnmatch(3). Most names find no
+ *                literal at all, and cost one pass over their characters.
+ *                Globs are matched like fnmatch(3) with no flags.
+ *                A compiled set is only read by globset_match(), so
+ *                several threads can match against the same set.
+ * Usage:         struct globset set;
+ *                globset_init(&set);
+ *                globset_add(&set, "*.tmp") ...
+ *                if (globset_compile(&set) == -1) perror(...) ...
+ *                uint32_t *matches = malloc(set.count * sizeof(uint32_t));
+ *                size_t found = globset_match(&set, name, matches);
+ *                for (size_t i = 0; i < found; i++)
+ *                    puts(set.patterns[matches[i]]);
+ *                globset_free(&set);
+ * Build with:    gcc -c globset.c
+ */
+
+#ifndef GLOBSET_H
+#define GLOBSET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct globset
+{
+    char **patterns; // in the order they were added
+    uint32_t count;
+    uint32_t capacity;
+
+    // Aho-Corasick automaton over the patterns' literals, built by
+    // globset_compile()
+    uint8_t classes[256];   // byte -> character class, 0 if in no literal
+    uint32_t class_count;
+    int32_t *delta;         // state * class_count + class -> next state
+    int32_t *outputs;       // state -> first of its list in output_links,
+                            // -1 if no literal ends there
+    int32_t *dictionary;    // state -> nearest state with outputs along
+                            // its failure links, -1 if none
+    uint32_t state_count;
+    int32_t *output_links;  // pairs: pattern, next pair's index or -1
+    uint32_t *unfiltered;   // patterns without a literal
+    uint32_t unfiltered_count;
+};
+
+void globset_init(struct globset *set);
+
+/**
+ * Adds a glob to a set not compiled yet.
+ * @returns its index, -1 with errno set on error
+ */
+int32_t globset_add(struct globset *set, const char *pattern);
+
+/**
+ * Builds the automaton, after which no globs can be added.
+ * @returns 0 on success, -1 with errno set on error
+ */
+int globset_compile(struct globset *set);
+
+/**
+ * Finds the globs of a compiled set that match a name.
+ * @param matches Room for set->count indexes, receives the indexes of the
+ *                matching globs in increasing order
+ * @returns the number of matching globs
+ */
+size_t globset_match(const struct globset *set, const char *name,
+                     uint32_t *matches);
+
+void globset_free(struct globset *set);
+
+#endif
@@ -0,0 +1,445 @@
+/**
+ * Title:         idcache.c
+ * Description:   Caches passwd/group lookups in a table that can be mmapped
+ * Purpose:       See idcache.h.
+ *                The cache file is a header followed by a power-of-two
+ *                number of struct identity slots, probed linearly from a
+ *                hash of the UID. The table doubles when three quarters
+ *                full, so probe runs stay short.
+ * Build with:    gcc -c idcache.c
+ */
+
+#define _GNU_SOURCE
+#include "idcache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <pwd.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define IDCACHE_MAGIC "IDCACHE1"
+#define IDCACHE_INITIAL_CAPACITY 256 // slots of a new table, a power of two
+
+struct idcache_header
+{
+    char magic[8];       // IDCACHE_MAGIC, without the NUL
+    uint32_t entry_size; // sizeof(struct identity) of the writer
+    uint32_t capacity;   // number of slots, a power of two
+    uint32_t count;      // slots in use
+    uint32_t reserved;
+};
+
+// --------------------------------- table ----------------------------------
+
+static size_t table_size(uint32_t capacity)
+{
+    return sizeof(struct idcache_header) +
+           (size_t)capacity * sizeof(struct identity);
+}
+
+/**
+ * Maps a table of the given capacity, from the cache file if there is one.
+ * @returns 0 on success, -1 with errno set on error
+ */
+static int map_table(struct idcache *cache, uint32_t capacity)
+{
+    const size_t size = table_size(capacity);
+    void *mapping;
+
+    if (cache->fd == -1)
+        mapping = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    else
+        mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                       cache->fd, 0);
+
+    if (mapping == MAP_FAILED)
+        return -1;
+
+    cache->header = mapping;
+    cache->entries = (struct identity *)(cache->header + 1);
+    cache->mapped_size = size;
+    return 0;
+}
+
+/**
+ * Writes the header of an empty table over a mapped table of zeros.
+ */
+static void start_table(struct idcache *cache, uint32_t capacity)
+{
+    memcpy(cache->header->magic, IDCACHE_MAGIC, sizeof(cache->header->magic));
+    cache->header->entry_size = sizeof(struct identity);
+    cache->header->capacity = capacity;
+    cache->header->count = 0;
+}
+
+/**
+ * Sizes the cache file for an empty table and maps it.
+ * @returns 0 on success, -1 with errno set on error
+ */
+static int create_table(struct idcache *cache, uint32_t capacity)
+{
+    if (cache->fd != -1)
+    { // drop the old contents, the new ones read as zeros
+        if (ftruncate(cache->fd, 0) == -1 ||
+            ftruncate(cache->fd, table_size(capacity)) == -1)
+            return -1;
+    }
+
+    if (map_table(cache, capacity) == -1)
+        return -1;
+
+    start_table(cache, capacity);
+    return 0;
+}
+
+/**
+ * Whether the mapped cache file holds a table this build can read. The
+ * count must match the occupied slots: the records are copied by it when
+ * the table grows, and probing relies on a free slot being left.
+ */
+static bool valid_table(const struct idcache *cache, off_t file_size)
+{
+    const struct idcache_header *header = cache->header;
+
+    if (memcmp(header->magic, IDCACHE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->entry_size != sizeof(struct identity) ||
+        header->capacity < IDCACHE_INITIAL_CAPACITY ||
+        (header->capacity & (header->capacity - 1)) != 0 ||
+        header->count >= header->capacity ||
+        (off_t)table_size(header->capacity) != file_size)
+        return false;
+
+    uint32_t occupied = 0;
+    for (uint32_t i = 0; i < header->capacity; i++)
+    {
+        if (cache->entries[i].fetched != 0)
+            occupied++;
+    }
+    return occupied == header->count;
+}
+
+/**
+ * Finds the slot of a UID, or the free slot it would go in.
+ */
+static struct identity *find_slot(struct idcache *cache, uint32_t uid)
+{
+    const uint32_t mask = cache->header->capacity - 1;
+    uint32_t i = (uid * 2654435761u) & mask; // Knuth's multiplicative hash
+
+    while (cache->entries[i].fetched != 0 && cache->entries[i].uid != uid)
+        i = (i + 1) & mask;
+
+    return &cache->entries[i];
+}
+
+/**
+ * Makes room for more records, doubling the table until they fit under
+ * three quarters of it. The larger table is mapped before the old one is
+ * dropped, so on error the cache, and its file, keep the old table.
+ * @returns 0 on success, -1 with errno set on error
+ */
+static int reserve(struct idcache *cache, size_t more)
+{
+    uint32_t capacity = cache->header->capacity;
+    const size_t needed = cache->header->count + more;
+
+    while (needed > capacity / 4 * 3)
+    {
+        if (capacity > UINT32_MAX / 2)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+        capacity *= 2;
+    }
+
+    if (capacity == cache->header->capacity)
+        return 0;
+
+    // set the records aside, the table is rebuilt in place
+    const uint32_t count = cache->header->count;
+    struct identity *records = malloc(sizeof(struct identity) * (count + 1));
+    if (records == NULL)
+        return -1;
+
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < cache->header->capacity && kept < count; i++)
+    {
+        if (cache->entries[i].fetched != 0)
+            records[kept++] = cache->entries[i];
+    }
+
+    // the file grows under the old table, which stays mapped until the
+    // new one is
+    struct idcache_header *old_header = cache->header;
+    const size_t old_size = cache->mapped_size;
+    if ((cache->fd != -1 &&
+         ftruncate(cache->fd, table_size(capacity)) == -1) ||
+        map_table(cache, capacity) == -1)
+    {
+        const int saved_errno = errno;
+        if (cache->fd != -1)
+            ftruncate(cache->fd, old_size); // the size the old table says
+        free(records);
+        errno = saved_errno;
+        return -1;
+    }
+    munmap(old_header, old_size);
+
+    // a file mapping starts with the old table
+    memset(cache->header, 0, cache->mapped_size);
+    start_table(cache, capacity);
+
+    for (uint32_t i = 0; i < kept; i++)
+        *find_slot(cache, records[i].uid) = records[i];
+    cache->header->count = kept;
+
+    free(records);
+    return 0;
+}
+
+// ---------------------------------- NSS -----------------------------------
+
+static void copy_string(char *destination, const char *source, size_t size)
+{
+    snprintf(destination, size, "%s", source == NULL ? "" : source);
+}
+
+/**
+ * Fills a record from NSS: getpwuid_r(3), then getgrouplist(3).
+ * @returns 0 on success (including UIDs without a passwd entry), -1 with
+ *          errno set if NSS failed
+ */
+static int fetch_identity(uid_t uid, struct identity *identity)
+{
+    long buffer_size = sysconf(_SC_GETPW_R_SIZE_MAX);
+    if (buffer_size <= 0)
+        buffer_size = 16384;
+
+    char *buffer = NULL;
+    struct passwd passwd;
+    struct passwd *result = NULL;
+    int error;
+
+    do
+    {
+        char *larger = realloc(buffer, buffer_size);
+        if (larger == NULL)
+        {
+            free(buffer);
+            return -1;
+        }
+        buffer = larger;
+
+        error = getpwuid_r(uid, &passwd, buffer, buffer_size, &result);
+        buffer_size *= 2;
+    } while (error == ERANGE);
+
+    if (error != 0)
+    {
+        free(buffer);
+        errno = error;
+        return -1;
+    }
+
+    memset(identity, 0, sizeof(struct identity));
+    identity->uid = uid;
+
+    if (result != NULL)
+    {
+        identity->found = 1;
+        identity->gid = passwd.pw_gid;
+        copy_string(identity->name, passwd.pw_name, sizeof(identity->name));
+        copy_string(identity->home, passwd.pw_dir, sizeof(identity->home));
+        copy_string(identity->shell, passwd.pw_shell, sizeof(identity->shell));
+
+        gid_t groups[IDCACHE_MAX_GROUPS];
+        int group_count = IDCACHE_MAX_GROUPS;
+
+        // -1 only means there were more groups than fit, keep the first ones
+        getgrouplist(passwd.pw_name, passwd.pw_gid, groups, &group_count);
+        if (group_count > IDCACHE_MAX_GROUPS)
+            group_count = IDCACHE_MAX_GROUPS;
+
+        for (int i = 0; i < group_count; i++)
+            identity->groups[i] = groups[i];
+        identity->group_count = group_count;
+    }
+
+    free(buffer);
+    identity->fetched = time(NULL);
+    return 0;
+}
+
+// --------------------------------- cache ----------------------------------
+
+int idcache_open(struct idcache *cache, const char *path, time_t ttl,
+                 char *error, size_t error_size)
+{
+    memset(cache, 0, sizeof(struct idcache));
+    cache->fd = -1;
+    cache->ttl = ttl;
+
+    if (path == NULL)
+    {
+        if (create_table(cache, IDCACHE_INITIAL_CAPACITY) == -1)
+        {
+            snprintf(error, error_size, "mmap(): %s", strerror(errno));
+            return -1;
+        }
+        return 0;
+    }
+
+    cache->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (cache->fd == -1)
+    {
+        snprintf(error, error_size, "%s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    struct stat status;
+    if (flock(cache->fd, LOCK_EX) == -1 || fstat(cache->fd, &status) == -1)
+    {
+        snprintf(error, error_size, "%s: %s", path, strerror(errno));
+        close(cache->fd);
+        return -1;
+    }
+
+    bool valid = false;
+    if (status.st_size >= (off_t)sizeof(struct idcache_header))
+    { // map the header alone first, the capacity gives the full size
+        struct idcache_header header;
+        if (pread(cache->fd, &header, sizeof(header), 0) ==
+                (ssize_t)sizeof(header) &&
+            (header.capacity & (header.capacity - 1)) == 0 &&
+            (off_t)table_size(header.capacity) == status.st_size &&
+            map_table(cache, header.capacity) == 0)
+        {
+            valid = valid_table(cache, status.st_size);
+            if (!valid)
+            {
+                munmap(cache->header, cache->mapped_size);
+                cache->header = NULL;
+                cache->entries = NULL;
+            }
+        }
+    }
+
+    if (!valid && create_table(cache, IDCACHE_INITIAL_CAPACITY) == -1)
+    {
+        snprintf(error, error_size, "%s: %s", path, strerror(errno));
+        close(cache->fd);
+        return -1;
+    }
+
+    return 0;
+}
+
+void idcache_close(struct idcache *cache)
+{
+    if (cache->header != NULL)
+        munmap(cache->header, cache->mapped_size);
+    cache->header = NULL;
+    cache->entries = NULL;
+
+    if (cache->fd != -1)
+        close(cache->fd); // also releases the lock
+    cache->fd = -1;
+}
+
+const struct identity *idcache_lookup(struct idcache *cache, uid_t uid)
+{
+    cache->stats.lookups++;
+
+    struct identity *slot = find_slot(cache, uid);
+    if (slot->fetched != 0)
+    {
+        if (time(NULL) - slot->fetched < cache->ttl)
+        {
+            cache->stats.hits++;
+            return slot;
+        }
+        cache->stats.expired++;
+    }
+    cache->stats.misses++;
+
+    struct identity identity;
+    if (fetch_identity(uid, &identity) == -1)
+        return NULL;
+
+    if (slot->fetched == 0)
+    { // new record, growing moves the slot
+        if (reserve(cache, 1) == -1)
+            return NULL;
+        slot = find_slot(cache, uid);
+        cache->header->count++;
+    }
+
+    *slot = identity;
+    return slot;
+}
+
+static int compare_uids(const void *a, const void *b)
+{
+    const uid_t x = *(const uid_t *)a;
+    const uid_t y = *(const uid_t *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Counts the distinct UIDs of a batch that have no record yet.
+ * @returns the count, or -1 with errno set on error
+ */
+static ssize_t count_new_uids(struct idcache *cache, const uid_t *uids,
+                              size_t count)
+{
+    uid_t *missing = malloc(sizeof(uid_t) * (count + 1));
+    if (missing == NULL)
+        return -1;
+
+    size_t missing_count = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (find_slot(cache, uids[i])->fetched == 0)
+            missing[missing_count++] = uids[i];
+    }
+
+    qsort(missing, missing_count, sizeof(uid_t), compare_uids);
+    ssize_t distinct = 0;
+    for (size_t i = 0; i < missing_count; i++)
+    {
+        if (i == 0 || missing[i] != missing[i - 1])
+            distinct++;
+    }
+
+    free(missing);
+    return distinct;
+}
+
+int idcache_lookup_batch(struct idcache *cache, const uid_t *uids,
+                         size_t count, struct identity *results)
+{
+    // grow once for the whole batch, not once per miss
+    const ssize_t new_uids = count_new_uids(cache, uids, count);
+    if (new_uids == -1 || reserve(cache, new_uids) == -1)
+        return -1;
+
+    for (size_t i = 0; i < count; i++)
+    { // repeated UIDs find the record of their first lookup
+        const struct identity *identity = idcache_lookup(cache, uids[i]);
+        if (identity == NULL)
+            return -1;
+        results[i] = *identity;
+    }
+
+    return 0;
+}
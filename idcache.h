@@ -0,0 +1,124 @@
+/**
+ * Title:         idcache.h
+ * Description:   Caches passwd/group lookups in a table that can be mmapped
+ * Purpose:       getpwuid(3) and getgrouplist(3) go through NSS, which may
+ *                be LDAP or sssd and take milliseconds per call. An idcache
+ *                keeps each UID's identity (name, primary GID, home, shell,
+ *                supplementary groups) in an open-addressing hash table of
+ *                fixed-size records, so the table can be mmapped straight
+ *                from a cache file and shared by every tool and run.
+ *                Records older than the TTL are looked up again. UIDs
+ *                without a passwd entry are cached too, as not found.
+ *                The cache file is locked with flock(2) from idcache_open()
+ *                to idcache_close(), other processes wait for it.
+ *                Without a cache file the table lives in anonymous memory
+ *                and only lasts for the process.
+ *                The IDCACHE environment variable names the cache file
+ *                tools use by default.
+ * Usage:         struct idcache cache;
+ *                char error[IDCACHE_ERROR_LENGTH];
+ *                if (idcache_open(&cache, getenv("IDCACHE"),
+ *                                 IDCACHE_DEFAULT_TTL, error,
+ *                                 sizeof(error)) == -1) ...
+ *                const struct identity *identity =
+ *                    idcache_lookup(&cache, getuid());
+ *                idcache_close(&cache);
+ * Build with:    gcc -c idcache.c
+ */
+
+#ifndef IDCACHE_H
+#define IDCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#define IDCACHE_ERROR_LENGTH 128 // enough for any error message
+#define IDCACHE_DEFAULT_TTL 600  // seconds a record stays fresh
+
+#define IDCACHE_NAME_LENGTH 32  // longest user name kept, with the NUL
+#define IDCACHE_PATH_LENGTH 256 // longest home or shell kept, with the NUL
+#define IDCACHE_MAX_GROUPS 64   // supplementary groups kept per user
+
+/**
+ * One UID's identity, as stored in the cache file. Strings too long for
+ * their field are truncated.
+ */
+struct identity
+{
+    int64_t fetched;      // time of the NSS lookup, 0 marks a free slot
+    uint32_t uid;
+    uint32_t gid;         // primary group
+    uint32_t found;       // 0 if the UID has no passwd entry
+    uint32_t group_count; // entries of groups, at most IDCACHE_MAX_GROUPS
+    char name[IDCACHE_NAME_LENGTH];
+    char home[IDCACHE_PATH_LENGTH];
+    char shell[IDCACHE_PATH_LENGTH];
+    uint32_t groups[IDCACHE_MAX_GROUPS]; // from getgrouplist(3)
+};
+
+/**
+ * Lookup counters since idcache_open().
+ */
+struct idcache_stats
+{
+    unsigned long lookups;
+    unsigned long hits;    // answered from a fresh record
+    unsigned long misses;  // went to NSS, including expired records
+    unsigned long expired; // misses caused by records older than the TTL
+};
+
+struct idcache_header;
+
+/**
+ * An open cache, a mapping of the cache file or anonymous memory.
+ */
+struct idcache
+{
+    int fd;                        // cache file, -1 if anonymous
+    struct idcache_header *header; // start of the mapping
+    struct identity *entries;      // the hash table, after the header
+    size_t mapped_size;
+    time_t ttl;
+    struct idcache_stats stats;
+};
+
+/**
+ * Opens a cache, creating the cache file if it doesn't exist. A file that
+ * isn't a valid cache is started over.
+ * @param cache Cache to set up, release with idcache_close()
+ * @param path Cache file, NULL to keep the table in memory
+ * @param ttl Seconds a record stays fresh
+ * @param error Receives a message on error
+ * @param error_size Size of error, IDCACHE_ERROR_LENGTH is enough
+ * @returns 0 on success, -1 on error
+ */
+int idcache_open(struct idcache *cache, const char *path, time_t ttl,
+                 char *error, size_t error_size);
+
+/**
+ * Unmaps the table and unlocks the cache file. Records are already in the
+ * file, as the mapping is shared.
+ */
+void idcache_close(struct idcache *cache);
+
+/**
+ * Looks up a UID, through NSS if its record is missing or stale.
+ * @returns the record, valid until the next lookup; NULL with errno set if
+ *          NSS failed or the table couldn't grow
+ */
+const struct identity *idcache_lookup(struct idcache *cache, uid_t uid);
+
+/**
+ * Looks up many UIDs. Room for all of them is made once up front, and each
+ * distinct UID goes to NSS at most once.
+ * @param uids UIDs to look up, duplicates allowed
+ * @param count Number of uids
+ * @param results Receives a copy of each UID's record, in order of uids
+ * @returns 0 on success, -1 with errno set on the first failed lookup
+ */
+int idcache_lookup_batch(struct idcache *cache, const uid_t *uids,
+                         size_t count, struct identity *results);
+
+#endif
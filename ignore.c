@@ -0,0 +1,306 @@
+/**
+ * Title:         ignore.c
+ * Description:   Rules of .gitignore and .ignore files, stacked per directory
+ * Purpose:       See ignore.h.
+ *                A rule is compiled once, when its file is read: its flags
+ *                are parsed out, and a rule matched against paths has its
+ *                slashes replaced by nulls, so each path segment is matched
+ *                with fnmatch(3) on its own and `**` segments can be tried
+ *                against any number of path segments. Rules without a
+ *                slash only look at the name, with one fnmatch(3) call.
+ * Build with:    gcc -c ignore.c
+ */
+
+#define _XOPEN_SOURCE 700
+#include "ignore.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+const char *const ignore_files[IGNORE_FILE_COUNT] = {".gitignore", ".ignore"};
+
+/**
+ * A line of an ignore file.
+ */
+struct ignore_rule
+{
+    char *segments;      // the glob, null separated where it had slashes
+    int segment_count;   // 1 unless anchored
+    bool negated;        // `!`: not ignored after all
+    bool directory_only; // trailing `/`
+    bool anchored;       // had a slash: matched against the path relative
+                         // to the ignore file's directory, not the name
+};
+
+struct ignore_rules
+{
+    struct ignore_rules *parent; // rules of the nearest ancestor with any
+    size_t prefix_length;        // of the directory's path, slash included
+    struct ignore_rule *rules;   // in file order
+    size_t count;
+    size_t capacity;
+    long references;
+};
+
+// --------------------------------- rules ----------------------------------
+
+/**
+ * Compiles a line of an ignore file into a rule, unless it is blank or a
+ * comment.
+ * @param line Modified
+ * @returns 0 on success, -1 with errno set on error
+ */
+static int add_rule(struct ignore_rules *rules, char *line)
+{
+    size_t length = strlen(line);
+    if (length > 0 && line[length - 1] == '\n')
+        length--;
+    while (length > 0 && line[length - 1] == ' ' &&
+           !(length > 1 && line[length - 2] == '\\'))
+        length--; // trailing spaces, unless escaped
+    line[length] = '\0';
+
+    if (length == 0 || line[0] == '#')
+        return 0;
+
+    struct ignore_rule rule = {0};
+    if (line[0] == '!')
+    {
+        rule.negated = true;
+        line++;
+        length--;
+    }
+    if (length > 0 && line[length - 1] == '/')
+    {
+        rule.directory_only = true;
+        line[--length] = '\0';
+    }
+    rule.anchored = strchr(line, '/') != NULL;
+    if (line[0] == '/')
+    {
+        line++;
+        length--;
+    }
+    if (length == 0)
+        return 0;
+
+    if (rules->count == rules->capacity)
+    {
+        const size_t capacity = (rules->capacity == 0) ? 16
+                                                        : rules->capacity * 2;
+        struct ignore_rule *grown =
+            realloc(rules->rules, capacity * sizeof(struct ignore_rule));
+        if (grown == NULL)
+            return -1;
+        rules->rules = grown;
+        rules->capacity = capacity;
+    }
+
+    rule.segments = strdup(line);
+    if (rule.segments == NULL)
+        return -1;
+    rule.segment_count = 1;
+    for (char *slash = rule.segments; rule.anchored &&
+                                      NULL != (slash = strchr(slash, '/'));)
+    {
+        *slash++ = '\0';
+        rule.segment_count++;
+    }
+
+    rules->rules[rules->count++] = rule;
+    return 0;
+}
+
+int ignore_read(struct ignore_rules **rules, int directory_fd,
+                const char *name, size_t prefix_length)
+{
+    const int fd = openat(directory_fd, name, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return (errno == ENOENT || errno == EACCES || errno == ELOOP) ? 0
+                                                                      : -1;
+
+    FILE *file = fdopen(fd, "r");
+    if (file == NULL)
+    {
+        const int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+
+    // the directory's own rules, on top of what it is under
+    struct ignore_rules *own = *rules;
+    if (own == NULL || own->prefix_length != prefix_length)
+    {
+        own = calloc(1, sizeof(struct ignore_rules));
+        if (own == NULL)
+        {
+            fclose(file);
+            return -1;
+        }
+        own->parent = *rules;
+        own->prefix_length = prefix_length;
+        own->references = 1;
+    }
+
+    char *line = NULL;
+    size_t line_size = 0;
+    int result = 0;
+    while (result == 0 && -1 != getline(&line, &line_size, file))
+        result = add_rule(own, line);
+
+    if (result == 0 && ferror(file) && errno != EISDIR)
+        result = -1;
+
+    const int saved_errno = errno;
+    free(line);
+    fclose(file);
+
+    if (own != *rules)
+    {
+        if (result == 0 && own->count > 0)
+            *rules = own; // takes over the caller's reference to the parent
+        else
+        {
+            own->parent = NULL;
+            ignore_release(own);
+        }
+    }
+
+    errno = saved_errno;
+    return result;
+}
+
+struct ignore_rules *ignore_retain(struct ignore_rules *rules)
+{
+    if (rules != NULL)
+        rules->references++;
+    return rules;
+}
+
+void ignore_release(struct ignore_rules *rules)
+{
+    while (rules != NULL && --rules->references == 0)
+    {
+        struct ignore_rules *parent = rules->parent;
+        for (size_t i = 0; i < rules->count; i++)
+            free(rules->rules[i].segments);
+        free(rules->rules);
+        free(rules);
+        rules = parent;
+    }
+}
+
+// -------------------------------- matching --------------------------------
+
+static const char *next_segment(const char *segment)
+{
+    return segment + strlen(segment) + 1;
+}
+
+/**
+ * Matches path segments against the segments of an anchored rule.
+ * @param pattern First segment of the rule
+ * @param path First segment of the path, null separated
+ */
+static bool match_segments(const char *pattern, int pattern_count,
+                           const char *path, int path_count)
+{
+    while (pattern_count > 0)
+    {
+        if (strcmp(pattern, "**") == 0)
+        {
+            if (pattern_count == 1)
+                return path_count > 0; // what's inside, not the directory
+
+            // any number of segments, then the rest of the rule
+            const char *rest = next_segment(pattern);
+            while (!match_segments(rest, pattern_count - 1, path,
+                                   path_count))
+            {
+                if (path_count == 0)
+                    return false;
+                path = next_segment(path);
+                path_count--;
+            }
+            return true;
+        }
+
+        if (path_count == 0 || 0 != fnmatch(pattern, path, 0))
+            return false;
+
+        pattern = next_segment(pattern);
+        pattern_count--;
+        path = next_segment(path);
+        path_count--;
+    }
+
+    return path_count == 0;
+}
+
+bool ignore_match(const struct ignore_rules *rules, const char *path,
+                  int base, bool directory)
+{
+    const char *name = path + base;
+    if (directory && strcmp(name, ".git") == 0)
+        return true;
+
+    // the path split at its slashes, once an anchored rule needs it
+    char buffer[PATH_MAX];
+    char *split = NULL;
+    bool ignored = false;
+
+    for (; rules != NULL; rules = rules->parent)
+    {
+        size_t i = rules->count;
+        while (i > 0)
+        {
+            const struct ignore_rule *rule = &rules->rules[--i];
+            if (rule->directory_only && !directory)
+                continue;
+
+            bool matched;
+            if (!rule->anchored)
+                matched = 0 == fnmatch(rule->segments, name, 0);
+            else
+            {
+                if (split == NULL)
+                {
+                    const size_t length = strlen(path) + 1;
+                    split = (length <= sizeof(buffer)) ? buffer
+                                                       : malloc(length);
+                    if (split == NULL)
+                        continue; // can't be matched, left to other rules
+                    for (size_t j = 0; j < length; j++)
+                        split[j] = (path[j] == '/') ? '\0' : path[j];
+                }
+
+                int path_count = 1;
+                for (const char *c = path + rules->prefix_length; *c; c++)
+                    path_count += *c == '/';
+
+                matched = match_segments(rule->segments, rule->segment_count,
+                                         split + rules->prefix_length,
+                                         path_count);
+            }
+
+            if (matched)
+            {
+                ignored = !rule->negated;
+                goto decided; // the deepest, last matching rule decides
+            }
+        }
+    }
+
+decided:
+    if (split != buffer)
+        free(split);
+    return ignored;
+}
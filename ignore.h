@@ -0,0 +1,84 @@
+/**
+ * Title:         ignore.h
+ * Description:   Rules of .gitignore and .ignore files, stacked per directory
+ * Purpose:       Decides which entries of a tree walk a source tree's
+ *                ignore files exclude, like git(1) does. Each directory
+ *                with ignore files gets its own compiled rules, linked to
+ *                the rules of its nearest ancestor with any, so a lookup
+ *                walks up a short chain instead of re-reading files, and
+ *                directories without ignore files share their parent's
+ *                rules. The deepest rules that match an entry decide, and
+ *                within a file the last matching rule, so a deeper `!`
+ *                rule can take back what a parent's rule ignored.
+ *                Rules are reference counted: a walk keeps a reference for
+ *                each pending directory, and a chain lives until the last
+ *                directory under it was walked.
+ *                Supported syntax: # comments, blank lines, `!` to
+ *                negate, a trailing `/` for directories only, a leading or
+ *                middle `/` to match relative to the ignore file's
+ *                directory instead of at any depth, `**` as a whole path
+ *                segment for any number of segments, and fnmatch(3) globs
+ *                otherwise. Trailing spaces are dropped unless escaped.
+ *                Like git(1), `.git` directories are always ignored.
+ * Usage:         struct ignore_rules *rules = ignore_retain(parent);
+ *                for (size_t i = 0; i < IGNORE_FILE_COUNT; i++)
+ *                    ignore_read(&rules, directory_fd, ignore_files[i],
+ *                                prefix_length) ...
+ *                if (ignore_match(rules, path, base, is_directory)) ...
+ *                ignore_release(rules);
+ * Build with:    gcc -c ignore.c
+ */
+
+#ifndef IGNORE_H
+#define IGNORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define IGNORE_FILE_COUNT 2
+
+/**
+ * Names of the ignore files, read in this order: the rules of .ignore come
+ * last, and win over those of .gitignore.
+ */
+extern const char *const ignore_files[IGNORE_FILE_COUNT];
+
+struct ignore_rules; // rules of a directory and its ancestors
+
+/**
+ * Adds the rules of an ignore file to the rules of a directory.
+ * @param rules Rules the directory is under, a reference the caller holds,
+ *              NULL for none. Replaced by the directory's own rules, which
+ *              take over that reference, when the file has rules.
+ * @param directory_fd Open directory holding the file
+ * @param name Name of the file, see ignore_files
+ * @param prefix_length Length of the directory's path, slash included, in
+ *                      the paths later given to ignore_match()
+ * @returns 0 on success, also if the file doesn't exist or can't be read,
+ *          -1 with errno set on error
+ */
+int ignore_read(struct ignore_rules **rules, int directory_fd,
+                const char *name, size_t prefix_length);
+
+/**
+ * Tells if an entry is ignored. Only reads the rules.
+ * @param path Path of the entry, in the same form as the directory paths
+ *             the rules were read for
+ * @param base Offset of the entry's name in path
+ * @param directory The entry is a directory
+ */
+bool ignore_match(const struct ignore_rules *rules, const char *path,
+                  int base, bool directory);
+
+/**
+ * Takes a reference to rules, NULL included.
+ * @returns rules
+ */
+struct ignore_rules *ignore_retain(struct ignore_rules *rules);
+
+/**
+ * Drops a reference to rules, NULL included, freeing those no longer used.
+ */
+void ignore_release(struct ignore_rules *rules);
+
+#endif
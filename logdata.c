@@ -13,7 +13,10 @@
  *                -f <file> to specify a path to log file other then _PATH_WTMP
  *                List usernames of users to query the total login time for.
  *                Omit to query only the current user.
- * Build with:    gcc -o logdata logdata.c
+ *                The current user is named by their UID, resolved through
+ *                the idcache file named by $IDCACHE (see idcache.h), and
+ *                by LOGNAME if the UID has no passwd entry.
+ * Build with:    gcc -o logdata logdata.c idcache.c outbuf.c
  */
 
 #define USAGE \
@@ -27,6 +30,11 @@ Omit to query only the current user.\n"
 
 #define _XOPEN_SOURCE
 #define _GNU_SOURCE
+#include "idcache.h"
+#include "multicall.h"
+#include "outbuf.h"
+#include "probes.h"
+
 #include <errno.h>
 #include <paths.h>
 #include <stdbool.h>
@@ -54,7 +62,7 @@ struct user
     struct line *lines;
 };
 
-int main(int argc, char *argv[])
+int MAIN(logdata)(int argc, char *argv[])
 {
     // ---------------------- command option parsing -------------------------
 
@@ -190,15 +198,42 @@ int main(int argc, char *argv[])
             new_user->lines = NULL;
             new_user->total_time = 0;
 
-            const char *username = getenv("LOGNAME");
+            const char *username = NULL;
+            struct idcache cache;
+            char error[IDCACHE_ERROR_LENGTH];
+
+            if (idcache_open(&cache, getenv("IDCACHE"), IDCACHE_DEFAULT_TTL,
+                             error, sizeof(error)) == -1)
+            { // still usable without a cache file
+                fprintf(stderr, "idcache: %s\n", error);
+                if (idcache_open(&cache, NULL, IDCACHE_DEFAULT_TTL, error,
+                                 sizeof(error)) == -1)
+                {
+                    fprintf(stderr, "idcache: %s\n", error);
+                    exit(EXIT_FAILURE);
+                }
+            }
+
+            const struct identity *identity = idcache_lookup(&cache, getuid());
+            if (identity != NULL && identity->found)
+                username = identity->name;
+            else
+                username = getenv("LOGNAME");
+
             if (username == NULL)
             {
                 fprintf(stderr, "getenv(): error getting username\n");
                 exit(EXIT_FAILURE);
             }
 
-            new_user->username = calloc(sizeof(char), strlen(username));
-            strncpy(new_user->username, username, strlen(username));
+            new_user->username = strdup(username);
+            if (new_user->username == NULL)
+            {
+                fprintf(stderr, "strdup(): error allocating memory\n");
+                exit(EXIT_FAILURE);
+            }
+
+            idcache_close(&cache);
 
             // insert user
 
@@ -221,6 +256,9 @@ int main(int argc, char *argv[])
 
     while (utmp_entry != NULL)
     {
+        PROBE2(logdata, record, utmp_entry->ut_type,
+               utmp_entry->ut_tv.tv_sec);
+
         // shutdowns:  line is ~ and username is shutdown
 
         // case: shutdown or reboot
@@ -239,6 +277,9 @@ int main(int argc, char *argv[])
                     // update total time
                     current_user->total_time +=
                         utmp_entry->ut_tv.tv_sec - current_line->start;
+                    PROBE3(logdata, session, current_user->username,
+                           current_line->name,
+                           utmp_entry->ut_tv.tv_sec - current_line->start);
 
                     // delete line
                     free(current_line->name);
@@ -376,6 +417,9 @@ int main(int argc, char *argv[])
 
                     target_user->total_time +=
                         utmp_entry->ut_tv.tv_sec - target_line->start;
+                    PROBE3(logdata, session, target_user->username,
+                           target_line->name,
+                           utmp_entry->ut_tv.tv_sec - target_line->start);
 
                     // delete line
 
@@ -430,7 +474,10 @@ int main(int argc, char *argv[])
 
     // ----------------------- formatting & printing -------------------------
 
-    int sum = 0;
+    time_t sum = 0;
+
+    struct outbuf output;
+    outbuf_init(&output, STDOUT_FILENO);
 
     current_user = user_list;
 
@@ -441,36 +488,11 @@ int main(int argc, char *argv[])
             sum += current_user->total_time;
         }
 
-        // calculate day, hour, minute, second
-        int seconds = current_user->total_time;
-        int minutes = (seconds / 60) % 60;
-        int hours = (seconds / 3600) % 24;
-        int days = seconds / 86400;
-
-        seconds -= 60 * minutes + 3600 * hours + 86400 * days;
-
-        // print
-        printf("%-32s ", current_user->username);
-
-        if (days != 0)
-        {
-            printf("%5d day%c  ", days, (days == 1) ? ' ' : 's');
-        }
-
-        if (hours != 0)
-        {
-            printf("%5d hour%c ", hours, (hours == 1) ? ' ' : 's');
-        }
-
-        if (minutes != 0)
-        {
-            printf("%5d min%c  ", minutes, (minutes == 1) ? ' ' : 's');
-        }
-
-        if (seconds != 0 || (days == 0 && hours == 0 && minutes == 0))
-        {
-            printf("%5d sec%c\n", seconds, (seconds == 1) ? ' ' : 's');
-        }
+        // print: username, then days, hours, minutes, seconds
+        outbuf_padded(&output, current_user->username, 32);
+        outbuf_char(&output, ' ');
+        outbuf_duration(&output, current_user->total_time);
+        outbuf_char(&output, '\n');
 
         // free and walk
         user_list = current_user->next;
@@ -482,34 +504,16 @@ int main(int argc, char *argv[])
 
     if (sum_totals)
     { // -s flag
-        int seconds = sum;
-        int minutes = (seconds / 60) % 60;
-        int hours = (seconds / 3600) % 24;
-        int days = seconds / 86400;
-
-        seconds -= 60 * minutes + 3600 * hours + 86400 * days;
-
-        printf("%-32s ", "TOTAL:");
-
-        if (days != 0)
-        {
-            printf("%5d day%c  ", days, (days == 1) ? ' ' : 's');
-        }
-
-        if (hours != 0)
-        {
-            printf("%5d hour%c ", hours, (hours == 1) ? ' ' : 's');
-        }
-
-        if (minutes != 0)
-        {
-            printf("%5d min%c  ", minutes, (minutes == 1) ? ' ' : 's');
-        }
+        outbuf_padded(&output, "TOTAL:", 32);
+        outbuf_char(&output, ' ');
+        outbuf_duration(&output, sum);
+        outbuf_char(&output, '\n');
+    }
 
-        if (seconds != 0 || (days == 0 && hours == 0 && minutes == 0))
-        {
-            printf("%5d sec%c\n", seconds, (seconds == 1) ? ' ' : 's');
-        }
+    if (-1 == outbuf_close(&output))
+    {
+        perror("write()");
+        exit(EXIT_FAILURE);
     }
 
     return 0;
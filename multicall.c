@@ -0,0 +1,753 @@
+/**
+ * Title:         multicall.c
+ * Description:   All five tools in one binary, picked by the name it's run as
+ * Purpose:       Scripts that run the tools thousands of times a minute pay
+ *                for exec and the dynamic loader every time.
+ *                This binary bundles basics, datelist, logdata, sfind and
+ *                autoscroll (busybox style): run through a symlink named
+ *                after a tool, or as `multicall <tool>`, it calls that tool's
+ *                entry point. It can be linked statically.
+ *                With -S it serves tool runs instead: the server loads the
+ *                time zone once, then forks a child per request,
+ *                which receives the client's stdin, stdout, stderr and
+ *                working directory as file descriptors (SCM_RIGHTS) along
+ *                with its arguments and environment, and runs the tool in
+ *                the already warm process. The server reports each child's
+ *                exit status back to its client. SIGINT, SIGTERM and SIGHUP
+ *                of the client are sent on to the run's process group, and
+ *                a client that goes away hangs it up with SIGHUP.
+ *                When MULTICALL_SOCKET names a server's socket, the tools
+ *                forward their run to it, and run locally if it can't be
+ *                reached. Only clients of the server's own user are served.
+ *                autoscroll always runs locally, as it is driven by signals
+ *                from the terminal.
+ * Usage:         $ multicall <tool> [args ...]
+ *                $ <tool> [args ...]     through a symlink to multicall
+ *                $ multicall -l          to list the tools
+ *                $ multicall -S <socket> to serve tool runs
+ *                $ MULTICALL_SOCKET=<socket> <tool> [args ...]
+ * Build with:    gcc -DMULTICALL -o multicall multicall.c autoscroll.c
+ *                basics.c datelist.c logdata.c sfind.c idcache.c outbuf.c
+ *                schedule.c -lm -pthread
+ *                (add -static to link statically; NSS lookups of basics and
+ *                logdata then need the glibc version they were built with)
+ */
+
+#define USAGE \
+    "Usage:\n\
+$ %s <tool> [args ...]\n\
+$ <tool> [args ...] through a symlink named after the tool\n\
+-l to list the tools\n\
+-S <socket> to serve tool runs on a socket\n\
+MULTICALL_SOCKET=<socket> makes the tools run through that server\n"
+
+#define _GNU_SOURCE
+#include "multicall.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_RUNNING 256       // tool runs in progress at once
+#define MAX_REQUEST (4 << 20) // bytes of arguments and environment
+#define REQUEST_FDS 4         // stdin, stdout, stderr, cwd
+
+extern char **environ;
+
+/**
+ * A tool bundled in the binary.
+ */
+struct tool
+{
+    const char *name;
+    int (*main)(int argc, char *argv[]);
+    bool served; // can run in the server, see -S
+};
+
+static const struct tool tools[] = {
+    {"autoscroll", autoscroll_main, false},
+    {"basics", basics_main, true},
+    {"datelist", datelist_main, true},
+    {"logdata", logdata_main, true},
+    {"sfind", sfind_main, true},
+};
+
+#define TOOL_COUNT (sizeof(tools) / sizeof(tools[0]))
+
+/**
+ * Request header, sent with the client's descriptors attached. The
+ * arguments and then the environment follow, as null terminated strings.
+ */
+struct request
+{
+    uint32_t length; // bytes of strings that follow
+    uint32_t argc;   // how many of them are arguments
+};
+
+/**
+ * Finds a tool by the last component of a path.
+ * @returns the tool, NULL if there's none by that name
+ */
+static const struct tool *find_tool(const char *path)
+{
+    const char *name = strrchr(path, '/');
+    name = (name == NULL) ? path : name + 1;
+
+    for (size_t i = 0; i < TOOL_COUNT; i++)
+    {
+        if (0 == strcmp(tools[i].name, name))
+            return &tools[i];
+    }
+    return NULL;
+}
+
+/**
+ * Reads exactly length bytes.
+ * @returns 0 on success, -1 on error or end of file
+ */
+static int read_all(int fd, void *buffer, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t got = read(fd, buffer, length);
+        if (got == -1 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return -1;
+        buffer = (char *)buffer + got;
+        length -= got;
+    }
+    return 0;
+}
+
+/**
+ * Writes exactly length bytes.
+ * @returns 0 on success, -1 on error
+ */
+static int write_all(int fd, const void *buffer, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t written = write(fd, buffer, length);
+        if (written == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buffer = (const char *)buffer + written;
+        length -= written;
+    }
+    return 0;
+}
+
+/**
+ * Connects to a server's socket.
+ * @returns the connection, -1 if the server can't be reached
+ */
+static int connect_server(const char *path)
+{
+    struct sockaddr_un address = {0};
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path))
+        return -1;
+    strcpy(address.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return -1;
+
+    if (-1 == connect(fd, (struct sockaddr *)&address, sizeof(address)))
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// -------------------------------- client ----------------------------------
+
+static const int forwarded_signals[] = {SIGINT, SIGTERM, SIGHUP};
+
+#define FORWARDED_COUNT (sizeof(forwarded_signals) / sizeof(int))
+
+static volatile sig_atomic_t forward_pending = 0; // signal to send on
+
+static void handle_forward(int signal_number)
+{
+    forward_pending = signal_number;
+}
+
+/**
+ * Waits for the exit status of a run, sending SIGINT, SIGTERM and SIGHUP on
+ * to it as they arrive, one byte each. Signals the client ignores stay
+ * ignored.
+ * @param forwarded Set to the last signal sent on, left alone if none was
+ * @returns 0 on success, -1 if the server hung up
+ */
+static int wait_remote(int server, int32_t *status, int *forwarded)
+{
+    // signals are only taken while waiting in ppoll()
+    sigset_t blocked, waiting;
+    sigemptyset(&blocked);
+    for (size_t i = 0; i < FORWARDED_COUNT; i++)
+        sigaddset(&blocked, forwarded_signals[i]);
+    sigprocmask(SIG_BLOCK, &blocked, &waiting);
+
+    struct sigaction action = {0};
+    action.sa_handler = handle_forward;
+    sigemptyset(&action.sa_mask);
+    struct sigaction old_actions[FORWARDED_COUNT];
+    for (size_t i = 0; i < FORWARDED_COUNT; i++)
+    {
+        sigaction(forwarded_signals[i], NULL, &old_actions[i]);
+        if (old_actions[i].sa_handler != SIG_IGN)
+            sigaction(forwarded_signals[i], &action, NULL);
+    }
+
+    int result = 0;
+    size_t got = 0;
+    while (got < sizeof(*status))
+    {
+        struct pollfd fds = {server, POLLIN, 0};
+        if (-1 == ppoll(&fds, 1, NULL, &waiting) && errno != EINTR)
+        {
+            result = -1;
+            break;
+        }
+
+        if (forward_pending != 0)
+        { // a server that hung up is noticed by the read below
+            const unsigned char number = forward_pending;
+            *forwarded = forward_pending;
+            forward_pending = 0;
+            write_all(server, &number, 1);
+        }
+
+        if (fds.revents == 0)
+            continue;
+
+        ssize_t count = read(server, (char *)status + got,
+                             sizeof(*status) - got);
+        if (count == -1 && errno == EINTR)
+            continue;
+        if (count <= 0)
+        {
+            result = -1;
+            break;
+        }
+        got += count;
+    }
+
+    for (size_t i = 0; i < FORWARDED_COUNT; i++)
+        sigaction(forwarded_signals[i], &old_actions[i], NULL);
+    sigprocmask(SIG_SETMASK, &waiting, NULL);
+    return result;
+}
+
+/**
+ * Runs a tool through a server.
+ * @returns the tool's exit status, -1 if the server can't be reached and
+ *          nothing was sent, so the tool can still run locally
+ */
+static int run_remote(const char *path, int argc, char *argv[])
+{
+    int cwd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (cwd == -1)
+        return -1;
+
+    int server = connect_server(path);
+    if (server == -1)
+    {
+        close(cwd);
+        return -1;
+    }
+
+    // arguments, then environment
+
+    size_t length = 0;
+    for (int i = 0; i < argc; i++)
+        length += strlen(argv[i]) + 1;
+    for (char **variable = environ; *variable != NULL; variable++)
+        length += strlen(*variable) + 1;
+
+    if (length > MAX_REQUEST)
+    {
+        close(server);
+        close(cwd);
+        return -1;
+    }
+
+    char *strings = malloc(length);
+    if (strings == NULL)
+    {
+        fprintf(stderr, "malloc(): failed to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    char *end = strings;
+    for (int i = 0; i < argc; i++)
+        end = stpcpy(end, argv[i]) + 1;
+    for (char **variable = environ; *variable != NULL; variable++)
+        end = stpcpy(end, *variable) + 1;
+
+    // header with the descriptors attached
+
+    struct request request = {length, argc};
+    struct iovec iov = {&request, sizeof(request)};
+    int fds[REQUEST_FDS] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO, cwd};
+
+    union
+    { // aligned for struct cmsghdr
+        char buffer[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } control;
+
+    struct msghdr message = {0};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+
+    struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(header), fds, sizeof(fds));
+
+    signal(SIGPIPE, SIG_IGN); // a dead server is reported by sendmsg()
+
+    ssize_t sent;
+    while (-1 == (sent = sendmsg(server, &message, 0)) && errno == EINTR)
+        ;
+    close(cwd);
+
+    if (sent != sizeof(request))
+    { // nothing reached the server
+        free(strings);
+        close(server);
+        return -1;
+    }
+
+    int32_t status;
+    int forwarded = 0;
+    if (-1 == write_all(server, strings, length) ||
+        -1 == wait_remote(server, &status, &forwarded))
+    {
+        fprintf(stderr, "%s: server hung up\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    free(strings);
+    close(server);
+
+    if (forwarded != 0 && status == 128 + forwarded)
+    { // the run died of the signal sent on, so does the client
+        signal(forwarded, SIG_DFL);
+        raise(forwarded);
+    }
+    return status;
+}
+
+// -------------------------------- server ----------------------------------
+
+static volatile sig_atomic_t stop_requested = 0; // set by SIGINT/SIGTERM
+static volatile sig_atomic_t child_exited = 0;   // set by SIGCHLD
+
+static void handle_signal(int signal_number)
+{
+    if (signal_number == SIGCHLD)
+        child_exited = 1;
+    else
+        stop_requested = 1;
+}
+
+/**
+ * In a forked child: receives a request from a client and runs the tool on
+ * the client's descriptors. Never returns.
+ * @param request_read Closed once the request is read, which tells the
+ *                     server the connection is its own from then on
+ */
+static void run_request(int connection, int request_read)
+{
+    // header and descriptors
+
+    struct request request;
+    struct iovec iov = {&request, sizeof(request)};
+    union
+    {
+        char buffer[CMSG_SPACE(sizeof(int) * REQUEST_FDS)];
+        struct cmsghdr align;
+    } control;
+
+    struct msghdr message = {0};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+
+    ssize_t got;
+    while (-1 == (got = recvmsg(connection, &message, MSG_CMSG_CLOEXEC)) &&
+           errno == EINTR)
+        ;
+
+    struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+    if (got != sizeof(request) || header == NULL ||
+        header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS ||
+        header->cmsg_len != CMSG_LEN(sizeof(int) * REQUEST_FDS) ||
+        (message.msg_flags & MSG_CTRUNC) || request.argc == 0 ||
+        request.length > MAX_REQUEST)
+        _exit(EXIT_FAILURE);
+
+    int fds[REQUEST_FDS];
+    memcpy(fds, CMSG_DATA(header), sizeof(fds));
+
+    // arguments and environment
+
+    char *strings = malloc(request.length + 1);
+    if (strings == NULL || -1 == read_all(connection, strings, request.length))
+        _exit(EXIT_FAILURE);
+    strings[request.length] = '\0'; // in case the last one isn't terminated
+    close(connection);
+    close(request_read);
+
+    size_t count = 0;
+    for (size_t i = 0; i < request.length; i++)
+        count += strings[i] == '\0';
+    if (count < request.argc)
+        _exit(EXIT_FAILURE);
+
+    char **pointers = malloc(sizeof(char *) * (count + 2));
+    if (pointers == NULL)
+        _exit(EXIT_FAILURE);
+
+    char *next = strings;
+    for (size_t i = 0; i < count; i++)
+    {
+        pointers[i + (i >= request.argc)] = next;
+        next += strlen(next) + 1;
+    }
+    pointers[request.argc] = NULL;
+    pointers[count + 1] = NULL;
+
+    int argc = request.argc;
+    char **argv = pointers;
+    environ = pointers + argc + 1;
+
+    // the client's descriptors and directory
+
+    for (int i = 0; i < 3; i++)
+    {
+        if (-1 == dup2(fds[i], i))
+            _exit(EXIT_FAILURE);
+        if (fds[i] > 2)
+            close(fds[i]);
+    }
+    if (-1 == fchdir(fds[REQUEST_FDS - 1]))
+    {
+        perror("fchdir()");
+        exit(EXIT_FAILURE);
+    }
+    close(fds[REQUEST_FDS - 1]);
+
+    const struct tool *tool = find_tool(argv[0]);
+    if (tool == NULL || !tool->served)
+    {
+        fprintf(stderr, "%s: not served\n", argv[0]);
+        exit(127);
+    }
+
+    tzset(); // TZ might differ from the server's
+    optind = 0; // fully resets getopt(), which the server used with "+"
+    exit(tool->main(argc, argv));
+}
+
+/**
+ * Serves tool runs on a socket until SIGINT or SIGTERM, then waits for the
+ * runs in progress.
+ */
+static void serve(const char *path)
+{
+    // setup
+
+    struct sockaddr_un address = {0};
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "Socket path is too long: %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    strcpy(address.sun_path, path);
+
+    struct stat stat_result;
+    if (0 == lstat(path, &stat_result) && S_ISSOCK(stat_result.st_mode))
+    { // left over from a previous run
+        unlink(path);
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (-1 == listener)
+    {
+        perror("socket()");
+        exit(EXIT_FAILURE);
+    }
+
+    mode_t old_mask = umask(0077); // only the server's user may connect
+    if (-1 == bind(listener, (struct sockaddr *)&address, sizeof(address)))
+    {
+        perror("bind()");
+        exit(EXIT_FAILURE);
+    }
+    umask(old_mask);
+
+    if (-1 == listen(listener, SOMAXCONN))
+    {
+        perror("listen()");
+        exit(EXIT_FAILURE);
+    }
+
+    // what the tools would otherwise each load at startup; the locale is
+    // left to them, as only datelist sets one (LC_TIME)
+    tzset();
+
+    // signals are only taken while waiting in ppoll()
+    sigset_t blocked, waiting;
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGCHLD);
+    sigaddset(&blocked, SIGINT);
+    sigaddset(&blocked, SIGTERM);
+    sigprocmask(SIG_BLOCK, &blocked, &waiting);
+
+    struct sigaction action = {0};
+    action.sa_handler = handle_signal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGCHLD, &action, NULL);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN); // clients hanging up are reported by write()
+
+    struct
+    {
+        pid_t pid;        // 0 if the slot is free, also the process group
+        int connection;   // where the exit status goes, and signals come from
+        int request_read; // hangs up once the child read the request, -1 then
+        bool hung_up;     // the client went away
+    } runs[MAX_RUNNING] = {{0, 0, 0, false}};
+    int running = 0;
+
+    // serve
+
+    while (!stop_requested || running > 0)
+    {
+        // the listener, then what each run waits on: the connection is only
+        // read once the child is done reading its request from it
+        struct pollfd fds[1 + MAX_RUNNING];
+        bool accepting = !stop_requested && running < MAX_RUNNING;
+        fds[0] = (struct pollfd){accepting ? listener : -1, POLLIN, 0};
+        for (int i = 0; i < MAX_RUNNING; i++)
+        {
+            int fd = -1;
+            if (runs[i].pid != 0 && runs[i].request_read != -1)
+                fd = runs[i].request_read;
+            else if (runs[i].pid != 0 && !runs[i].hung_up)
+                fd = runs[i].connection;
+            fds[1 + i] = (struct pollfd){fd, POLLIN, 0};
+        }
+
+        if (-1 == ppoll(fds, 1 + MAX_RUNNING, NULL, &waiting) &&
+            errno != EINTR)
+        {
+            perror("ppoll()");
+            exit(EXIT_FAILURE);
+        }
+
+        for (int i = 0; i < MAX_RUNNING; i++)
+        {
+            if (runs[i].pid == 0 || fds[1 + i].revents == 0)
+                continue;
+
+            if (runs[i].request_read != -1)
+            { // the child closed its end, or exited
+                close(runs[i].request_read);
+                runs[i].request_read = -1;
+                continue;
+            }
+
+            // signals sent on by the client, one byte each
+            unsigned char numbers[16];
+            ssize_t count = read(runs[i].connection, numbers, sizeof(numbers));
+            for (ssize_t j = 0; j < count; j++)
+            {
+                for (size_t k = 0; k < FORWARDED_COUNT; k++)
+                {
+                    if (numbers[j] == forwarded_signals[k])
+                        kill(-runs[i].pid, numbers[j]);
+                }
+            }
+            if (count == 0 || (count == -1 && errno != EINTR))
+            { // the client is gone, as if its terminal was
+                kill(-runs[i].pid, SIGHUP);
+                runs[i].hung_up = true;
+            }
+        }
+
+        if (child_exited)
+        { // report exit statuses
+            child_exited = 0;
+
+            int status;
+            pid_t pid;
+            while (0 < (pid = waitpid(-1, &status, WNOHANG)))
+            {
+                for (int i = 0; i < MAX_RUNNING; i++)
+                {
+                    if (runs[i].pid != pid)
+                        continue;
+
+                    int32_t code = WIFEXITED(status)
+                                       ? WEXITSTATUS(status)
+                                       : 128 + WTERMSIG(status);
+                    write_all(runs[i].connection, &code, sizeof(code));
+                    close(runs[i].connection);
+                    if (runs[i].request_read != -1)
+                        close(runs[i].request_read);
+                    runs[i].pid = 0;
+                    running--;
+                    break;
+                }
+            }
+        }
+
+        if (!accepting || !(fds[0].revents & POLLIN))
+            continue;
+
+        int connection = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+        if (connection == -1)
+            continue;
+
+        struct ucred credentials;
+        socklen_t size = sizeof(credentials);
+        if (-1 == getsockopt(connection, SOL_SOCKET, SO_PEERCRED,
+                             &credentials, &size) ||
+            credentials.uid != getuid())
+        { // runs would get the server's privileges
+            close(connection);
+            continue;
+        }
+
+        int request_pipe[2];
+        if (-1 == pipe2(request_pipe, O_CLOEXEC))
+        {
+            perror("pipe2()");
+            close(connection);
+            continue;
+        }
+
+        pid_t pid = fork();
+        if (pid == -1)
+        {
+            perror("fork()");
+            close(request_pipe[0]);
+            close(request_pipe[1]);
+            close(connection);
+            continue;
+        }
+
+        if (pid == 0)
+        { // child: as if freshly started, in a process group of its own
+            setpgid(0, 0);
+            close(listener);
+            close(request_pipe[0]);
+            for (int i = 0; i < MAX_RUNNING; i++)
+            { // other clients' connections
+                if (runs[i].pid == 0)
+                    continue;
+                close(runs[i].connection);
+                if (runs[i].request_read != -1)
+                    close(runs[i].request_read);
+            }
+            signal(SIGCHLD, SIG_DFL);
+            signal(SIGINT, SIG_DFL);
+            signal(SIGTERM, SIG_DFL);
+            signal(SIGHUP, SIG_DFL);
+            signal(SIGPIPE, SIG_DFL);
+            sigprocmask(SIG_SETMASK, &waiting, NULL);
+            run_request(connection, request_pipe[1]);
+        }
+
+        setpgid(pid, pid); // either of the two calls can come first
+        close(request_pipe[1]);
+
+        int slot = 0;
+        while (runs[slot].pid != 0)
+            slot++;
+        runs[slot].pid = pid;
+        runs[slot].connection = connection;
+        runs[slot].request_read = request_pipe[0];
+        runs[slot].hung_up = false;
+        running++;
+    }
+
+    close(listener);
+    unlink(path);
+}
+
+int main(int argc, char *argv[])
+{
+    const struct tool *tool = find_tool(argv[0]);
+
+    if (tool == NULL)
+    { // run as multicall itself
+        opterr = 0;
+        int option = getopt(argc, argv, "+:lS:");
+
+        switch (option)
+        {
+        case 'l':
+            for (size_t i = 0; i < TOOL_COUNT; i++)
+                printf("%s\n", tools[i].name);
+            return 0;
+        case 'S':
+            serve(optarg);
+            return 0;
+        case -1:
+            break;
+        default:
+            fprintf(stderr, "Unknown option: %c\n" USAGE, optopt, argv[0]);
+            exit(EXIT_FAILURE);
+        }
+
+        if (optind >= argc || NULL == (tool = find_tool(argv[optind])))
+        {
+            fprintf(stderr, "Unknown tool\n" USAGE, argv[0]);
+            exit(EXIT_FAILURE);
+        }
+
+        // the tool sees its own name as argv[0]
+        argc -= optind;
+        argv += optind;
+        optind = 0; // fully resets getopt(), used above with "+"
+    }
+
+    const char *server = getenv("MULTICALL_SOCKET");
+    if (server != NULL && tool->served)
+    {
+        int status = run_remote(server, argc, argv);
+        if (status != -1)
+            return status;
+    }
+
+    return tool->main(argc, argv);
+}
@@ -0,0 +1,25 @@
+/**
+ * Title:         multicall.h
+ * Description:   Entry points of the tools inside the multi-call binary
+ * Purpose:       Each tool defines its entry point as MAIN(<tool>), which is
+ *                main() when built on its own and <tool>_main() when built
+ *                with -DMULTICALL into the multi-call binary (multicall.c).
+ * Build with:    included by every tool
+ */
+
+#ifndef MULTICALL_H
+#define MULTICALL_H
+
+#ifdef MULTICALL
+#define MAIN(tool) tool##_main
+#else
+#define MAIN(tool) main
+#endif
+
+int autoscroll_main(int argc, char *argv[]);
+int basics_main(int argc, char *argv[]);
+int datelist_main(int argc, char *argv[]);
+int logdata_main(int argc, char *argv[]);
+int sfind_main(int argc, char *argv[]);
+
+#endif
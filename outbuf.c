@@ -0,0 +1,339 @@
+/**
+ * Title:         outbuf.c
+ * Description:   Buffered output and printf-free number formatting
+ * Purpose:       See outbuf.h.
+ * Build with:    gcc -c outbuf.c
+ */
+
+#define _XOPEN_SOURCE 700
+#include "outbuf.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// ------------------------------- formatting -------------------------------
+
+size_t format_unsigned(uint64_t value, char *buffer)
+{
+    char digits[20];
+    size_t count = 0;
+
+    do
+    {
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
+
+    for (size_t i = 0; i < count; i++)
+        buffer[i] = digits[count - 1 - i];
+
+    return count;
+}
+
+size_t format_integer(int64_t value, char *buffer)
+{
+    if (value >= 0)
+        return format_unsigned(value, buffer);
+
+    buffer[0] = '-';
+    return 1 + format_unsigned(-(uint64_t)value, buffer + 1);
+}
+
+/**
+ * Writes a number right aligned in 5 columns, then a space and a unit, an
+ * `s` if plural, and spaces up to the unit's column width.
+ * @returns number of bytes written
+ */
+static size_t format_duration_unit(int64_t value, const char *unit,
+                                   size_t unit_width, char *buffer)
+{
+    char digits[FORMAT_INTEGER_LENGTH];
+    const size_t digit_count = format_integer(value, digits);
+    size_t length = 0;
+
+    for (size_t i = digit_count; i < 5; i++)
+        buffer[length++] = ' ';
+    memcpy(buffer + length, digits, digit_count);
+    length += digit_count;
+
+    buffer[length++] = ' ';
+    const size_t unit_length = strlen(unit);
+    memcpy(buffer + length, unit, unit_length);
+    length += unit_length;
+    buffer[length++] = (value == 1) ? ' ' : 's';
+
+    for (size_t i = unit_length + 1; i < unit_width; i++)
+        buffer[length++] = ' ';
+
+    return length;
+}
+
+size_t format_duration(int64_t seconds, char *buffer)
+{
+    const int64_t days = seconds / 86400;
+    const int64_t hours = seconds / 3600 % 24;
+    const int64_t minutes = seconds / 60 % 60;
+    seconds %= 60;
+
+    size_t length = 0;
+
+    if (days != 0)
+        length += format_duration_unit(days, "day", 6, buffer + length);
+    if (hours != 0)
+        length += format_duration_unit(hours, "hour", 6, buffer + length);
+    if (minutes != 0)
+        length += format_duration_unit(minutes, "min", 6, buffer + length);
+    if (seconds != 0 || (days == 0 && hours == 0 && minutes == 0))
+        length += format_duration_unit(seconds, "sec", 0, buffer + length);
+
+    return length;
+}
+
+// --------------------------------- output ---------------------------------
+
+/**
+ * Writes iovecs in full, resuming after partial writes.
+ * @returns 0 on success, -1 with errno set on error
+ */
+static int writev_all(int fd, struct iovec *iov, int count)
+{
+    while (count > 0)
+    {
+        ssize_t written = writev(fd, iov, count);
+        if (written == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        while (count > 0 && (size_t)written >= iov->iov_len)
+        {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Makes room for length more bytes, growing the buffer of a memory outbuf.
+ * @returns false if the data can't be buffered
+ */
+static bool reserve(struct outbuf *output, size_t length)
+{
+    if (output->length + length <= output->size)
+        return true;
+
+    size_t size = output->size;
+    if (output->fd != -1)
+    {
+        if (size != 0)
+            return false; // a descriptor's buffer never grows
+        size = OUTBUF_SIZE;
+    }
+    else
+    {
+        if (size == 0)
+            size = 4096;
+        while (output->length + length > size)
+            size *= 2;
+    }
+
+    char *data = realloc(output->data, size);
+    if (data == NULL)
+    {
+        output->error = errno;
+        return false;
+    }
+    output->data = data;
+    output->size = size;
+
+    return output->length + length <= size;
+}
+
+void outbuf_init(struct outbuf *output, int fd)
+{
+    output->fd = fd;
+    output->data = NULL;
+    output->length = 0;
+    output->size = 0;
+    output->error = 0;
+}
+
+void outbuf_write(struct outbuf *output, const void *data, size_t length)
+{
+    if (output->error != 0)
+        return;
+
+    if (reserve(output, length))
+    {
+        memcpy(output->data + output->length, data, length);
+        output->length += length;
+        return;
+    }
+
+    if (output->error != 0 || output->fd == -1)
+        return;
+
+    if (length < output->size / 2)
+    { // small: start a new buffer
+        if (outbuf_flush(output) == -1)
+            return;
+        memcpy(output->data, data, length);
+        output->length = length;
+        return;
+    }
+
+    // large: buffered bytes and data in one system call, without copying
+    struct iovec iov[2] = {
+        {output->data, output->length},
+        {(void *)data, length},
+    };
+    if (writev_all(output->fd, iov, 2) == -1)
+        output->error = errno;
+    output->length = 0;
+}
+
+void outbuf_string(struct outbuf *output, const char *text)
+{
+    outbuf_write(output, text, strlen(text));
+}
+
+void outbuf_char(struct outbuf *output, char c)
+{
+    if (output->length < output->size && output->error == 0)
+        output->data[output->length++] = c;
+    else
+        outbuf_write(output, &c, 1);
+}
+
+void outbuf_padded(struct outbuf *output, const char *text, int width)
+{
+    const size_t length = strlen(text);
+    outbuf_write(output, text, length);
+
+    for (int i = length; i < width; i++)
+        outbuf_char(output, ' ');
+}
+
+/**
+ * Appends formatted digits right aligned to width.
+ */
+static void outbuf_aligned(struct outbuf *output, const char *digits,
+                           size_t length, int width)
+{
+    for (int i = length; i < width; i++)
+        outbuf_char(output, ' ');
+    outbuf_write(output, digits, length);
+}
+
+void outbuf_unsigned(struct outbuf *output, uint64_t value, int width)
+{
+    char digits[FORMAT_INTEGER_LENGTH];
+    outbuf_aligned(output, digits, format_unsigned(value, digits), width);
+}
+
+void outbuf_integer(struct outbuf *output, int64_t value, int width)
+{
+    char digits[FORMAT_INTEGER_LENGTH];
+    outbuf_aligned(output, digits, format_integer(value, digits), width);
+}
+
+void outbuf_hex(struct outbuf *output, uint64_t value, int digits)
+{
+    char hex[16];
+    for (int i = digits - 1; i >= 0; i--)
+    {
+        hex[i] = "0123456789abcdef"[value & 0xf];
+        value >>= 4;
+    }
+    outbuf_write(output, hex, digits);
+}
+
+void outbuf_duration(struct outbuf *output, int64_t seconds)
+{
+    char buffer[FORMAT_DURATION_LENGTH];
+    outbuf_write(output, buffer, format_duration(seconds, buffer));
+}
+
+void outbuf_printf(struct outbuf *output, const char *format, ...)
+{
+    char buffer[256];
+    va_list arguments;
+
+    va_start(arguments, format);
+    int length = vsnprintf(buffer, sizeof(buffer), format, arguments);
+    va_end(arguments);
+
+    if (length < 0)
+    {
+        output->error = errno;
+        return;
+    }
+
+    if ((size_t)length < sizeof(buffer))
+    {
+        outbuf_write(output, buffer, length);
+        return;
+    }
+
+    // too long for the stack buffer
+    char *text = malloc(length + 1);
+    if (text == NULL)
+    {
+        output->error = errno;
+        return;
+    }
+
+    va_start(arguments, format);
+    vsnprintf(text, length + 1, format, arguments);
+    va_end(arguments);
+
+    outbuf_write(output, text, length);
+    free(text);
+}
+
+int outbuf_flush(struct outbuf *output)
+{
+    if (output->error == 0 && output->fd != -1 && output->length > 0)
+    {
+        struct iovec iov = {output->data, output->length};
+        if (writev_all(output->fd, &iov, 1) == -1)
+            output->error = errno;
+        output->length = 0;
+    }
+
+    if (output->error != 0)
+    {
+        errno = output->error;
+        return -1;
+    }
+    return 0;
+}
+
+int outbuf_close(struct outbuf *output)
+{
+    const int result = outbuf_flush(output);
+    const int saved_errno = errno;
+
+    free(output->data);
+    output->data = NULL;
+    output->size = 0;
+    output->length = 0;
+
+    errno = saved_errno;
+    return result;
+}
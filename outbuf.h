@@ -0,0 +1,125 @@
+/**
+ * Title:         outbuf.h
+ * Description:   Buffered output and printf-free number formatting
+ * Purpose:       Shared by the tools for their high-volume output. An outbuf
+ *                collects output in a large buffer and hands it to write(2)
+ *                when full; output bigger than the room left goes out with
+ *                the buffered bytes in one writev(2) instead of being copied.
+ *                Appending never fails: the first error is kept, later
+ *                output is dropped, and outbuf_flush() reports it, so
+ *                callers check once instead of after every call.
+ *                An outbuf without a descriptor grows instead, to build a
+ *                record in memory before it is written.
+ *                The format_*() functions write digits straight into a
+ *                buffer, without parsing a format string.
+ * Usage:         struct outbuf output;
+ *                outbuf_init(&output, STDOUT_FILENO);
+ *                outbuf_padded(&output, username, 32);
+ *                outbuf_unsigned(&output, count, 5);
+ *                outbuf_char(&output, '\n');
+ *                if (outbuf_close(&output) == -1) perror("write()") ...
+ * Build with:    gcc -c outbuf.c
+ */
+
+#ifndef OUTBUF_H
+#define OUTBUF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define OUTBUF_SIZE (1 << 16) // buffer size when writing to a descriptor
+
+#define FORMAT_INTEGER_LENGTH 21   // longest format_integer() output
+#define FORMAT_DURATION_LENGTH 128 // longest format_duration() output
+
+/**
+ * Output on its way to a descriptor, or a record built in memory.
+ */
+struct outbuf
+{
+    int fd;        // descriptor written to, -1 to only collect in memory
+    char *data;    // allocated on first use
+    size_t length; // bytes in data
+    size_t size;   // allocated size of data
+    int error;     // errno of the first failure, 0 if none
+};
+
+// ------------------------------- formatting -------------------------------
+
+/**
+ * Writes the decimal digits of a number, not null terminated.
+ * @param buffer Destination, at least FORMAT_INTEGER_LENGTH bytes
+ * @returns number of bytes written
+ */
+size_t format_unsigned(uint64_t value, char *buffer);
+
+/**
+ * Writes the decimal digits of a number, with a minus sign if negative.
+ * @param buffer Destination, at least FORMAT_INTEGER_LENGTH bytes
+ * @returns number of bytes written
+ */
+size_t format_integer(int64_t value, char *buffer);
+
+/**
+ * Writes a number of seconds in days, hours, minutes and seconds, each in
+ * its own aligned column, like "    2 days      1 hour     5 secs".
+ * Units with a zero value are left out, except seconds when all are zero.
+ * @param buffer Destination, at least FORMAT_DURATION_LENGTH bytes
+ * @returns number of bytes written, not null terminated
+ */
+size_t format_duration(int64_t seconds, char *buffer);
+
+// --------------------------------- output ---------------------------------
+
+/**
+ * Sets up an empty outbuf.
+ * @param fd Descriptor to write to, -1 to only collect in memory
+ */
+void outbuf_init(struct outbuf *output, int fd);
+
+void outbuf_write(struct outbuf *output, const void *data, size_t length);
+
+void outbuf_string(struct outbuf *output, const char *text);
+
+void outbuf_char(struct outbuf *output, char c);
+
+/**
+ * Appends a string, left aligned and padded with spaces to width.
+ */
+void outbuf_padded(struct outbuf *output, const char *text, int width);
+
+/**
+ * Appends a number, right aligned and padded with spaces to width (0 for
+ * no padding).
+ */
+void outbuf_unsigned(struct outbuf *output, uint64_t value, int width);
+
+void outbuf_integer(struct outbuf *output, int64_t value, int width);
+
+/**
+ * Appends a number as exactly digits lowercase hexadecimal digits.
+ */
+void outbuf_hex(struct outbuf *output, uint64_t value, int digits);
+
+void outbuf_duration(struct outbuf *output, int64_t seconds);
+
+/**
+ * Appends printf(3)-formatted text, for what the other calls can't do.
+ */
+void outbuf_printf(struct outbuf *output, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/**
+ * Writes out everything buffered.
+ * @returns 0 on success, -1 with errno set if this or any earlier output
+ *          failed
+ */
+int outbuf_flush(struct outbuf *output);
+
+/**
+ * Flushes, then releases the buffer.
+ * @returns like outbuf_flush()
+ */
+int outbuf_close(struct outbuf *output);
+
+#endif
@@ -0,0 +1,55 @@
+/**
+ * Title:         probes.h
+ * Description:   Static tracepoints (USDT probes) for the tools' hot paths
+ * Purpose:       Marks the points worth watching on a production host, so a
+ *                slow run can be traced instead of guessed at:
+ *                  sfind:entry(path, inode)       every entry walked
+ *                  sfind:match(path)              every entry printed
+ *                  logdata:record(type, seconds)  every wtmp record read
+ *                  logdata:session(user, line, seconds)
+ *                                                 every session closed
+ *                  datelist:instant(seconds, nanoseconds)
+ *                                                 every instant printed
+ *                  autoscroll:frame(first_line, lines, bytes)
+ *                                                 every frame drawn
+ *                Built with -DWITH_USDT, each probe is a single nop plus a
+ *                note in the ELF .note.stapsdt section, through systemtap's
+ *                <sys/sdt.h> (package systemtap-sdt-dev or
+ *                systemtap-sdt-devel). A tracer attaching to the probe
+ *                swaps the nop for a breakpoint, so probes cost nothing
+ *                until traced. Without WITH_USDT they compile to nothing and
+ *                their arguments are not evaluated.
+ * Usage:         PROBE2(datelist, instant, seconds, nanoseconds);
+ *                $ make USDT=1
+ *                $ bpftrace -e 'usdt:./build/sfind:sfind:match
+ *                               { printf("%s\n", str(arg0)); }'
+ *                $ perf buildid-cache --add build/sfind
+ *                $ perf record -e sdt_sfind:entry build/sfind ...
+ * Build with:    gcc -DWITH_USDT ... to enable the probes
+ */
+
+#ifndef PROBES_H
+#define PROBES_H
+
+#ifdef WITH_USDT
+
+#if defined(__has_include) && !__has_include(<sys/sdt.h>)
+#error "WITH_USDT needs <sys/sdt.h>, from systemtap-sdt-dev(el)"
+#endif
+
+#include <sys/sdt.h>
+
+#define PROBE1(provider, name, a) DTRACE_PROBE1(provider, name, a)
+#define PROBE2(provider, name, a, b) DTRACE_PROBE2(provider, name, a, b)
+#define PROBE3(provider, name, a, b, c) \
+    DTRACE_PROBE3(provider, name, a, b, c)
+
+#else
+
+#define PROBE1(provider, name, a) ((void)0)
+#define PROBE2(provider, name, a, b) ((void)0)
+#define PROBE3(provider, name, a, b, c) ((void)0)
+
+#endif
+
+#endif
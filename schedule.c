@@ -0,0 +1,699 @@
+/**
+ * Title:         schedule.c
+ * Description:   Parses datelist schedules and generates their instants
+ * Purpose:       See schedule.h.
+ *                A schedule is made of a number, space, time unit, multiple
+ *                of these can be supplied, each space seperated. Time units
+ *                cannot repeat. It can be prefixed by `label:`.
+ *                `business day[s]` (or bday[s]) steps over weekends and the
+ *                holidays of the calendar. Holidays are kept as per-year
+ *                bitmaps and skipped 64 days at a time by popcount.
+ *                Business days are counted from the date before any other
+ *                unit of the schedule is added.
+ *                millisecond[s] (ms), microsecond[s] (us) and
+ *                nanosecond[s] (ns) are carried in a separate nanosecond
+ *                count, as struct tm stops at seconds.
+ * Build with:    gcc -c schedule.c
+ */
+
+#define _XOPEN_SOURCE 700
+#include "schedule.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// -------------------------------- calendar --------------------------------
+
+int64_t days_from_civil(int64_t year, int month, int day)
+{
+    year -= month <= 2;
+    const int64_t era = (year >= 0 ? year : year - 399) / 400;
+    const int64_t year_of_era = year - era * 400;
+    const int64_t day_of_year =
+        (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    const int64_t day_of_era = year_of_era * 365 + year_of_era / 4 -
+                               year_of_era / 100 + day_of_year;
+    return era * 146097 + day_of_era - 719468;
+}
+
+void civil_from_seconds(int64_t seconds, struct tm *result)
+{
+    int64_t days = seconds / 86400;
+    int64_t remainder = seconds % 86400;
+    if (remainder < 0)
+    {
+        remainder += 86400;
+        days--;
+    }
+
+    memset(result, 0, sizeof(struct tm));
+    result->tm_hour = remainder / 3600;
+    result->tm_min = remainder / 60 % 60;
+    result->tm_sec = remainder % 60;
+    result->tm_wday = ((days + 4) % 7 + 7) % 7; // 1970-01-01 was a Thursday
+
+    // inverse of days_from_civil()
+    const int64_t shifted = days + 719468;
+    const int64_t era = (shifted >= 0 ? shifted : shifted - 146096) / 146097;
+    const int64_t day_of_era = shifted - era * 146097;
+    const int64_t year_of_era = (day_of_era - day_of_era / 1460 +
+                                 day_of_era / 36524 - day_of_era / 146096) /
+                                365;
+    const int64_t day_of_year =
+        day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    const int64_t month_index = (5 * day_of_year + 2) / 153;
+    const int month = month_index < 10 ? month_index + 3 : month_index - 9;
+    const int64_t year = year_of_era + era * 400 + (month <= 2);
+
+    result->tm_mday = day_of_year - (153 * month_index + 2) / 5 + 1;
+    result->tm_mon = month - 1;
+    result->tm_year = year - 1900;
+    result->tm_yday = days - days_from_civil(year, 1, 1);
+}
+
+bool is_leap_year(int64_t year)
+{
+    return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
+
+int days_in_month(int64_t year, int month)
+{
+    static const int lengths[] = {31, 28, 31, 30, 31, 30,
+                                  31, 31, 30, 31, 30, 31};
+    if (month == 2 && is_leap_year(year))
+        return 29;
+    return lengths[month - 1];
+}
+
+// ----------------------------- business days ------------------------------
+
+/**
+ * Business days of one year as a bitmap, bit n standing for day-of-year n
+ * (tm_yday). Built lazily the first time the year is stepped through.
+ */
+struct business_year
+{
+    bool built;
+    uint64_t holidays[6]; // from the calendar file
+    uint64_t business[6]; // weekdays that are not holidays
+};
+
+/**
+ * Holiday calendar, covering the years [first_year, first_year + count).
+ */
+struct business_calendar
+{
+    int64_t first_year;
+    int64_t count;
+    struct business_year *years;
+};
+
+static struct business_calendar calendar = {0, 0, NULL};
+
+/**
+ * Finds a year of the calendar, growing the calendar to cover it.
+ * @returns the year, its bitmaps not necessarily built, NULL if out of
+ *          memory
+ */
+static struct business_year *calendar_year(int64_t year)
+{
+    if (calendar.count == 0 || year < calendar.first_year ||
+        year >= calendar.first_year + calendar.count)
+    {
+        int64_t first = (calendar.count == 0 || year < calendar.first_year)
+                            ? year
+                            : calendar.first_year;
+        int64_t last = (calendar.count == 0 ||
+                        year >= calendar.first_year + calendar.count)
+                           ? year
+                           : calendar.first_year + calendar.count - 1;
+        int64_t count = last - first + 1;
+
+        struct business_year *years =
+            calloc(count, sizeof(struct business_year));
+        if (NULL == years)
+            return NULL;
+
+        if (calendar.count != 0)
+            memcpy(years + (calendar.first_year - first), calendar.years,
+                   calendar.count * sizeof(struct business_year));
+
+        free(calendar.years);
+        calendar.years = years;
+        calendar.first_year = first;
+        calendar.count = count;
+    }
+
+    return &calendar.years[year - calendar.first_year];
+}
+
+int schedule_load_calendar(const char *path, char *error, size_t error_size)
+{
+    FILE *file = fopen(path, "r");
+    if (NULL == file)
+    {
+        snprintf(error, error_size, "could not open calendar file %s: %s",
+                 path, strerror(errno));
+        return -1;
+    }
+
+    char *line = NULL;
+    size_t size = 0;
+    long line_number = 0;
+    int result = 0;
+
+    while (-1 != getline(&line, &size, file))
+    {
+        line_number++;
+
+        char *text = line + strspn(line, " \t");
+        if (*text == '#' || *text == '\n' || *text == '\0')
+            continue;
+
+        int year, month, day;
+        char rest;
+        if (sscanf(text, "%d-%d-%d %c", &year, &month, &day, &rest) != 3 ||
+            month < 1 || month > 12 || day < 1 ||
+            day > days_in_month(year, month))
+        {
+            snprintf(error, error_size, "%s:%ld: expected a YYYY-MM-DD date",
+                     path, line_number);
+            result = -1;
+            break;
+        }
+
+        struct business_year *entry = calendar_year(year);
+        if (NULL == entry)
+        {
+            snprintf(error, error_size, "failed to allocate memory");
+            result = -1;
+            break;
+        }
+
+        int yday = days_from_civil(year, month, day) -
+                   days_from_civil(year, 1, 1);
+        entry->holidays[yday / 64] |= 1ULL << (yday % 64);
+        entry->built = false; // a built bitmap would miss the holiday
+        memset(entry->business, 0, sizeof(entry->business));
+    }
+
+    free(line);
+    fclose(file);
+
+    return result;
+}
+
+void schedule_free_calendar(void)
+{
+    free(calendar.years);
+    calendar.years = NULL;
+    calendar.first_year = 0;
+    calendar.count = 0;
+}
+
+/**
+ * Business day bitmap of a year, building it on first use.
+ * @returns the bitmap, NULL if out of memory
+ */
+static const uint64_t *business_bitmap(int64_t year)
+{
+    struct business_year *entry = calendar_year(year);
+    if (NULL == entry)
+        return NULL;
+
+    if (!entry->built)
+    {
+        int length = is_leap_year(year) ? 366 : 365;
+        int weekday = ((days_from_civil(year, 1, 1) + 4) % 7 + 7) % 7;
+
+        for (int yday = 0; yday < length; yday++)
+        {
+            if (weekday != 0 && weekday != 6) // not Sunday or Saturday
+                entry->business[yday / 64] |= 1ULL << (yday % 64);
+            weekday = (weekday + 1) % 7;
+        }
+
+        for (int word = 0; word < 6; word++)
+            entry->business[word] &= ~entry->holidays[word];
+
+        entry->built = true;
+    }
+
+    return entry->business;
+}
+
+/**
+ * Counts the calendar days from a date to the n-th business day after it.
+ * Whole 64-day words are skipped by their popcount, only the word holding
+ * the target day is looked at bit by bit.
+ * @param year Full year of the starting date
+ * @param yday Day of year of the starting date, 0-365
+ * @param n Number of business days to move ahead, positive
+ * @param days Receives the number of calendar days to add to the date
+ * @returns 0 on success, -1 with errno set to ENOMEM if out of memory or
+ *          EDOM if the calendar has no business days
+ */
+static int business_days_ahead(int64_t year, int yday, long n, int64_t *days)
+{
+    int64_t start = days_from_civil(year, 1, 1) + yday;
+    int position = yday + 1; // the starting date itself is not counted
+    int empty_years = 0;     // guards against calendars without workdays
+
+    while (true)
+    {
+        int length = is_leap_year(year) ? 366 : 365;
+
+        if (position >= length)
+        { // on to the next year
+            year++;
+            position = 0;
+            continue;
+        }
+
+        const uint64_t *bitmap = business_bitmap(year);
+        if (NULL == bitmap)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+
+        bool any = false;
+
+        for (int word = position / 64; word < 6; word++)
+        {
+            uint64_t bits = bitmap[word];
+            if (word == position / 64)
+                bits &= ~0ULL << (position % 64);
+
+            long available = __builtin_popcountll(bits);
+            any = any || available != 0;
+
+            if (available < n)
+            {
+                n -= available;
+                continue;
+            }
+
+            // target is in this word: drop the n-1 lowest set bits
+            while (--n > 0)
+                bits &= bits - 1;
+
+            int target = word * 64 + __builtin_ctzll(bits);
+            *days = days_from_civil(year, 1, 1) + target - start;
+            return 0;
+        }
+
+        empty_years = any ? 0 : empty_years + 1;
+        if (empty_years > 10)
+        { // the calendar has no business days
+            errno = EDOM;
+            return -1;
+        }
+
+        year++;
+        position = 0;
+    }
+}
+
+// ------------------------------- schedules --------------------------------
+
+/**
+ * Time units a schedule can be made of.
+ */
+struct unit
+{
+    const char *singular;
+    const char *plural;
+    const char *abbreviation; // NULL if none
+    const char *description;  // for error messages
+};
+
+enum unit_index
+{
+    UNIT_YEAR,
+    UNIT_MONTH,
+    UNIT_WEEK,
+    UNIT_DAY,
+    UNIT_BUSINESS_DAY,
+    UNIT_HOUR,
+    UNIT_MINUTE,
+    UNIT_SECOND,
+    UNIT_MILLISECOND,
+    UNIT_MICROSECOND,
+    UNIT_NANOSECOND,
+    UNIT_COUNT
+};
+
+static const struct unit units[UNIT_COUNT] = {
+    [UNIT_YEAR] = {"year", "years", NULL, "year"},
+    [UNIT_MONTH] = {"month", "months", NULL, "month"},
+    [UNIT_WEEK] = {"week", "weeks", NULL, "week"},
+    [UNIT_DAY] = {"day", "days", NULL, "day"},
+    [UNIT_BUSINESS_DAY] = {"bday", "bdays", NULL, "business day"},
+    [UNIT_HOUR] = {"hour", "hours", NULL, "hour"},
+    [UNIT_MINUTE] = {"minute", "minutes", NULL, "minute"},
+    [UNIT_SECOND] = {"second", "seconds", NULL, "second"},
+    [UNIT_MILLISECOND] = {"millisecond", "milliseconds", "ms", "millisecond"},
+    [UNIT_MICROSECOND] = {"microsecond", "microseconds", "us", "microsecond"},
+    [UNIT_NANOSECOND] = {"nanosecond", "nanoseconds", "ns", "nanosecond"},
+};
+
+int schedule_parse(const char *text, struct schedule *schedule, char *error,
+                   size_t error_size)
+{
+    struct tm time_adjustment = {0};
+    bool date_portion_only = true; // will set to false if to modify h/m/s
+    long business_days = 0;
+    long long nanoseconds = 0; // sub-second units, carried into seconds
+    bool units_seen[UNIT_COUNT] = {0};
+
+    memset(schedule, 0, sizeof(struct schedule));
+
+    char *copy = strdup(text); // strtok_r() writes into the text
+    if (NULL == copy)
+    {
+        snprintf(error, error_size, "failed to allocate memory");
+        return -1;
+    }
+
+    // optional label
+
+    char *schedule_text = copy;
+    char *colon = strchr(copy, ':');
+    if (NULL != colon)
+    {
+        *colon = '\0';
+        schedule->label = strdup(copy);
+        if (NULL == schedule->label)
+        {
+            snprintf(error, error_size, "failed to allocate memory");
+            free(copy);
+            return -1;
+        }
+        schedule_text = colon + 1;
+    }
+
+    char *save_ptr;
+    char *token = strtok_r(schedule_text, " \t", &save_ptr);
+
+    if (NULL == token)
+    { // nothing after the label
+        snprintf(error, error_size, "Missing schedule");
+        goto fail;
+    }
+
+    while (NULL != token)
+    {
+        // getting number
+
+        errno = 0;
+
+        char *end_ptr;
+        long number = strtol(token, &end_ptr, 0);
+
+        if (0 != errno)
+        {
+            snprintf(error, error_size, "error calling strtol: %s",
+                     strerror(errno));
+            goto fail;
+        }
+
+        if (*end_ptr != '\0')
+        { // non number
+            snprintf(error, error_size, "A non-number was supplied.");
+            goto fail;
+        }
+
+        if (number < 0)
+        { // negative
+            snprintf(error, error_size, "Negative time was supplied");
+            goto fail;
+        }
+
+        if (number > __INT_MAX__)
+        { // out of int range
+            snprintf(error, error_size, "Supplied number is out of range");
+            goto fail;
+        }
+
+        // getting unit
+
+        token = strtok_r(NULL, " \t", &save_ptr);
+
+        if (NULL == token)
+        { // missing units
+            snprintf(error, error_size, "Missing time units.");
+            goto fail;
+        }
+
+        if (strcmp(token, "business") == 0)
+        { // "business day[s]" is two tokens
+            token = strtok_r(NULL, " \t", &save_ptr);
+
+            if (NULL == token ||
+                (strcmp(token, "day") != 0 && strcmp(token, "days") != 0))
+            {
+                snprintf(error, error_size, "Invalid unit supplied");
+                goto fail;
+            }
+
+            token = "bdays";
+        }
+
+        int unit = 0;
+        while (unit < UNIT_COUNT && strcmp(token, units[unit].singular) != 0 &&
+               strcmp(token, units[unit].plural) != 0 &&
+               (NULL == units[unit].abbreviation ||
+                strcmp(token, units[unit].abbreviation) != 0))
+            unit++;
+
+        if (unit == UNIT_COUNT)
+        {
+            snprintf(error, error_size, "Invalid unit supplied");
+            goto fail;
+        }
+
+        if (units_seen[unit])
+        {
+            snprintf(error, error_size, "Supplied %s multiple times",
+                     units[unit].description);
+            goto fail;
+        }
+        units_seen[unit] = true;
+
+        // setting up time_adjustment
+
+        switch (unit)
+        {
+        case UNIT_YEAR:
+            time_adjustment.tm_year += number;
+            break;
+        case UNIT_MONTH:
+            time_adjustment.tm_mon += number;
+            break;
+        case UNIT_WEEK:
+            time_adjustment.tm_mday += 7 * number;
+            break;
+        case UNIT_DAY:
+            time_adjustment.tm_mday += number;
+            break;
+        case UNIT_BUSINESS_DAY:
+            business_days += number;
+            break;
+        case UNIT_HOUR:
+            time_adjustment.tm_hour += number;
+            date_portion_only = false;
+            break;
+        case UNIT_MINUTE:
+            time_adjustment.tm_min += number;
+            date_portion_only = false;
+            break;
+        case UNIT_SECOND:
+            time_adjustment.tm_sec += number;
+            date_portion_only = false;
+            break;
+        case UNIT_MILLISECOND:
+            nanoseconds += number * 1000000LL;
+            date_portion_only = false;
+            break;
+        case UNIT_MICROSECOND:
+            nanoseconds += number * 1000LL;
+            date_portion_only = false;
+            break;
+        case UNIT_NANOSECOND:
+            nanoseconds += number;
+            date_portion_only = false;
+            break;
+        }
+
+        token = strtok_r(NULL, " \t", &save_ptr);
+    }
+
+    free(copy);
+
+    // whole seconds of the sub-second units go into struct tm
+    time_adjustment.tm_sec += nanoseconds / 1000000000;
+
+    schedule->adjustment = time_adjustment;
+    schedule->nanoseconds = nanoseconds % 1000000000;
+    schedule->business_days = business_days;
+    schedule->date_portion_only = date_portion_only;
+    schedule->subsecond = units_seen[UNIT_MILLISECOND] ||
+                          units_seen[UNIT_MICROSECOND] ||
+                          units_seen[UNIT_NANOSECOND];
+    schedule->calendar_units = units_seen[UNIT_YEAR] ||
+                               units_seen[UNIT_MONTH] ||
+                               units_seen[UNIT_BUSINESS_DAY];
+    schedule->exact = false;
+
+    return 0;
+
+fail:
+    free(copy);
+    schedule_free(schedule);
+    return -1;
+}
+
+int schedule_exact(struct schedule *schedule, bool exact, char *error,
+                   size_t error_size)
+{
+    if (exact && schedule->calendar_units)
+    {
+        snprintf(error, error_size,
+                 "Years, months and business days have no exact duration");
+        return -1;
+    }
+
+    const struct tm *adjustment = &schedule->adjustment;
+
+    schedule->exact = exact;
+    schedule->duration.tv_sec = adjustment->tm_mday * 86400LL +
+                                adjustment->tm_hour * 3600LL +
+                                adjustment->tm_min * 60LL + adjustment->tm_sec;
+    schedule->duration.tv_nsec = schedule->nanoseconds;
+
+    return 0;
+}
+
+void schedule_free(struct schedule *schedule)
+{
+    free(schedule->label);
+    schedule->label = NULL;
+}
+
+int schedule_iterator_init(struct schedule_iterator *iterator,
+                           const struct schedule *schedule,
+                           struct timespec start)
+{
+    iterator->schedule = schedule;
+    iterator->instant = start;
+    iterator->current_valid = true;
+
+    if (NULL == localtime_r(&start.tv_sec, &iterator->current))
+        return -1;
+
+    return 0;
+}
+
+int schedule_next(struct schedule_iterator *iterator,
+                  struct timespec *instant)
+{
+    struct tm *current_time = &iterator->current;
+    const struct schedule *schedule = iterator->schedule;
+
+    if (schedule->exact)
+    { // elapsed duration, struct tm stays untouched
+        struct timespec next = iterator->instant;
+        next.tv_nsec += schedule->duration.tv_nsec;
+        if (next.tv_nsec >= 1000000000)
+        {
+            next.tv_nsec -= 1000000000;
+            next.tv_sec++;
+        }
+
+        if (__builtin_add_overflow(next.tv_sec, schedule->duration.tv_sec,
+                                   &next.tv_sec))
+        {
+            errno = EOVERFLOW;
+            return -1;
+        }
+
+        iterator->instant = next;
+        iterator->current_valid = false;
+        if (NULL != instant)
+            *instant = next;
+
+        return 0;
+    }
+
+    if (!iterator->current_valid && NULL == schedule_local_time(iterator))
+        return -1;
+
+    // business days first, counted from the current (normalized) date
+    if (schedule->business_days > 0)
+    {
+        int64_t days;
+        if (-1 == business_days_ahead(current_time->tm_year + 1900LL,
+                                      current_time->tm_yday,
+                                      schedule->business_days, &days))
+            return -1;
+        current_time->tm_mday += days;
+    }
+
+    // add, carrying nanoseconds into seconds
+    long nanoseconds = iterator->instant.tv_nsec + schedule->nanoseconds;
+    if (nanoseconds >= 1000000000)
+    {
+        nanoseconds -= 1000000000;
+        current_time->tm_sec++;
+    }
+
+    current_time->tm_year += schedule->adjustment.tm_year;
+    current_time->tm_mon += schedule->adjustment.tm_mon;
+    current_time->tm_mday += schedule->adjustment.tm_mday;
+    current_time->tm_hour += schedule->adjustment.tm_hour;
+    current_time->tm_min += schedule->adjustment.tm_min;
+    current_time->tm_sec += schedule->adjustment.tm_sec;
+
+    // a step of a day or more keeps the time of day across a DST change;
+    // shorter steps keep the offset of the last instant, like the original
+    // loop, so they go through a repeated hour evenly
+    if (schedule->business_days > 0 || schedule->adjustment.tm_year != 0 ||
+        schedule->adjustment.tm_mon != 0 || schedule->adjustment.tm_mday != 0)
+        current_time->tm_isdst = -1;
+
+    errno = 0;
+    time_t next = mktime(current_time);
+    if (errno != 0)
+        return -1;
+
+    iterator->instant.tv_sec = next;
+    iterator->instant.tv_nsec = nanoseconds;
+    if (NULL != instant)
+        *instant = iterator->instant;
+
+    return 0;
+}
+
+const struct tm *schedule_local_time(struct schedule_iterator *iterator)
+{
+    if (!iterator->current_valid)
+    {
+        if (NULL == localtime_r(&iterator->instant.tv_sec, &iterator->current))
+            return NULL;
+        iterator->current_valid = true;
+    }
+
+    return &iterator->current;
+}
+
+int timespec_compare(struct timespec a, struct timespec b)
+{
+    if (a.tv_sec != b.tv_sec)
+        return (a.tv_sec < b.tv_sec) ? -1 : 1;
+    if (a.tv_nsec != b.tv_nsec)
+        return (a.tv_nsec < b.tv_nsec) ? -1 : 1;
+    return 0;
+}
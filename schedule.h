@@ -0,0 +1,169 @@
+/**
+ * Title:         schedule.h
+ * Description:   Parses datelist schedules and generates their instants
+ * Purpose:       The schedule parser and generator behind datelist, usable
+ *                from other programs without spawning datelist.
+ *                A schedule is parsed once into a struct schedule, then any
+ *                number of iterators can walk its instants from a starting
+ *                time, each call to schedule_next() producing one instant.
+ *                Functions report errors through their return value and a
+ *                message buffer, they never print or exit.
+ *                Schedules step on the wall clock of the local time zone
+ *                (TZ) like mktime(3) by default, so "1 day" keeps the time
+ *                of day across DST changes. Exact schedules instead add
+ *                their total elapsed duration with timespec arithmetic,
+ *                never going through struct tm, so "1 hour" is always 3600
+ *                seconds. Only fixed-length units can be exact.
+ *                The holiday calendar used by business days is shared by all
+ *                schedules of the process and built lazily, so iterators
+ *                using business days must not run on several threads.
+ * Usage:         struct schedule schedule;
+ *                char error[SCHEDULE_ERROR_LENGTH];
+ *                if (schedule_parse("backup:1 day 2 hours", &schedule,
+ *                                   error, sizeof(error)) == -1) ...
+ *                struct schedule_iterator iterator;
+ *                schedule_iterator_init(&iterator, &schedule, time(NULL));
+ *                struct timespec instant;
+ *                while (schedule_next(&iterator, &instant) == 0) ...
+ *                schedule_free(&schedule);
+ * Build with:    gcc -c schedule.c
+ */
+
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define SCHEDULE_ERROR_LENGTH 128 // enough for any error message
+
+/**
+ * A parsed schedule: the amount of time added on every step.
+ */
+struct schedule
+{
+    char *label;            // `label:` prefix, NULL if none
+    struct tm adjustment;   // amount added on every step
+    long nanoseconds;       // sub-second part of the adjustment
+    long business_days;     // business days moved ahead on every step
+    bool date_portion_only; // false if the schedule modifies h/m/s
+    bool subsecond;         // true if the schedule has sub-second units
+    bool calendar_units;    // true if it has years, months or business days
+    bool exact;             // step by elapsed duration, see schedule_exact()
+    struct timespec duration; // elapsed duration of a step, if exact
+};
+
+/**
+ * Position of an iteration over a schedule's instants.
+ */
+struct schedule_iterator
+{
+    const struct schedule *schedule;
+    struct timespec instant; // last instant, or the start before stepping
+    struct tm current;       // broken-down local time of instant
+    bool current_valid;      // exact steps leave current to be computed
+};
+
+// ------------------------------- schedules --------------------------------
+
+/**
+ * Parses a schedule, e.g. "label:1 week 2 hours".
+ * @param text Schedule text, not modified
+ * @param schedule Schedule to fill out, release with schedule_free()
+ * @param error Receives a message if the schedule is malformed
+ * @param error_size Size of error, SCHEDULE_ERROR_LENGTH is enough
+ * @returns 0 on success, -1 on error
+ */
+int schedule_parse(const char *text, struct schedule *schedule, char *error,
+                   size_t error_size);
+
+/**
+ * Switches a schedule between wall-clock steps (the default) and exact
+ * elapsed durations.
+ * @param exact true for exact elapsed durations
+ * @returns 0 on success, -1 if the schedule has calendar units (years,
+ *          months or business days) which have no fixed duration
+ */
+int schedule_exact(struct schedule *schedule, bool exact, char *error,
+                   size_t error_size);
+
+/**
+ * Releases what schedule_parse() allocated.
+ */
+void schedule_free(struct schedule *schedule);
+
+/**
+ * Starts iterating over a schedule's instants. The first instant is one
+ * step after start.
+ * @param iterator Iterator to set up
+ * @param schedule Schedule to iterate, must outlive the iterator
+ * @param start Starting time
+ * @returns 0 on success, -1 if start can't be converted to local time
+ */
+int schedule_iterator_init(struct schedule_iterator *iterator,
+                           const struct schedule *schedule,
+                           struct timespec start);
+
+/**
+ * Steps an iterator to the schedule's next instant.
+ * @param iterator Iterator to step
+ * @param instant Receives the next instant, may be NULL
+ * @returns 0 on success, -1 with errno set if the instant can't be
+ *          represented (EOVERFLOW), memory ran out (ENOMEM) or the holiday
+ *          calendar has no business days (EDOM)
+ */
+int schedule_next(struct schedule_iterator *iterator,
+                  struct timespec *instant);
+
+/**
+ * Broken-down local time of an iterator's instant, computed on demand after
+ * exact steps.
+ * @returns the local time, NULL if it can't be computed
+ */
+const struct tm *schedule_local_time(struct schedule_iterator *iterator);
+
+/**
+ * Compares two instants.
+ * @returns negative, zero or positive as a is before, at or after b
+ */
+int timespec_compare(struct timespec a, struct timespec b);
+
+// ----------------------------- business days ------------------------------
+
+/**
+ * Adds the holidays of a calendar file (one YYYY-MM-DD date per line, blank
+ * lines and lines starting with # ignored) to the process' calendar.
+ * @returns 0 on success, -1 on error
+ */
+int schedule_load_calendar(const char *path, char *error, size_t error_size);
+
+/**
+ * Releases the process' holiday calendar.
+ */
+void schedule_free_calendar(void);
+
+// -------------------------------- calendar --------------------------------
+
+/**
+ * Days since 1970-01-01 of a proleptic Gregorian calendar date.
+ * @param year Full year, e.g. 2024
+ * @param month 1-12
+ * @param day 1-31
+ */
+int64_t days_from_civil(int64_t year, int month, int day);
+
+/**
+ * Fills the calendar fields of a struct tm from seconds since the epoch,
+ * without consulting any time zone.
+ * @param seconds Seconds since 1970-01-01 00:00:00, already offset if local
+ * @param result Broken-down time to fill out
+ */
+void civil_from_seconds(int64_t seconds, struct tm *result);
+
+bool is_leap_year(int64_t year);
+
+int days_in_month(int64_t year, int month);
+
+#endif
@@ -9,19 +9,107 @@
  *                Tests (only one per command):
  *                -s filename: match if file is a hardlink to `filename`
  *                -m fileglob: match if file's name matches `fileglob`
- * Build with:    gcc -o sfind sfind.c
+ *                -M patfile: match if file's name matches any of the globs
+ *                    in `patfile`, one per line, blank lines and lines
+ *                    starting with # ignored. All globs are tested at once
+ *                    with a glob set (see globset.h), and matches are
+ *                    printed with the globs they matched, after a tab,
+ *                    separated by commas.
+ *                -l: list every group of hardlinks, paths sharing an inode,
+ *                    in one walk. Groups are separated by blank lines, in
+ *                    the order their first path was found. Only files with
+ *                    more than one link are recorded, in a hash table of
+ *                    (device, inode) with the paths packed in an arena.
+ *                -S snapshot: write a snapshot of the files (all but
+ *                    directories) to `snapshot`: their paths, inodes,
+ *                    sizes and modification times, sorted by path (see
+ *                    snapshot.h). Doesn't cross mountpoints.
+ *                -D old new: print what changed from snapshot `old` to
+ *                    snapshot `new`, one line per file, in path order: A
+ *                    (added), D (deleted), M (modified) or R (renamed,
+ *                    same inode), a tab, the path, and for R a tab and the
+ *                    new path. Walks nothing, and reads both snapshots once
+ *                    in constant memory.
+ *                Images, for -s, -m and -M:
+ *                -x image: search the ext2/3/4 file system in the file
+ *                    `image`, read directly, instead of directories: its
+ *                    inode tables in order, then its directory blocks in
+ *                    block order, in large sequential reads, without
+ *                    mounting it or walking from directory to directory
+ *                    (see ext4image.h). Prints paths from the image's
+ *                    root, like /etc/passwd; the -s filename is such a
+ *                    path too. No actions, and none of the options below.
+ *                Actions (only one per command, prints matches if none):
+ *                -delete: delete matches with unlinkat(2) relative to their
+ *                    open directory. The walk is depth-first, so a matched
+ *                    directory is deleted after the matches inside it.
+ *                    Only empty directories can be deleted.
+ *                -exec command [argument ...] {} +: run command with the
+ *                    matches as its last arguments, as many per run as fit
+ *                    in ARG_MAX, while the walk goes on.
+ *                -P jobs: run up to `jobs` commands of -exec at once
+ *                    (default 1).
+ *                Exits with failure if a deletion or a command failed.
+ *                Throttling, to walk a shared host without starving others:
+ *                -r rate: at most `rate` directory reads and stat calls per
+ *                    second (token bucket, see throttle.h)
+ *                -L ms: adapt the rate to keep their mean latency under
+ *                    `ms` milliseconds, halving it while over and raising
+ *                    it again while under (needs -r)
+ *                -i: idle I/O priority, only use the disk when no one else
+ *                    does
+ *                Checkpoints, for walks of hours:
+ *                -c file: every 10 seconds, and on SIGINT/SIGTERM before
+ *                    exiting, save the walk's frontier (the directories
+ *                    still to read) and the number of matches so far to
+ *                    `file`, replaced atomically. Removed once the walk
+ *                    is done. Not with -l.
+ *                --resume: continue the walk saved in the -c file, with the
+ *                    same command line, without walking the finished
+ *                    subtrees again. If stdout is a regular file, it is
+ *                    truncated to the matches printed before the
+ *                    checkpoint, so appending to it gives each match once.
+ *                Source trees:
+ *                -g: skip what the .gitignore and .ignore files in the
+ *                    directories ignore, with git's rules, and .git
+ *                    directories. Ignored directories are not opened.
+ *                    Only the ignore files at or below the given
+ *                    directories are read, not those of their parents.
+ *                Large directories:
+ *                -t threads: stat the entries of directories of more than
+ *                    4096 entries with `threads` threads, while the next
+ *                    entries are read. Matches are still tested and acted
+ *                    on one at a time.
+ *                Directories are read in full and their entries stat'ed in
+ *                inode order, see walk.h.
+ * Build with:    gcc -o sfind sfind.c outbuf.c walk.c throttle.c globset.c \
+ *                    ignore.c snapshot.c ext4image.c -pthread
  */
 
-#define _XOPEN_SOURCE 500
+#define _XOPEN_SOURCE 700
+#include "ext4image.h"
+#include "globset.h"
+#include "multicall.h"
+#include "outbuf.h"
+#include "probes.h"
+#include "snapshot.h"
+#include "walk.h"
+
 #include <errno.h>
+#include <fcntl.h>
 #include <fnmatch.h>
-#include <ftw.h>
+#include <limits.h>
+#include <signal.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #define USAGE \
@@ -30,18 +118,819 @@ $ %s [dir1 dir2 ...] [test]\n\
 Can omit dirs to imply current working directory\n\
 Tests (only one per command):\n\
 -s filename: match if file is a hardlink to `filename`\n\
--m fileglob: match if file's name matches `fileglob`\n"
+-m fileglob: match if file's name matches `fileglob`\n\
+-M patfile: match if file's name matches a glob of `patfile`, one per line\n\
+-l: list every group of hardlinks in the directories\n\
+-S snapshot: write a snapshot of the files in the directories to `snapshot`\n\
+-D old new: print the files added, deleted, modified and renamed between two\n\
+    snapshots\n\
+Images:\n\
+-x image: search the ext2/3/4 image file `image` instead, for -s, -m or -M\n\
+Actions for -s, -m and -M (only one per command, prints matches if none):\n\
+-delete: delete matches, directories after their contents\n\
+-exec command [argument ...] {} +: run command with the matches\n\
+-P jobs: run up to `jobs` commands of -exec at once (default 1)\n\
+Throttling:\n\
+-r rate: at most `rate` directory reads and stat calls per second\n\
+-L ms: lower the rate while their mean latency is over `ms` (needs -r)\n\
+-i: idle I/O priority\n\
+Checkpoints:\n\
+-c file: save the walk to `file` every 10 seconds and when interrupted\n\
+--resume: continue the walk saved in the -c file\n\
+Source trees:\n\
+-g: skip what .gitignore and .ignore files ignore, and .git directories\n\
+Large directories:\n\
+-t threads: stat the entries of directories of over 4096 entries in threads\n"
+
+/**
+ * What is done with the matches of -s, -m and -M.
+ */
+enum action
+{
+    ACTION_PRINT,
+    ACTION_DELETE,
+    ACTION_EXEC,
+};
+
+static ino_t target_inode;          // for -s test matching
+static char *target_pattern = NULL; // for -m test matching
+static struct globset pattern_set;  // for -M test matching
+static uint32_t *pattern_matches;   // globs matched by an entry, for -M
+static struct outbuf output;        // matches, on stdout
+static enum action action = ACTION_PRINT;
+static bool action_failed = false; // a deletion or a command failed
+static uint64_t match_count = 0;   // matches reported
+static uint64_t output_bytes = 0;  // bytes of matches printed
+
+// ----------------------------- hardlink groups ----------------------------
+
+#define ARENA_BLOCK_SIZE (1 << 16)  // paths are allocated in blocks this big
+#define LINK_TABLE_INITIAL_SIZE 1024 // slots of the index, a power of two
+
+/**
+ * One path of a hardlink group, in the arena.
+ */
+struct link_path
+{
+    struct link_path *next;
+    char path[]; // null terminated
+};
+
+/**
+ * A file with more than one link, and the paths to it found so far.
+ */
+struct link_group
+{
+    dev_t device;
+    ino_t inode;
+    nlink_t link_count;      // st_nlink
+    size_t path_count;       // paths found, at most link_count unless the
+                             // tree changed during the walk
+    struct link_path *first; // in walk order
+    struct link_path *last;
+};
+
+/**
+ * Groups in discovery order, and an open addressing index into them.
+ * The index only holds group numbers (0 for a free slot, n + 1 for group
+ * n), so growing it moves 4-byte slots, not groups.
+ */
+struct link_table
+{
+    struct link_group *groups;
+    size_t group_count;
+    size_t group_capacity;
+    uint32_t *index;
+    size_t index_size; // a power of two
+};
+
+/**
+ * Bump allocator for path records, freed all at once.
+ */
+struct arena
+{
+    char *block; // current block, its first bytes link to the previous
+    size_t used; // bytes used in block
+    size_t size; // size of block
+};
+
+static struct link_table link_table; // for -l
+static struct arena path_arena;      // for -l
+static struct snapshot snapshot;     // for -S
+
+/**
+ * Allocates from the arena, in a new block when the current one is full.
+ * Exits on allocation failure.
+ */
+static void *arena_allocate(struct arena *arena, size_t length)
+{
+    const size_t alignment = _Alignof(max_align_t);
+    length = (length + alignment - 1) / alignment * alignment;
+
+    if (arena->block == NULL || arena->used + length > arena->size)
+    {
+        const size_t header = alignment; // holds the previous block's address
+        size_t size = ARENA_BLOCK_SIZE;
+        if (header + length > size)
+            size = header + length; // a path longer than a block
+
+        char *block = malloc(size);
+        if (block == NULL)
+        {
+            fprintf(stderr, "malloc(): failed to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+        *(char **)block = arena->block;
+        arena->block = block;
+        arena->used = header;
+        arena->size = size;
+    }
+
+    void *allocation = arena->block + arena->used;
+    arena->used += length;
+    return allocation;
+}
+
+static void arena_free(struct arena *arena)
+{
+    while (arena->block != NULL)
+    {
+        char *previous = *(char **)arena->block;
+        free(arena->block);
+        arena->block = previous;
+    }
+}
+
+static size_t link_hash(dev_t device, ino_t inode)
+{
+    uint64_t hash = (uint64_t)inode * 0x9e3779b97f4a7c15u ^ (uint64_t)device;
+    return hash ^ (hash >> 29);
+}
+
+/**
+ * Rebuilds the index at twice its size, or at its initial size when empty.
+ * Exits on allocation failure.
+ */
+static void grow_link_index(struct link_table *table)
+{
+    const size_t size = (table->index_size == 0) ? LINK_TABLE_INITIAL_SIZE
+                                                  : table->index_size * 2;
+    uint32_t *index = calloc(size, sizeof(uint32_t));
+    if (index == NULL)
+    {
+        fprintf(stderr, "calloc(): failed to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t n = 0; n < table->group_count; n++)
+    {
+        const struct link_group *group = &table->groups[n];
+        size_t i = link_hash(group->device, group->inode) & (size - 1);
+        while (index[i] != 0)
+            i = (i + 1) & (size - 1);
+        index[i] = n + 1;
+    }
+
+    free(table->index);
+    table->index = index;
+    table->index_size = size;
+}
+
+/**
+ * Finds the group of a file, adding an empty one if it is new.
+ * Exits on allocation failure.
+ */
+static struct link_group *find_link_group(struct link_table *table,
+                                          const struct stat *sb)
+{
+    if ((table->group_count + 1) * 4 > table->index_size * 3)
+        grow_link_index(table); // keep the index under 3/4 full
+
+    const size_t mask = table->index_size - 1;
+    size_t i = link_hash(sb->st_dev, sb->st_ino) & mask;
+
+    while (table->index[i] != 0)
+    {
+        struct link_group *group = &table->groups[table->index[i] - 1];
+        if (group->inode == sb->st_ino && group->device == sb->st_dev)
+            return group;
+        i = (i + 1) & mask;
+    }
+
+    if (table->group_count == table->group_capacity)
+    {
+        const size_t capacity =
+            (table->group_capacity == 0) ? 256 : table->group_capacity * 2;
+        struct link_group *groups =
+            realloc(table->groups, capacity * sizeof(struct link_group));
+        if (groups == NULL)
+        {
+            fprintf(stderr, "realloc(): failed to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+        table->groups = groups;
+        table->group_capacity = capacity;
+    }
+
+    struct link_group *group = &table->groups[table->group_count++];
+    group->device = sb->st_dev;
+    group->inode = sb->st_ino;
+    group->link_count = sb->st_nlink;
+    group->path_count = 0;
+    group->first = NULL;
+    group->last = NULL;
+    table->index[i] = table->group_count;
+
+    return group;
+}
+
+/**
+ * Prints the groups with at least two paths found, blank line separated,
+ * and frees the table and the arena.
+ */
+static void print_link_groups(struct link_table *table, struct arena *arena)
+{
+    bool first_group = true;
+
+    for (size_t n = 0; n < table->group_count; n++)
+    {
+        const struct link_group *group = &table->groups[n];
+        if (group->path_count < 2)
+            continue; // its other links are outside the directories
+
+        if (!first_group)
+            outbuf_char(&output, '\n');
+        first_group = false;
+
+        for (const struct link_path *path = group->first; path != NULL;
+             path = path->next)
+        {
+            outbuf_string(&output, path->path);
+            outbuf_char(&output, '\n');
+        }
+    }
+
+    free(table->groups);
+    free(table->index);
+    memset(table, 0, sizeof(struct link_table));
+    arena_free(arena);
+}
+
+// -------------------------------- actions ---------------------------------
+
+/**
+ * Command lines of -exec ... +, filled with matches and run by a pool of
+ * up to jobs processes.
+ */
+struct exec_batch
+{
+    char **argv;          // the command, then the matches, NULL terminated
+    size_t command_count; // arguments of the command itself
+    size_t count;         // arguments in argv
+    size_t capacity;      // room in argv, NULL excluded
+    size_t bytes;         // bytes the matches in argv take on the command
+                          // line, pointers included
+    size_t limit;         // most bytes of matches per command line
+    struct arena paths;   // copies of the matches in argv
+    long jobs;            // most commands running at once
+    long running;         // commands running
+};
+
+static struct exec_batch exec_batch; // for -exec
+
+/**
+ * Sets up the batches of -exec. The room for matches on a command line is
+ * ARG_MAX less the environment, the command and some headroom, like
+ * xargs(1).
+ * Exits on error.
+ * @param command The command and its arguments, without `{} +`
+ */
+static void exec_init(struct exec_batch *batch, char **command,
+                      size_t command_count, long jobs)
+{
+    extern char **environ;
+
+    long limit = sysconf(_SC_ARG_MAX);
+    if (limit == -1)
+        limit = _POSIX_ARG_MAX;
+    limit -= 2048; // headroom, as in POSIX's description of xargs(1)
+
+    for (char **variable = environ; *variable != NULL; variable++)
+        limit -= strlen(*variable) + 1 + sizeof(char *);
+    for (size_t i = 0; i < command_count; i++)
+        limit -= strlen(command[i]) + 1 + sizeof(char *);
+
+    if (limit < 4096)
+    {
+        fprintf(stderr, "-exec: environment and command too long\n");
+        exit(EXIT_FAILURE);
+    }
+
+    memset(batch, 0, sizeof(struct exec_batch));
+    batch->capacity = command_count + 1024;
+    batch->argv = malloc((batch->capacity + 1) * sizeof(char *));
+    if (batch->argv == NULL)
+    {
+        fprintf(stderr, "malloc(): failed to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(batch->argv, command, command_count * sizeof(char *));
+    batch->command_count = command_count;
+    batch->count = command_count;
+    batch->limit = limit;
+    batch->jobs = jobs;
+}
+
+/**
+ * Waits for one command of the pool to end, noting if it failed.
+ * Exits on error.
+ */
+static void exec_wait(struct exec_batch *batch)
+{
+    int status;
+    while (-1 == wait(&status))
+    {
+        if (errno != EINTR)
+        {
+            perror("wait()");
+            exit(EXIT_FAILURE);
+        }
+    }
+    batch->running--;
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        action_failed = true;
+}
+
+/**
+ * Starts the command with the matches collected so far, once the pool has
+ * room for it.
+ * Exits on error.
+ */
+static void exec_run(struct exec_batch *batch)
+{
+    if (batch->count == batch->command_count)
+        return; // no matches
+
+    // the command writes to the same stdout, after what was output so far
+    if (-1 == outbuf_flush(&output))
+    {
+        perror("write()");
+        exit(EXIT_FAILURE);
+    }
+
+    while (batch->running >= batch->jobs)
+        exec_wait(batch);
+
+    batch->argv[batch->count] = NULL;
+
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        perror("fork()");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0)
+    {
+        execvp(batch->argv[0], batch->argv);
+        fprintf(stderr, "%s: %s\n", batch->argv[0], strerror(errno));
+        _exit(127);
+    }
+    batch->running++;
+
+    batch->count = batch->command_count;
+    batch->bytes = 0;
+    arena_free(&batch->paths);
+}
+
+/**
+ * Adds a match to the command line, starting the command first if the
+ * match doesn't fit.
+ * Exits on error.
+ */
+static void exec_add(struct exec_batch *batch, const char *path)
+{
+    const size_t length = strlen(path) + 1;
+    const size_t bytes = length + sizeof(char *);
+
+    if (batch->bytes + bytes > batch->limit)
+        exec_run(batch);
+
+    if (batch->count == batch->capacity)
+    {
+        const size_t capacity = batch->capacity * 2;
+        char **argv = realloc(batch->argv, (capacity + 1) * sizeof(char *));
+        if (argv == NULL)
+        {
+            fprintf(stderr, "realloc(): failed to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+        batch->argv = argv;
+        batch->capacity = capacity;
+    }
+
+    char *copy = arena_allocate(&batch->paths, length);
+    memcpy(copy, path, length);
+    batch->argv[batch->count++] = copy;
+    batch->bytes += bytes;
+}
+
+/**
+ * Runs the last command line and waits for all commands to end.
+ * Exits on error.
+ */
+static void exec_drain(struct exec_batch *batch)
+{
+    exec_run(batch);
+    while (batch->running > 0)
+        exec_wait(batch);
+}
+
+/**
+ * Drains the pool, then frees the batch.
+ * Exits on error.
+ */
+static void exec_finish(struct exec_batch *batch)
+{
+    exec_drain(batch);
+
+    free(batch->argv);
+    batch->argv = NULL;
+}
+
+/**
+ * Deletes a match, relative to its directory.
+ */
+static void delete_entry(const char *fpath, const struct stat *sb,
+                         struct FTW *ftwbuf)
+{
+    const char *name = fpath + ftwbuf->base;
+    if (ftwbuf->level == 0 && strcmp(name, ".") == 0)
+        return; // like find(1), never the starting directory
+
+    const int directory_fd = walk_directory_fd(ftwbuf);
+    if (directory_fd == -1 ||
+        -1 == unlinkat(directory_fd, name,
+                       S_ISDIR(sb->st_mode) ? AT_REMOVEDIR : 0))
+    {
+        fprintf(stderr, "unlinkat(): %s: %s\n", fpath, strerror(errno));
+        action_failed = true;
+    }
+}
+
+/**
+ * Prints a match of -s, -m or -M, or acts on it.
+ * @param globs Globs of pattern_set the match matched, printed after it,
+ *              NULL for none
+ * @param glob_count Number of globs
+ */
+static void report_match(const char *fpath, const struct stat *sb,
+                         struct FTW *ftwbuf, const uint32_t *globs,
+                         size_t glob_count)
+{
+    PROBE1(sfind, match, fpath);
+    match_count++;
+
+    switch (action)
+    {
+    case ACTION_PRINT:
+    {
+        const size_t length = strlen(fpath);
+        outbuf_write(&output, fpath, length);
+        output_bytes += length + 1;
+
+        for (size_t i = 0; globs != NULL && i < glob_count; i++)
+        {
+            const char *glob = pattern_set.patterns[globs[i]];
+            const size_t glob_length = strlen(glob);
+            outbuf_char(&output, (i == 0) ? '\t' : ',');
+            outbuf_write(&output, glob, glob_length);
+            output_bytes += 1 + glob_length;
+        }
+
+        outbuf_char(&output, '\n');
+        break;
+    }
+    case ACTION_DELETE:
+        delete_entry(fpath, sb, ftwbuf);
+        break;
+    case ACTION_EXEC:
+        exec_add(&exec_batch, fpath);
+        break;
+    }
+}
+
+/**
+ * Takes the actions and --resume out of the command line, so getopt()
+ * doesn't see them: `-delete`, and `-exec command [argument ...] {} +`.
+ * Exits on error.
+ * @param argc Argument count, updated
+ * @param argv Arguments, with the actions removed
+ * @param command Set to the command of -exec, in argv
+ * @param command_count Set to the number of arguments of the command
+ * @param resume Set if --resume was given
+ */
+static void take_actions(int *argc, char *argv[], char ***command,
+                         size_t *command_count, bool *resume)
+{
+    int kept = 1;
+    int i = 1;
+
+    while (i < *argc)
+    {
+        if (strcmp(argv[i], "--") == 0)
+            break; // the rest are directories
+
+        if (strcmp(argv[i], "--resume") == 0)
+        {
+            *resume = true;
+            i++;
+            continue;
+        }
+
+        if (strcmp(argv[i], "-delete") != 0 && strcmp(argv[i], "-exec") != 0)
+        {
+            argv[kept++] = argv[i++];
+            continue;
+        }
+
+        if (action != ACTION_PRINT)
+        {
+            fprintf(stderr, "Must provide at most one action\n" USAGE,
+                    argv[0]);
+            exit(EXIT_FAILURE);
+        }
+
+        if (strcmp(argv[i], "-delete") == 0)
+        {
+            action = ACTION_DELETE;
+            i++;
+            continue;
+        }
+
+        // -exec: the command ends at `{} +`
+        int end = i + 1;
+        while (end + 1 < *argc &&
+               !(strcmp(argv[end], "{}") == 0 &&
+                 strcmp(argv[end + 1], "+") == 0))
+            end++;
+        if (end + 1 >= *argc || end == i + 1)
+        {
+            fprintf(stderr, "-exec needs a command, then {} +\n" USAGE,
+                    argv[0]);
+            exit(EXIT_FAILURE);
+        }
+
+        // copied out, the kept arguments move over it
+        action = ACTION_EXEC;
+        *command_count = end - (i + 1);
+        *command = malloc(*command_count * sizeof(char *));
+        if (*command == NULL)
+        {
+            fprintf(stderr, "malloc(): failed to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(*command, argv + i + 1, *command_count * sizeof(char *));
+        i = end + 2;
+    }
+
+    while (i < *argc)
+        argv[kept++] = argv[i++];
+
+    argv[kept] = NULL;
+    *argc = kept;
+}
+
+// ------------------------------ checkpoints -------------------------------
+
+#define CHECKPOINT_MAGIC "SFINDCP1"
+#define CHECKPOINT_INTERVAL 10 // seconds between checkpoints
+
+/**
+ * Start of a checkpoint file, followed by the path of the directory being
+ * walked and the walk's frontier (see walk_save_frontier()).
+ */
+struct checkpoint_header
+{
+    char magic[8];          // CHECKPOINT_MAGIC, without the NUL
+    uint32_t root;          // which of the command line's directories
+    uint32_t root_length;   // of the path that follows
+    uint64_t matches;       // match_count at the checkpoint
+    uint64_t output_bytes;  // output_bytes at the checkpoint
+    uint64_t frontier_length;
+};
+
+static const char *checkpoint_path = NULL; // -c argument
+static uint32_t checkpoint_root;           // directory being walked
+static const char *checkpoint_root_path;
+static struct timespec next_checkpoint; // CLOCK_MONOTONIC
+
+static volatile sig_atomic_t stop_requested = 0; // SIGINT or SIGTERM caught
+
+static void handle_stop(int signal_number)
+{
+    stop_requested = 1;
+}
+
+/**
+ * Has SIGINT and SIGTERM end the walk at the next checkpoint. System calls
+ * are restarted, the walk is not disturbed until then.
+ */
+static void catch_stop_signals(void)
+{
+    struct sigaction action = {0};
+    action.sa_handler = handle_stop;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+
+    if (-1 == sigaction(SIGINT, &action, NULL) ||
+        -1 == sigaction(SIGTERM, &action, NULL))
+    {
+        perror("sigaction()");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Writes a checkpoint: all matches so far are printed or acted on first,
+ * then the checkpoint goes to a temporary file renamed over the previous
+ * one, so a crash leaves either checkpoint whole.
+ * Exits on error.
+ */
+static void write_checkpoint(const struct walk *walk)
+{
+    if (-1 == outbuf_flush(&output))
+    {
+        perror("write()");
+        exit(EXIT_FAILURE);
+    }
+    if (action == ACTION_EXEC)
+        exec_drain(&exec_batch);
+
+    struct outbuf frontier;
+    outbuf_init(&frontier, -1);
+    walk_save_frontier(walk, &frontier);
+
+    struct checkpoint_header header = {0};
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.root = checkpoint_root;
+    header.root_length = strlen(checkpoint_root_path);
+    header.matches = match_count;
+    header.output_bytes = output_bytes;
+    header.frontier_length = frontier.length;
+
+    char temporary[PATH_MAX];
+    if (snprintf(temporary, sizeof(temporary), "%s.tmp", checkpoint_path) >=
+        (int)sizeof(temporary))
+    {
+        fprintf(stderr, "%s: path too long\n", checkpoint_path);
+        exit(EXIT_FAILURE);
+    }
+
+    const int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                        0600);
+    if (fd == -1)
+    {
+        fprintf(stderr, "%s: %s\n", temporary, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    struct outbuf file;
+    outbuf_init(&file, fd);
+    outbuf_write(&file, &header, sizeof(header));
+    outbuf_write(&file, checkpoint_root_path, header.root_length);
+    outbuf_write(&file, frontier.data, frontier.length);
+
+    if (-1 == outbuf_close(&frontier) || -1 == outbuf_close(&file) ||
+        -1 == fsync(fd) || -1 == close(fd) ||
+        -1 == rename(temporary, checkpoint_path))
+    {
+        fprintf(stderr, "%s: %s\n", temporary, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Checkpoint function for walk_tree_options: writes a checkpoint every
+ * CHECKPOINT_INTERVAL seconds, and ends the walk after one if a stop was
+ * requested.
+ * @returns 0 to continue the walk, 1 to end it
+ */
+static int checkpoint_walk(const struct walk *walk)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if (!stop_requested && (now.tv_sec < next_checkpoint.tv_sec ||
+                            (now.tv_sec == next_checkpoint.tv_sec &&
+                             now.tv_nsec < next_checkpoint.tv_nsec)))
+        return 0;
+
+    write_checkpoint(walk);
+
+    clock_gettime(CLOCK_MONOTONIC, &next_checkpoint);
+    next_checkpoint.tv_sec += CHECKPOINT_INTERVAL;
+
+    return stop_requested ? 1 : 0;
+}
+
+/**
+ * Reads the checkpoint of an interrupted walk.
+ * Exits on error, or if it isn't a walk of the given directories.
+ * @param roots Directories of the command line
+ * @param header Set to the checkpoint's header
+ * @returns the frontier, to be freed
+ */
+static char *read_checkpoint(char **roots, int root_count,
+                             struct checkpoint_header *header)
+{
+    FILE *file = fopen(checkpoint_path, "rb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "%s: %s\n", checkpoint_path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    char *root = NULL;
+    char *frontier = NULL;
+    bool valid =
+        1 == fread(header, sizeof(struct checkpoint_header), 1, file) &&
+        0 == memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic)) &&
+        header->root < (uint32_t)root_count &&
+        header->root_length < PATH_MAX &&
+        header->frontier_length < ((uint64_t)1 << 40);
+
+    if (valid)
+    {
+        root = calloc(header->root_length + 1, 1);
+        frontier = malloc(header->frontier_length + 1);
+        if (root == NULL || frontier == NULL)
+        {
+            fprintf(stderr, "malloc(): failed to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+
+        valid = (header->root_length == 0 ||
+                 1 == fread(root, header->root_length, 1, file)) &&
+                (header->frontier_length == 0 ||
+                 1 == fread(frontier, header->frontier_length, 1, file)) &&
+                0 == strcmp(root, roots[header->root]);
+    }
+    fclose(file);
+    free(root);
+
+    if (!valid)
+    {
+        fprintf(stderr,
+                "%s: not a checkpoint of a walk of these directories\n",
+                checkpoint_path);
+        exit(EXIT_FAILURE);
+    }
+
+    return frontier;
+}
+
+/**
+ * Picks up the output of an interrupted walk: a regular file is cut back
+ * to what was printed up to the checkpoint.
+ * Exits on error.
+ */
+static void resume_output(const struct checkpoint_header *header)
+{
+    match_count = header->matches;
+    output_bytes = header->output_bytes;
+
+    struct stat status;
+    if (-1 == fstat(STDOUT_FILENO, &status))
+    {
+        perror("fstat()");
+        exit(EXIT_FAILURE);
+    }
 
-static ino_t target_inode;          // for -s test matching
-static char *target_pattern = NULL; // for -m test matching
+    if (S_ISREG(status.st_mode) && action == ACTION_PRINT &&
+        (uint64_t)status.st_size >= header->output_bytes)
+    {
+        if (-1 == ftruncate(STDOUT_FILENO, header->output_bytes) ||
+            -1 == lseek(STDOUT_FILENO, header->output_bytes, SEEK_SET))
+        {
+            perror("ftruncate()");
+            exit(EXIT_FAILURE);
+        }
+    }
+    else
+    {
+        fprintf(stderr, "Resuming after %llu matches\n",
+                (unsigned long long)header->matches);
+    }
+}
 
 // --------------------------------- tests ----------------------------------
 
 /**
- * Callback function for nftw.
- * Prints out relative pathnames of entries with the same inode number as
- * target_inode. (-s test)
- * @pre Assumes nftw will not cross mountpoints.
+ * Callback function for walk_tree.
+ * Reports entries with the same inode number as target_inode, see
+ * report_match(). (-s test)
+ * @pre Assumes walk_tree will not cross mountpoints.
  * @param fpath Path of current entry
  * @param sb stat structure of current entry
  * @param typeflag Type of file of the current entry
@@ -51,19 +940,19 @@ static char *target_pattern = NULL; // for -m test matching
 int hardlink_test(const char *fpath, const struct stat *sb, int typeflag,
                   struct FTW *ftwbuf)
 {
+    PROBE2(sfind, entry, fpath, (typeflag != FTW_NS) ? sb->st_ino : 0);
+
     // if stat data is valid and inode number matches target, print fpath
     if (typeflag != FTW_NS && sb->st_ino == target_inode)
-    {
-        printf("%s\n", fpath);
-    }
+        report_match(fpath, sb, ftwbuf, NULL, 0);
 
-    return 0; // nftw: continue walk
+    return 0; // walk_tree: continue walk
 }
 
 /**
- * Callback function for nftw.
- * Prints out relative pathnames of entries with a basename that matches
- * target_pattern by fnmatch(3). (-m test)
+ * Callback function for walk_tree.
+ * Reports entries with a basename that matches target_pattern by
+ * fnmatch(3), see report_match(). (-m test)
  * @param fpath Path of current entry
  * @param sb stat structure of current entry
  * @param typeflag Type of file of the current entry
@@ -73,16 +962,258 @@ int hardlink_test(const char *fpath, const struct stat *sb, int typeflag,
 int basename_test(const char *fpath, const struct stat *sb, int typeflag,
                   struct FTW *ftwbuf)
 {
+    PROBE2(sfind, entry, fpath, (typeflag != FTW_NS) ? sb->st_ino : 0);
+
     // print if basename match pattern via fnmatch(3)
     if (0 == fnmatch(target_pattern, fpath + ftwbuf->base, 0))
+        report_match(fpath, sb, ftwbuf, NULL, 0);
+
+    return 0; // walk_tree: continue walk
+}
+
+/**
+ * Callback function for walk_tree.
+ * Reports entries with a basename that matches any glob of pattern_set,
+ * see report_match(). (-M test)
+ * @param fpath Path of current entry
+ * @param sb stat structure of current entry
+ * @param typeflag Type of file of the current entry
+ * @param ftwbuf Basename offset and tree level info
+ * @returns 0 to continue walk, non-zero to end walk
+ */
+int pattern_set_test(const char *fpath, const struct stat *sb, int typeflag,
+                     struct FTW *ftwbuf)
+{
+    PROBE2(sfind, entry, fpath, (typeflag != FTW_NS) ? sb->st_ino : 0);
+
+    // all globs in one pass over the basename
+    const size_t found =
+        globset_match(&pattern_set, fpath + ftwbuf->base, pattern_matches);
+    if (found != 0)
+        report_match(fpath, sb, ftwbuf, pattern_matches, found);
+
+    return 0; // walk_tree: continue walk
+}
+
+/**
+ * Reads the globs of -M into pattern_set, one per line, skipping blank
+ * lines and # comments, and compiles it.
+ * Exits on error.
+ */
+static void read_patterns(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    globset_init(&pattern_set);
+
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t length;
+    while (-1 != (length = getline(&line, &line_size, file)))
+    {
+        if (length > 0 && line[length - 1] == '\n')
+            line[--length] = '\0';
+        if (length == 0 || line[0] == '#')
+            continue;
+
+        if (-1 == globset_add(&pattern_set, line))
+        {
+            perror("globset_add()");
+            exit(EXIT_FAILURE);
+        }
+    }
+    free(line);
+
+    if (ferror(file))
+    {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    fclose(file);
+
+    if (pattern_set.count == 0)
+    {
+        fprintf(stderr, "%s: no globs\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    pattern_matches = malloc(pattern_set.count * sizeof(uint32_t));
+    if (pattern_matches == NULL || -1 == globset_compile(&pattern_set))
+    {
+        perror("globset_compile()");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Callback function for walk_tree.
+ * Records the paths of files with more than one link, in link_table.
+ * (-l test)
+ * @param fpath Path of current entry
+ * @param sb stat structure of current entry
+ * @param typeflag Type of file of the current entry
+ * @param ftwbuf Basename offset and tree level info
+ * @returns 0 to continue walk, non-zero to end walk
+ */
+int link_group_test(const char *fpath, const struct stat *sb, int typeflag,
+                    struct FTW *ftwbuf)
+{
+    PROBE2(sfind, entry, fpath, (typeflag != FTW_NS) ? sb->st_ino : 0);
+
+    // directories' link counts are their subdirectories, not hardlinks
+    if (typeflag == FTW_NS || S_ISDIR(sb->st_mode) || sb->st_nlink < 2)
+        return 0;
+
+    struct link_group *group = find_link_group(&link_table, sb);
+
+    const size_t length = strlen(fpath);
+    struct link_path *path =
+        arena_allocate(&path_arena, sizeof(struct link_path) + length + 1);
+    path->next = NULL;
+    memcpy(path->path, fpath, length + 1);
+
+    if (group->last == NULL)
+        group->first = path;
+    else
+        group->last->next = path;
+    group->last = path;
+    group->path_count++;
+
+    return 0; // walk_tree: continue walk
+}
+
+/**
+ * Callback function for walk_tree.
+ * Records files, anything but directories, in snapshot. (-S test)
+ * Exits on allocation failure.
+ * @param fpath Path of current entry
+ * @param sb stat structure of current entry
+ * @param typeflag Type of file of the current entry
+ * @param ftwbuf Basename offset and tree level info
+ * @returns 0 to continue walk, non-zero to end walk
+ */
+int snapshot_test(const char *fpath, const struct stat *sb, int typeflag,
+                  struct FTW *ftwbuf)
+{
+    PROBE2(sfind, entry, fpath, (typeflag != FTW_NS) ? sb->st_ino : 0);
+
+    // a directory changes with its entries, which are recorded themselves
+    if (typeflag == FTW_NS || S_ISDIR(sb->st_mode))
+        return 0;
+
+    if (-1 == snapshot_add(&snapshot, fpath, sb))
+    {
+        perror("snapshot_add()");
+        exit(EXIT_FAILURE);
+    }
+
+    return 0; // walk_tree: continue walk
+}
+
+/**
+ * Writes the snapshot of -S to a temporary file renamed over path, so the
+ * previous snapshot stays whole until the new one is.
+ * Exits on error.
+ */
+static void write_snapshot(const char *path)
+{
+    char temporary[PATH_MAX];
+    if (snprintf(temporary, sizeof(temporary), "%s.tmp", path) >=
+        (int)sizeof(temporary))
+    {
+        fprintf(stderr, "%s: path too long\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    const int fd =
+        open(temporary, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1 || -1 == snapshot_write(&snapshot, fd) || -1 == fsync(fd) ||
+        -1 == close(fd) || -1 == rename(temporary, path))
+    {
+        fprintf(stderr, "%s: %s\n", temporary, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    snapshot_free(&snapshot);
+}
+
+// -------------------------------- images ----------------------------------
+
+/**
+ * Test function for ext4_scan.
+ * Tests an entry of an image like -s, -m or -M test walked entries, on
+ * what the image's directories hold: its name and inode number.
+ * @returns true if the entry matches
+ */
+static bool image_test(const char *name, uint32_t inode, void *context)
+{
+    if (target_pattern != NULL)
+        return 0 == fnmatch(target_pattern, name, 0);
+    if (pattern_matches != NULL)
+        return 0 != globset_match(&pattern_set, name, pattern_matches);
+    return inode == target_inode;
+}
+
+/**
+ * Report function for ext4_scan.
+ * Prints a match of an image, see report_match(), with the globs of -M it
+ * matched.
+ */
+static void image_report(const char *path, uint32_t inode, void *context)
+{
+    size_t found = 0;
+    if (pattern_matches != NULL)
+        found = globset_match(&pattern_set, strrchr(path, '/') + 1,
+                              pattern_matches);
+    report_match(path, NULL, NULL, pattern_matches, found);
+}
+
+/**
+ * Searches an ext2/3/4 image for the matches of the test set up. (-x)
+ * Exits on error.
+ * @param target Path in the image of the -s file, NULL for other tests
+ */
+static void scan_image(const char *path, const char *target)
+{
+    struct ext4_image image;
+    if (-1 == ext4_open(&image, path))
+    {
+        if (errno == EINVAL)
+            fprintf(stderr, "%s: not an ext2/3/4 image\n", path);
+        else
+            fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    if (target != NULL)
+    {
+        uint32_t inode;
+        if (-1 == ext4_lookup(&image, target, &inode))
+        {
+            fprintf(stderr, "%s: %s: %s\n", path, target, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        target_inode = inode;
+    }
+
+    if (-1 == ext4_scan(&image, image_test, image_report, NULL))
     {
-        printf("%s\n", fpath);
+        if (errno == EINVAL)
+            fprintf(stderr, "%s: corrupt image\n", path);
+        else
+            fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
     }
 
-    return 0; // nftw: continue walk
+    ext4_close(&image);
 }
 
-int main(int argc, char *argv[])
+int MAIN(sfind)(int argc, char *argv[])
 {
     // ----------------------- command line processing -----------------------
 
@@ -92,11 +1223,28 @@ int main(int argc, char *argv[])
     char *s_arg = NULL;         // -s argument
     bool m_test = false;        // -m option
     char *m_arg = NULL;         // -m argument
+    char *pattern_file = NULL;  // -M argument
+    bool l_test = false;        // -l option
+    char *snapshot_file = NULL; // -S argument
+    char *diff_file = NULL;     // -D argument, the old snapshot
+    char *image_file = NULL;    // -x argument
+    long jobs = 0;              // -P argument
+    double rate = 0;            // -r argument
+    double latency = 0;         // -L argument
+    bool idle = false;          // -i option
+    bool ignore = false;        // -g option
+    long threads = 0;           // -t argument
+    char **command = NULL;      // -exec command
+    size_t command_count = 0;   // -exec command arguments
+    bool resume = false;        // --resume option
     bool supplied_dirs = false; // whether directories were supplied
 
+    // not options, getopt() would take them apart
+    take_actions(&argc, argv, &command, &command_count, &resume);
+
     while (true)
     {
-        option = getopt(argc, argv, ":s:m:");
+        option = getopt(argc, argv, ":s:m:M:lS:D:x:P:t:r:L:igc:");
         if (option == -1)
             break; // reached end of options
 
@@ -105,7 +1253,7 @@ int main(int argc, char *argv[])
         case 's':
             s_test = true;
             // save arg
-            s_arg = calloc(sizeof(char), strlen(optarg));
+            s_arg = calloc(sizeof(char), strlen(optarg) + 1);
             if (s_arg == NULL)
             {
                 fprintf(stderr, "calloc(): failed to allocate memory\n");
@@ -116,7 +1264,7 @@ int main(int argc, char *argv[])
         case 'm':
             m_test = true;
             // save arg
-            m_arg = calloc(sizeof(char), strlen(optarg));
+            m_arg = calloc(sizeof(char), strlen(optarg) + 1);
             if (m_arg == NULL)
             {
                 fprintf(stderr, "calloc(): failed to allocate memory\n");
@@ -124,6 +1272,66 @@ int main(int argc, char *argv[])
             }
             strncpy(m_arg, optarg, strlen(optarg));
             break;
+        case 'M':
+            pattern_file = optarg;
+            break;
+        case 'l':
+            l_test = true;
+            break;
+        case 'S':
+            snapshot_file = optarg;
+            break;
+        case 'D':
+            diff_file = optarg;
+            break;
+        case 'x':
+            image_file = optarg;
+            break;
+        case 'P':
+            errno = 0;
+            char *end;
+            jobs = strtol(optarg, &end, 10);
+            if (errno != 0 || *end != '\0' || jobs < 1)
+            {
+                fprintf(stderr, "Invalid number of jobs %s\n" USAGE, optarg,
+                        argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 't':
+            errno = 0;
+            char *threads_end;
+            threads = strtol(optarg, &threads_end, 10);
+            if (errno != 0 || *threads_end != '\0' || threads < 1 ||
+                threads > 1024)
+            {
+                fprintf(stderr, "Invalid number of threads %s\n" USAGE,
+                        optarg, argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'r':
+        case 'L':
+            errno = 0;
+            char *number_end;
+            double number = strtod(optarg, &number_end);
+            if (errno != 0 || *number_end != '\0' || !(number > 0))
+            {
+                fprintf(stderr, "Invalid number %s for %c\n" USAGE, optarg,
+                        option, argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            *((option == 'r') ? &rate : &latency) = number;
+            break;
+        case 'i':
+            idle = true;
+            break;
+        case 'g':
+            ignore = true;
+            break;
+        case 'c':
+            checkpoint_path = optarg;
+            break;
         case ':': // missing argument
             fprintf(stderr, "Missing argument for %c\n" USAGE, optopt,
                     argv[0]);
@@ -137,18 +1345,100 @@ int main(int argc, char *argv[])
     }
 
     // must have exactly one test
-    if (!s_test && !m_test || s_test && m_test)
+    const int tests = s_test + m_test + (pattern_file != NULL) + l_test +
+                      (snapshot_file != NULL) + (diff_file != NULL);
+    if (tests != 1)
     {
         fprintf(stderr, "Must provide exactly one test\n" USAGE, argv[0]);
         exit(EXIT_FAILURE);
     }
 
+    // the other tests don't report matches one by one
+    const bool matching = s_test || m_test || pattern_file != NULL;
+
+    if (!matching && action != ACTION_PRINT)
+    {
+        fprintf(stderr, "Actions only apply to -s, -m and -M\n" USAGE,
+                argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (jobs != 0 && action != ACTION_EXEC)
+    {
+        fprintf(stderr, "-P only applies to -exec\n" USAGE, argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (latency != 0 && rate == 0)
+    {
+        fprintf(stderr, "-L needs a rate to adapt, -r\n" USAGE, argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (!matching && checkpoint_path != NULL)
+    {
+        fprintf(stderr, "-c only checkpoints -s, -m and -M\n" USAGE,
+                argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (diff_file != NULL && optind + 1 != argc)
+    {
+        fprintf(stderr, "-D needs the old snapshot, then the new one\n" USAGE,
+                argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (image_file != NULL &&
+        (!matching || action != ACTION_PRINT || optind < argc ||
+         checkpoint_path != NULL || rate != 0 || ignore || threads != 0))
+    {
+        fprintf(stderr,
+                "-x only applies to -s, -m and -M, without directories, "
+                "actions, -c, -r, -g or -t\n" USAGE,
+                argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (resume && checkpoint_path == NULL)
+    {
+        fprintf(stderr, "--resume needs the checkpoint file, -c\n" USAGE,
+                argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
     supplied_dirs = optind < argc; // true if directories were supplied
 
+    // default to `.` if no directories supplied
+    static char *current_directory[] = {"."};
+    char **roots = (supplied_dirs) ? argv + optind : current_directory;
+    const int root_count = (supplied_dirs) ? argc - optind : 1;
+
+    // -D: no walk, only the two snapshots
+    if (diff_file != NULL)
+    {
+        outbuf_init(&output, STDOUT_FILENO);
+        if (-1 == snapshot_diff(diff_file, argv[optind], &output))
+        {
+            if (errno == EINVAL)
+                fprintf(stderr, "%s or %s: not a snapshot\n", diff_file,
+                        argv[optind]);
+            else
+                perror("snapshot_diff()");
+            exit(EXIT_FAILURE);
+        }
+        if (-1 == outbuf_close(&output))
+        {
+            perror("write()");
+            exit(EXIT_FAILURE);
+        }
+        return 0;
+    }
+
     // ----------------------- walking the directories -----------------------
 
     // setup
-    if (s_test)
+    if (s_test && image_file == NULL)
     { // -s: hardlink test
         // get inode number to match
         struct stat stat_result;
@@ -165,36 +1455,164 @@ int main(int argc, char *argv[])
     { // -m: basename test
         target_pattern = m_arg;
     }
+    else if (pattern_file != NULL)
+    { // -M: basename test against a glob set
+        read_patterns(pattern_file);
+    }
+
+    if (action == ACTION_EXEC)
+    {
+        exec_init(&exec_batch, command, command_count, jobs ? jobs : 1);
+        free(command);
+        command = NULL;
+    }
+
+    // before anything else does I/O, so -exec commands inherit it too
+    if (idle && -1 == io_priority_idle())
+    {
+        perror("ioprio_set()");
+        exit(EXIT_FAILURE);
+    }
+
+    // -x: no walk, the image is read in its own order
+    if (image_file != NULL)
+    {
+        outbuf_init(&output, STDOUT_FILENO);
+        scan_image(image_file, s_arg);
+        if (-1 == outbuf_close(&output))
+        {
+            perror("write()");
+            exit(EXIT_FAILURE);
+        }
+        return 0;
+    }
+
+    struct throttle throttle;
+    struct throttle *walk_throttle = NULL; // NULL if not throttled
+    if (rate != 0)
+    {
+        throttle_init(&throttle, rate, latency);
+        walk_throttle = &throttle;
+    }
+
+    struct walk_options options = {0};
+    options.throttle = walk_throttle;
+    options.ignore = ignore;
+    options.threads = threads;
+    walk_function test;
+
+    // a matched directory is deleted once the matches in it are
+    const int depth_first = (action == ACTION_DELETE) ? FTW_DEPTH : 0;
+
+    if (s_test)
+    { // -s: hardlink test
+        // don't follow symlinks
+        // don't cross mountpoints
+        test = hardlink_test;
+        options.flags = FTW_MOUNT | FTW_PHYS | depth_first;
+    }
+    else if (m_test)
+    { // -m: basename test
+        // don't follow symlinks
+        test = basename_test;
+        options.flags = FTW_PHYS | depth_first;
+    }
+    else if (pattern_file != NULL)
+    { // -M: basename test against a glob set
+        // don't follow symlinks
+        test = pattern_set_test;
+        options.flags = FTW_PHYS | depth_first;
+    }
+    else if (snapshot_file != NULL)
+    { // -S: snapshot, written after all directories are walked
+        // don't follow symlinks
+        // inodes are per device, don't cross mountpoints
+        snapshot_init(&snapshot);
+        test = snapshot_test;
+        options.flags = FTW_MOUNT | FTW_PHYS;
+    }
+    else
+    { // -l: hardlink groups, printed after all directories are walked
+        // don't follow symlinks
+        // groups are per device, so mountpoints can be crossed
+        test = link_group_test;
+        options.flags = FTW_PHYS;
+    }
+
+    outbuf_init(&output, STDOUT_FILENO);
+
+    // checkpoints
+    int first_root = 0;
+    char *frontier = NULL;
+    if (checkpoint_path != NULL)
+    {
+        if (resume)
+        {
+            struct checkpoint_header header;
+            frontier = read_checkpoint(roots, root_count, &header);
+            resume_output(&header);
+
+            first_root = header.root;
+            options.resume = frontier;
+            options.resume_length = header.frontier_length;
+        }
+
+        options.checkpoint = checkpoint_walk;
+        clock_gettime(CLOCK_MONOTONIC, &next_checkpoint);
+        next_checkpoint.tv_sec += CHECKPOINT_INTERVAL;
+        catch_stop_signals();
+    }
 
     // walk
-    do
-    {
-        if (s_test)
-        { // -s: hardlink test
-            // don't follow symlinks
-            // don't cross mountpoints
-            // default to `.` if no directories supplied
-            if (0 != nftw((supplied_dirs) ? argv[optind] : ".", hardlink_test,
-                          20, FTW_MOUNT | FTW_PHYS))
-            {
-                perror("nftw()");
-                exit(EXIT_FAILURE);
-            }
+    for (int root = first_root; root < root_count; root++)
+    {
+        checkpoint_root = root;
+        checkpoint_root_path = roots[root];
+
+        const int result = walk_tree_options(roots[root], test, &options);
+        if (result == 1 && stop_requested)
+        {
+            fprintf(stderr, "Interrupted, continue with --resume -c %s\n",
+                    checkpoint_path);
+            exit(EXIT_FAILURE);
         }
-        else if (m_test)
-        { // -m: basename test
-            // don't follow symlinks
-            // default to `.` if no directories supplied
-            if (0 != nftw((supplied_dirs) ? argv[optind] : ".", basename_test,
-                          20, FTW_PHYS))
-            {
-                perror("nftw()");
-                exit(EXIT_FAILURE);
-            }
+        if (result != 0)
+        {
+            perror("walk_tree()");
+            exit(EXIT_FAILURE);
         }
 
-        optind++;
-    } while (optind < argc);
+        // only the first directory resumes
+        options.resume = NULL;
+        free(frontier);
+        frontier = NULL;
+    }
+
+    // a finished walk has nothing to resume
+    if (checkpoint_path != NULL && -1 == unlink(checkpoint_path) &&
+        errno != ENOENT)
+    {
+        fprintf(stderr, "%s: %s\n", checkpoint_path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    if (l_test)
+        print_link_groups(&link_table, &path_arena);
+
+    if (snapshot_file != NULL)
+        write_snapshot(snapshot_file);
+
+    if (action == ACTION_EXEC)
+        exec_finish(&exec_batch);
+
+    if (walk_throttle != NULL)
+        throttle_free(walk_throttle);
+
+    if (-1 == outbuf_close(&output))
+    {
+        perror("write()");
+        exit(EXIT_FAILURE);
+    }
 
     if (m_test)
     {
@@ -203,5 +1621,12 @@ int main(int argc, char *argv[])
         target_pattern = NULL;
     }
 
-    return 0;
+    if (pattern_file != NULL)
+    {
+        globset_free(&pattern_set);
+        free(pattern_matches);
+        pattern_matches = NULL;
+    }
+
+    return action_failed ? EXIT_FAILURE : 0;
 }
\ No newline at end of file
@@ -0,0 +1,496 @@
+/**
+ * Title:         snapshot.c
+ * Description:   Sorted binary snapshots of a tree, and their differences
+ * Purpose:       See snapshot.h.
+ *                A snapshot file is a struct snapshot_header, the records
+ *                (a struct snapshot_record then the path, padded to 8
+ *                bytes), the offsets of the records in path order, which
+ *                is also their order in the file, then the inode index.
+ *                Everything is 8-byte aligned, so a mapped snapshot is read
+ *                in place. Paths are ordered bytewise, like strcmp(3).
+ *                Collecting a snapshot keeps all records in memory; only
+ *                the diff is bounded.
+ * Build with:    gcc -c snapshot.c
+ */
+
+#define _XOPEN_SOURCE 700
+#include "snapshot.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define SNAPSHOT_MAGIC "SFINDSN1"
+
+struct snapshot_header
+{
+    char magic[8]; // SNAPSHOT_MAGIC, without the NUL
+    uint64_t count;
+    uint64_t records_length;
+};
+
+struct snapshot_record
+{
+    uint64_t inode;
+    uint64_t size;
+    int64_t mtime_sec;
+    uint32_t mtime_nsec;
+    uint32_t path_length; // of the path that follows, without a NUL
+};
+
+struct inode_entry
+{
+    uint64_t inode;
+    uint64_t offset; // of the record, from the first record
+};
+
+/**
+ * A snapshot file mapped in memory.
+ */
+struct snapshot_map
+{
+    void *data;
+    size_t size;
+    uint64_t count;
+    const char *records;
+    uint64_t records_length;
+    const uint64_t *offsets;          // of the records, in path order
+    const struct inode_entry *inodes; // in inode, then path order
+};
+
+static size_t record_size(uint32_t path_length)
+{
+    return (sizeof(struct snapshot_record) + path_length + 7) / 8 * 8;
+}
+
+static const char *record_path(const struct snapshot_record *record)
+{
+    return (const char *)(record + 1);
+}
+
+static int compare_paths(const char *a, size_t a_length, const char *b,
+                         size_t b_length)
+{
+    const int result =
+        memcmp(a, b, (a_length < b_length) ? a_length : b_length);
+    if (result != 0)
+        return result;
+    return (a_length > b_length) - (a_length < b_length);
+}
+
+// -------------------------------- writing ---------------------------------
+
+void snapshot_init(struct snapshot *snapshot)
+{
+    memset(snapshot, 0, sizeof(struct snapshot));
+}
+
+int snapshot_add(struct snapshot *snapshot, const char *path,
+                 const struct stat *sb)
+{
+    const size_t path_length = strlen(path);
+    if (path_length > UINT32_MAX)
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    const size_t size = record_size(path_length);
+    if (snapshot->length + size > snapshot->size)
+    {
+        size_t new_size = (snapshot->size == 0) ? (1 << 16) : snapshot->size;
+        while (new_size < snapshot->length + size)
+            new_size *= 2;
+        char *records = realloc(snapshot->records, new_size);
+        if (records == NULL)
+            return -1;
+        snapshot->records = records;
+        snapshot->size = new_size;
+    }
+
+    char *at = snapshot->records + snapshot->length;
+    struct snapshot_record record = {sb->st_ino, sb->st_size,
+                                     sb->st_mtim.tv_sec, sb->st_mtim.tv_nsec,
+                                     path_length};
+    memset(at, 0, size); // padding
+    memcpy(at, &record, sizeof(record));
+    memcpy(at + sizeof(record), path, path_length);
+
+    snapshot->length += size;
+    snapshot->count++;
+    return 0;
+}
+
+static int compare_records(const void *a, const void *b)
+{
+    const struct snapshot_record *first =
+        *(const struct snapshot_record *const *)a;
+    const struct snapshot_record *second =
+        *(const struct snapshot_record *const *)b;
+    return compare_paths(record_path(first), first->path_length,
+                         record_path(second), second->path_length);
+}
+
+static int compare_inode_entries(const void *a, const void *b)
+{
+    const struct inode_entry *first = a;
+    const struct inode_entry *second = b;
+    if (first->inode != second->inode)
+        return (first->inode > second->inode) ? 1 : -1;
+    return (first->offset > second->offset) - (first->offset < second->offset);
+}
+
+int snapshot_write(struct snapshot *snapshot, int fd)
+{
+    const size_t count = snapshot->count;
+    const struct snapshot_record **sorted =
+        malloc(count * sizeof(struct snapshot_record *) + 1);
+    uint64_t *offsets = malloc(count * sizeof(uint64_t) + 1);
+    struct inode_entry *inodes = malloc(count * sizeof(struct inode_entry) + 1);
+    if (sorted == NULL || offsets == NULL || inodes == NULL)
+    {
+        free(sorted);
+        free(offsets);
+        free(inodes);
+        return -1;
+    }
+
+    size_t offset = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        sorted[i] =
+            (const struct snapshot_record *)(snapshot->records + offset);
+        offset += record_size(sorted[i]->path_length);
+    }
+    qsort(sorted, count, sizeof(struct snapshot_record *), compare_records);
+
+    struct snapshot_header header = {{0}, count, snapshot->length};
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+
+    struct outbuf output;
+    outbuf_init(&output, fd);
+    outbuf_write(&output, &header, sizeof(header));
+
+    offset = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        const size_t size = record_size(sorted[i]->path_length);
+        outbuf_write(&output, sorted[i], size);
+        offsets[i] = offset;
+        inodes[i].inode = sorted[i]->inode;
+        inodes[i].offset = offset;
+        offset += size;
+    }
+    qsort(inodes, count, sizeof(struct inode_entry), compare_inode_entries);
+
+    outbuf_write(&output, offsets, count * sizeof(uint64_t));
+    outbuf_write(&output, inodes, count * sizeof(struct inode_entry));
+    const int result = outbuf_close(&output);
+
+    const int saved_errno = errno;
+    free(sorted);
+    free(offsets);
+    free(inodes);
+    errno = saved_errno;
+    return result;
+}
+
+void snapshot_free(struct snapshot *snapshot)
+{
+    free(snapshot->records);
+    memset(snapshot, 0, sizeof(struct snapshot));
+}
+
+// -------------------------------- reading ---------------------------------
+
+/**
+ * The record at an offset of a mapped snapshot, NULL if it doesn't fit.
+ */
+static const struct snapshot_record *record_at(const struct snapshot_map *map,
+                                               uint64_t offset)
+{
+    if (offset % 8 != 0 || offset > map->records_length ||
+        map->records_length - offset < sizeof(struct snapshot_record))
+        return NULL;
+
+    const struct snapshot_record *record =
+        (const struct snapshot_record *)(map->records + offset);
+    if (record_size(record->path_length) > map->records_length - offset)
+        return NULL;
+    return record;
+}
+
+static void unmap_snapshot(struct snapshot_map *map)
+{
+    munmap(map->data, map->size);
+}
+
+/**
+ * Maps a snapshot file, checking that all its offsets point to records.
+ * @returns 0 on success, -1 with errno set on error, EINVAL if it isn't a
+ *          valid snapshot
+ */
+static int map_snapshot(const char *path, struct snapshot_map *map)
+{
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat status;
+    if (fd == -1 || fstat(fd, &status) == -1)
+    {
+        const int saved_errno = errno;
+        if (fd != -1)
+            close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+
+    if ((uint64_t)status.st_size < sizeof(struct snapshot_header))
+    {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    map->size = status.st_size;
+    map->data = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map->data == MAP_FAILED)
+        return -1;
+    posix_madvise(map->data, map->size, POSIX_MADV_SEQUENTIAL);
+
+    struct snapshot_header header;
+    memcpy(&header, map->data, sizeof(header));
+    const uint64_t body = map->size - sizeof(header);
+    const size_t index_entry = sizeof(uint64_t) + sizeof(struct inode_entry);
+
+    bool valid =
+        0 == memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) &&
+        header.records_length % 8 == 0 && header.records_length <= body &&
+        header.count == (body - header.records_length) / index_entry &&
+        (body - header.records_length) % index_entry == 0;
+
+    if (valid)
+    {
+        map->count = header.count;
+        map->records = (const char *)map->data + sizeof(header);
+        map->records_length = header.records_length;
+        map->offsets =
+            (const uint64_t *)(map->records + header.records_length);
+        map->inodes = (const struct inode_entry *)(map->offsets + map->count);
+
+        for (uint64_t i = 0; i < map->count && valid; i++)
+            valid = record_at(map, map->offsets[i]) != NULL &&
+                    record_at(map, map->inodes[i].offset) != NULL;
+    }
+
+    if (!valid)
+    {
+        unmap_snapshot(map);
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Tells if a snapshot has a path, by binary search of its offsets.
+ */
+static bool has_path(const struct snapshot_map *map, const char *path,
+                     size_t length)
+{
+    uint64_t low = 0;
+    uint64_t high = map->count;
+
+    while (low < high)
+    {
+        const uint64_t middle = low + (high - low) / 2;
+        const struct snapshot_record *record =
+            record_at(map, map->offsets[middle]);
+        const int order = compare_paths(record_path(record),
+                                        record->path_length, path, length);
+        if (order == 0)
+            return true;
+        if (order < 0)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return false;
+}
+
+/**
+ * First entry of an inode in a snapshot's inode index, by binary search.
+ * @returns its index, map->count if the inode isn't in the snapshot
+ */
+static uint64_t find_inode(const struct snapshot_map *map, uint64_t inode)
+{
+    uint64_t low = 0;
+    uint64_t high = map->count;
+
+    while (low < high)
+    {
+        const uint64_t middle = low + (high - low) / 2;
+        if (map->inodes[middle].inode < inode)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return (low < map->count && map->inodes[low].inode == inode) ? low
+                                                                  : map->count;
+}
+
+/**
+ * Tells if a record's path is only in its own snapshot.
+ */
+static bool unmatched(const struct snapshot_map *other,
+                      const struct snapshot_record *record)
+{
+    return !has_path(other, record_path(record), record->path_length);
+}
+
+/**
+ * Counts the paths of an inode, before a record in path order, that are
+ * only in their own snapshot: the rank of the record among them.
+ */
+static uint64_t unmatched_rank(const struct snapshot_map *map,
+                               const struct snapshot_map *other,
+                               uint64_t inode, uint64_t offset)
+{
+    uint64_t rank = 0;
+    for (uint64_t i = find_inode(map, inode);
+         i < map->count && map->inodes[i].inode == inode &&
+         map->inodes[i].offset < offset;
+         i++)
+        rank += unmatched(other, record_at(map, map->inodes[i].offset));
+    return rank;
+}
+
+/**
+ * Finds the path of an inode of a given rank among those only in their own
+ * snapshot, which pairs with the path of the same rank in the other.
+ * @returns its record, NULL if there are fewer
+ */
+static const struct snapshot_record *
+unmatched_link(const struct snapshot_map *map,
+               const struct snapshot_map *other, uint64_t inode,
+               uint64_t rank)
+{
+    for (uint64_t i = find_inode(map, inode);
+         i < map->count && map->inodes[i].inode == inode; i++)
+    {
+        const struct snapshot_record *record =
+            record_at(map, map->inodes[i].offset);
+        if (unmatched(other, record) && rank-- == 0)
+            return record;
+    }
+    return NULL;
+}
+
+/**
+ * Finds the path a record only in the old snapshot was renamed to, or the
+ * path a record only in the new one was renamed from: the path of its
+ * inode of the same rank, only in the other snapshot, of the same size
+ * and modification time, which a rename keeps.
+ * @returns its record, NULL if the record wasn't renamed
+ */
+static const struct snapshot_record *
+rename_pair(const struct snapshot_map *map, const struct snapshot_map *other,
+            const struct snapshot_record *record, uint64_t offset)
+{
+    const uint64_t rank = unmatched_rank(map, other, record->inode, offset);
+    const struct snapshot_record *pair =
+        unmatched_link(other, map, record->inode, rank);
+
+    if (pair == NULL || pair->size != record->size ||
+        pair->mtime_sec != record->mtime_sec ||
+        pair->mtime_nsec != record->mtime_nsec)
+        return NULL;
+    return pair;
+}
+
+/**
+ * Writes a line of the diff.
+ * @param renamed New path of a rename, NULL for other changes
+ */
+static void write_change(struct outbuf *output, char change,
+                         const struct snapshot_record *record,
+                         const struct snapshot_record *renamed)
+{
+    outbuf_char(output, change);
+    outbuf_char(output, '\t');
+    outbuf_write(output, record_path(record), record->path_length);
+    if (renamed != NULL)
+    {
+        outbuf_char(output, '\t');
+        outbuf_write(output, record_path(renamed), renamed->path_length);
+    }
+    outbuf_char(output, '\n');
+}
+
+int snapshot_diff(const char *old_path, const char *new_path,
+                  struct outbuf *output)
+{
+    struct snapshot_map old;
+    struct snapshot_map new;
+    if (map_snapshot(old_path, &old) == -1)
+        return -1;
+    if (map_snapshot(new_path, &new) == -1)
+    {
+        const int saved_errno = errno;
+        unmap_snapshot(&old);
+        errno = saved_errno;
+        return -1;
+    }
+
+    // merge join, in path order
+    uint64_t i = 0;
+    uint64_t j = 0;
+    while (i < old.count || j < new.count)
+    {
+        const struct snapshot_record *before =
+            (i < old.count) ? record_at(&old, old.offsets[i]) : NULL;
+        const struct snapshot_record *after =
+            (j < new.count) ? record_at(&new, new.offsets[j]) : NULL;
+
+        int order;
+        if (before == NULL)
+            order = 1;
+        else if (after == NULL)
+            order = -1;
+        else
+            order = compare_paths(record_path(before), before->path_length,
+                                  record_path(after), after->path_length);
+
+        if (order == 0)
+        { // in both
+            if (before->inode != after->inode ||
+                before->size != after->size ||
+                before->mtime_sec != after->mtime_sec ||
+                before->mtime_nsec != after->mtime_nsec)
+                write_change(output, 'M', before, NULL);
+            i++;
+            j++;
+        }
+        else if (order < 0)
+        { // only in the old snapshot: renamed, or deleted
+            const struct snapshot_record *renamed =
+                rename_pair(&old, &new, before, old.offsets[i]);
+            write_change(output, (renamed != NULL) ? 'R' : 'D', before,
+                         renamed);
+            i++;
+        }
+        else
+        { // only in the new snapshot: added, unless renamed from an old path
+            if (rename_pair(&new, &old, after, new.offsets[j]) == NULL)
+                write_change(output, 'A', after, NULL);
+            j++;
+        }
+    }
+
+    unmap_snapshot(&old);
+    unmap_snapshot(&new);
+    return 0;
+}
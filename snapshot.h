@@ -0,0 +1,85 @@
+/**
+ * Title:         snapshot.h
+ * Description:   Sorted binary snapshots of a tree, and their differences
+ * Purpose:       Tells what changed in a tree between two walks without a
+ *                database. A snapshot holds a record (path, inode, size,
+ *                modification time) for each file of a walk, sorted by
+ *                path, then two indexes: record offsets in path order, for
+ *                lookups by path, and (inode, offset) pairs in inode order,
+ *                for lookups by inode.
+ *                Two snapshots are compared by a merge join of their
+ *                records in path order, reading both once, front to back,
+ *                from memory maps. A path in both snapshots is modified if
+ *                its inode, size or modification time changed. A path only
+ *                in the old snapshot was renamed if its inode is, in the
+ *                new snapshot, at a path that is only there, with the same
+ *                size and modification time, which a rename keeps, and
+ *                deleted otherwise; a path only in the new snapshot was
+ *                added, unless it is such a rename's new path. The renames
+ *                are found with binary searches of the indexes, so a diff
+ *                takes no memory but the maps, whatever the size of the
+ *                trees.
+ *                Inode numbers are only meaningful on one file system. A
+ *                file renamed and then modified shows as deleted and
+ *                added, as does a new file that got the inode number of a
+ *                deleted one.
+ *                Snapshots are in native byte order, to be compared on the
+ *                host that wrote them.
+ * Usage:         struct snapshot snapshot;
+ *                snapshot_init(&snapshot);
+ *                snapshot_add(&snapshot, path, &sb) ...
+ *                if (snapshot_write(&snapshot, fd) == -1) perror(...) ...
+ *                snapshot_free(&snapshot);
+ *                if (snapshot_diff("old", "new", &output) == -1) ...
+ * Build with:    gcc -c snapshot.c
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "outbuf.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+/**
+ * A snapshot being collected, its records packed in one buffer.
+ */
+struct snapshot
+{
+    char *records;
+    size_t length; // bytes of records
+    size_t size;   // allocated size of records
+    uint64_t count;
+};
+
+void snapshot_init(struct snapshot *snapshot);
+
+/**
+ * Adds the record of a file.
+ * @returns 0 on success, -1 with errno set on error
+ */
+int snapshot_add(struct snapshot *snapshot, const char *path,
+                 const struct stat *sb);
+
+/**
+ * Sorts the records and writes the snapshot.
+ * @returns 0 on success, -1 with errno set on error
+ */
+int snapshot_write(struct snapshot *snapshot, int fd);
+
+void snapshot_free(struct snapshot *snapshot);
+
+/**
+ * Compares two snapshots, writing a line per change in path order, like
+ * `git diff --name-status`: `A\tpath` for an added file, `D\tpath` for a
+ * deleted one, `M\tpath` for a modified one, `R\told path\tnew path` for a
+ * renamed one.
+ * @returns 0 on success, -1 with errno set on error, EINVAL if a file isn't
+ *          a valid snapshot
+ */
+int snapshot_diff(const char *old_path, const char *new_path,
+                  struct outbuf *output);
+
+#endif
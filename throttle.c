@@ -0,0 +1,136 @@
+/**
+ * Title:         throttle.c
+ * Description:   Rate limit for file system operations, adapting to latency
+ * Purpose:       See throttle.h.
+ *                The bucket holds at most a tenth of a second of tokens, so
+ *                an idle walk can't save up a burst. A thread that finds it
+ *                empty takes its token anyway, putting the bucket in debt,
+ *                and sleeps until the debt is paid back by the refill; the
+ *                threads queue up without holding the lock while asleep.
+ * Build with:    gcc -c throttle.c -pthread
+ */
+
+#define _GNU_SOURCE
+#include "throttle.h"
+
+#include <errno.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define IOPRIO_CLASS_IDLE 3 // from linux/ioprio.h, not in glibc
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_WHO_PROCESS 1
+
+static int64_t elapsed_ns(struct timespec from, struct timespec to)
+{
+    return (int64_t)(to.tv_sec - from.tv_sec) * 1000000000 +
+           (to.tv_nsec - from.tv_nsec);
+}
+
+static struct timespec add_ns(struct timespec time, int64_t ns)
+{
+    time.tv_sec += ns / 1000000000;
+    time.tv_nsec += ns % 1000000000;
+    if (time.tv_nsec >= 1000000000)
+    {
+        time.tv_sec++;
+        time.tv_nsec -= 1000000000;
+    }
+    return time;
+}
+
+void throttle_init(struct throttle *throttle, double rate, double target_ms)
+{
+    pthread_mutex_init(&throttle->lock, NULL);
+    throttle->max_rate = rate;
+    throttle->rate = rate;
+    throttle->tokens = rate / 10;
+    clock_gettime(CLOCK_MONOTONIC, &throttle->refilled);
+
+    throttle->target_ns = target_ms * 1000000;
+    throttle->window_latency_ns = 0;
+    throttle->window_count = 0;
+    throttle->window_end = add_ns(throttle->refilled, THROTTLE_WINDOW_NS);
+}
+
+void throttle_acquire(struct throttle *throttle)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    pthread_mutex_lock(&throttle->lock);
+
+    const double burst = (throttle->rate / 10 < 1) ? 1 : throttle->rate / 10;
+    throttle->tokens +=
+        elapsed_ns(throttle->refilled, now) * throttle->rate / 1e9;
+    if (throttle->tokens > burst)
+        throttle->tokens = burst;
+    throttle->refilled = now;
+
+    throttle->tokens -= 1;
+    const double debt = -throttle->tokens;
+    const double rate = throttle->rate;
+
+    pthread_mutex_unlock(&throttle->lock);
+
+    if (debt > 0)
+    { // sleep until the refill has paid for this token
+        const struct timespec wake = add_ns(now, debt / rate * 1e9);
+        while (EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake,
+                                        NULL))
+            ;
+    }
+}
+
+void throttle_record(struct throttle *throttle, int64_t latency_ns)
+{
+    if (throttle->target_ns == 0)
+        return;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    pthread_mutex_lock(&throttle->lock);
+
+    throttle->window_latency_ns += latency_ns;
+    throttle->window_count++;
+
+    if (elapsed_ns(throttle->window_end, now) >= 0)
+    {
+        const int64_t mean =
+            throttle->window_latency_ns / throttle->window_count;
+        double floor = throttle->max_rate / 1000;
+        if (floor < 1)
+            floor = (throttle->max_rate < 1) ? throttle->max_rate : 1;
+
+        if (mean > throttle->target_ns)
+        { // multiplicative decrease
+            throttle->rate /= 2;
+            if (throttle->rate < floor)
+                throttle->rate = floor;
+        }
+        else
+        { // additive increase
+            throttle->rate += throttle->max_rate / 20;
+            if (throttle->rate > throttle->max_rate)
+                throttle->rate = throttle->max_rate;
+        }
+
+        throttle->window_latency_ns = 0;
+        throttle->window_count = 0;
+        throttle->window_end = add_ns(now, THROTTLE_WINDOW_NS);
+    }
+
+    pthread_mutex_unlock(&throttle->lock);
+}
+
+void throttle_free(struct throttle *throttle)
+{
+    pthread_mutex_destroy(&throttle->lock);
+}
+
+int io_priority_idle(void)
+{
+    return syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+                   IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+}
@@ -0,0 +1,77 @@
+/**
+ * Title:         throttle.h
+ * Description:   Rate limit for file system operations, adapting to latency
+ * Purpose:       Keeps a long tree walk from starving other I/O of a shared
+ *                host. A token bucket caps the operations per second (a
+ *                directory read or a stat call each); it can be shared by
+ *                several threads. With a latency target, the rate adapts
+ *                like TCP's congestion window (AIMD): every window of
+ *                operations, the rate is halved if their mean latency was
+ *                over the target, and raised by a twentieth of the cap if
+ *                it was under, so the walk backs off while the disk is
+ *                busy and speeds up again when it is idle.
+ *                io_priority_idle() puts the process in the idle I/O
+ *                scheduling class, where its I/O is only served when no one
+ *                else needs the disk (CFQ and BFQ schedulers).
+ * Usage:         struct throttle throttle;
+ *                throttle_init(&throttle, 500, 20); // 500/s, 20 ms target
+ *                throttle_acquire(&throttle);
+ *                ... timed operation ...
+ *                throttle_record(&throttle, latency_ns);
+ *                throttle_free(&throttle);
+ * Build with:    gcc -c throttle.c -pthread
+ */
+
+#ifndef THROTTLE_H
+#define THROTTLE_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+#define THROTTLE_WINDOW_NS 100000000 // 100 ms of operations per adaptation
+
+struct throttle
+{
+    pthread_mutex_t lock;
+    double max_rate; // operations per second, the cap
+    double rate;     // operations per second now, at most max_rate
+    double tokens;   // operations allowed now, negative when in debt to
+                     // sleeping threads
+    struct timespec refilled; // when tokens were last added
+
+    int64_t target_ns;          // mean latency to stay under, 0 to not adapt
+    int64_t window_latency_ns;  // latency of the window's operations
+    long window_count;          // operations in the window
+    struct timespec window_end; // when the rate is next adjusted
+};
+
+/**
+ * Sets up a throttle, full, at the cap.
+ * @param rate Most operations per second
+ * @param target_ms Mean operation latency to adapt the rate to, 0 to keep
+ *                  it at the cap
+ */
+void throttle_init(struct throttle *throttle, double rate, double target_ms);
+
+/**
+ * Takes a token, sleeping until one is available.
+ */
+void throttle_acquire(struct throttle *throttle);
+
+/**
+ * Accounts for the latency of an operation, adapting the rate once per
+ * window. Does nothing without a latency target.
+ */
+void throttle_record(struct throttle *throttle, int64_t latency_ns);
+
+void throttle_free(struct throttle *throttle);
+
+/**
+ * Moves the calling process to the idle I/O scheduling class, inherited by
+ * the threads and processes it then creates.
+ * @returns 0 on success, -1 with errno set on error
+ */
+int io_priority_idle(void);
+
+#endif
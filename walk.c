@@ -0,0 +1,1238 @@
+/**
+ * Title:         walk.c
+ * Description:   Directory tree walk in inode order, a replacement for nftw
+ * Purpose:       See walk.h.
+ *                Pending directories are kept on a stack, their paths
+ *                packed in one buffer that grows and shrinks with it. The
+ *                subdirectories of a directory are pushed once all its
+ *                entries were stat'ed, in reverse inode order, so they are
+ *                popped in inode order.
+ *                A saved frontier is the device of the root, then each
+ *                pending directory from the bottom of the stack: a struct
+ *                frontier_entry and the path. It is only read back by the
+ *                same build on the same host, so it is in native byte
+ *                order. Pending directories are stat'ed again on resume.
+ *                With ignore files, each pending directory holds a
+ *                reference to the rules of its parent. Entries are matched
+ *                against them before they are stat'ed, when readdir(3)
+ *                gives their type, so an ignored directory is never opened
+ *                and an ignored file never stat'ed. A resumed directory
+ *                gets its rules by reading its ancestors' files again.
+ *                A directory of more than WALK_BATCH_ENTRIES entries, with
+ *                threads, is read in batches of that many instead of in
+ *                full. Each batch is sorted by inode and put in a ring of
+ *                WALK_BATCHES for the threads, which claim WALK_CHUNK
+ *                entries at a time to stat. The walking thread reads the
+ *                next batches meanwhile, and reports the oldest batch once
+ *                it is stat'ed, so callbacks are still called from the
+ *                walking thread only, in batch order.
+ * Build with:    gcc -c walk.c -pthread
+ */
+
+#define _XOPEN_SOURCE 700
+#define _DEFAULT_SOURCE // DT_* types of struct dirent
+#include "walk.h"
+#include "ignore.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define WALK_BATCHES 4 // batches read ahead of the reported one
+#define WALK_CHUNK 64  // entries a thread stats at a time
+
+#define SKIPPED -2 // examine_entry(): entry not reported
+
+/**
+ * An entry read from a directory, before it is stat'ed.
+ */
+struct entry
+{
+    ino_t inode;
+    size_t name;        // offset in its listing's names
+    unsigned char type; // d_type, DT_UNKNOWN if the file system doesn't say
+};
+
+/**
+ * Entries read from a directory, sorted by inode.
+ */
+struct listing
+{
+    struct entry *entries;
+    size_t count;
+    size_t capacity;
+    char *names; // null terminated names of entries
+    size_t names_length;
+    size_t names_size;
+};
+
+/**
+ * A subdirectory found while reading a directory, pushed once all entries
+ * were stat'ed.
+ */
+struct subdirectory
+{
+    size_t name; // offset in walk.subdirectory_names
+    struct stat sb;
+};
+
+/**
+ * Entries of a large directory, stat'ed by the threads of a stat_pool.
+ */
+struct batch
+{
+    struct listing listing;
+    struct stat *stats; // per entry
+    int *typeflags;     // per entry, from examine_entry()
+    size_t capacity;    // of stats and typeflags
+    size_t claimed;     // entries taken by a thread
+    size_t finished;    // entries stat'ed
+    int error;          // errno of an entry that failed
+};
+
+/**
+ * Threads stat'ing the batches of the large directory being read.
+ * Everything but the threads is guarded by lock.
+ */
+struct stat_pool
+{
+    pthread_t *threads;
+    int thread_count;
+    pthread_mutex_t lock;
+    pthread_cond_t work;     // a batch was added, or stop was set
+    pthread_cond_t finished; // a batch was stat'ed
+    bool stop;
+
+    struct batch batches[WALK_BATCHES]; // a ring
+    size_t first;                       // oldest batch
+    size_t count;                       // batches in the ring
+
+    // the directory being read, set while no batch is in the ring
+    struct walk *walk;
+    int fd;
+    const char *path;
+    struct ignore_rules *rules;
+};
+
+/**
+ * A directory waiting to be read, with its stat data, reported when read.
+ */
+struct pending
+{
+    size_t path; // offset in walk.pending_paths
+    int base;    // offset of the basename in the path
+    int level;   // depth below the root
+    bool post;   // read already, to report as FTW_DP (FTW_DEPTH)
+    struct stat sb;
+    struct ignore_rules *rules; // a reference to the rules of the parent,
+                                // NULL for none
+};
+
+/**
+ * What a callback gets as its struct FTW, with the directory descriptor
+ * behind walk_directory_fd().
+ */
+struct walk_ftw
+{
+    struct FTW ftw; // first, a struct FTW * points to the struct walk_ftw
+    const char *path;
+    int directory_fd; // -1 until opened, if the walk has none open
+    bool opened;      // directory_fd was opened for the callback
+};
+
+/**
+ * Header of a pending directory in a saved frontier, followed by its path.
+ */
+struct frontier_entry
+{
+    int32_t base;
+    int32_t level;
+    uint32_t post;
+    uint32_t length; // of the path, without a terminating null
+};
+
+struct walk
+{
+    walk_function fn;
+    int flags;
+    struct throttle *throttle; // NULL if not throttled
+    bool ignore;               // skip what ignore files ignore
+    int threads;               // for large directories, 0 or 1 for none
+    struct stat_pool *pool;    // started at the first large directory
+    dev_t device; // of the root, for FTW_MOUNT
+
+    char *path; // path of the current entry
+    size_t path_size;
+
+    struct listing listing; // of the directory being read, or its first
+                            // batch if large
+    struct subdirectory *subdirectories; // of the directory being read
+    size_t subdirectory_count;
+    size_t subdirectory_capacity;
+    char *subdirectory_names; // null terminated
+    size_t subdirectory_names_length;
+    size_t subdirectory_names_size;
+
+    struct pending *pending; // stack of directories to read
+    size_t pending_count;
+    size_t pending_capacity;
+    char *pending_paths; // null terminated paths of pending directories
+    size_t pending_paths_length;
+    size_t pending_paths_size;
+};
+
+// -------------------------------- buffers ---------------------------------
+
+/**
+ * Grows an array to hold at least count elements.
+ * @returns 0 on success, -1 with errno set on error
+ */
+static int reserve(void **array, size_t *capacity, size_t count,
+                   size_t element_size)
+{
+    if (count <= *capacity)
+        return 0;
+
+    size_t new_capacity = (*capacity == 0) ? 64 : *capacity;
+    while (new_capacity < count)
+        new_capacity *= 2;
+
+    void *grown = realloc(*array, new_capacity * element_size);
+    if (grown == NULL)
+        return -1;
+
+    *array = grown;
+    *capacity = new_capacity;
+    return 0;
+}
+
+/**
+ * Sets a path buffer to directory/name.
+ * @returns offset of name in the path, -1 with errno set on error
+ */
+static int join_path(char **path, size_t *path_size, const char *directory,
+                     size_t directory_length, const char *name)
+{
+    const size_t name_length = strlen(name);
+    const bool slash =
+        directory_length > 0 && directory[directory_length - 1] != '/';
+    const size_t length = directory_length + slash + name_length;
+
+    if (reserve((void **)path, path_size, length + 1, 1) == -1)
+        return -1;
+
+    memmove(*path, directory, directory_length);
+    if (slash)
+        (*path)[directory_length] = '/';
+    memcpy(*path + directory_length + slash, name, name_length + 1);
+
+    return directory_length + slash;
+}
+
+/**
+ * Sets the current path to directory/name.
+ * @returns offset of name in the path, -1 with errno set on error
+ */
+static int set_path(struct walk *walk, const char *directory,
+                    size_t directory_length, const char *name)
+{
+    return join_path(&walk->path, &walk->path_size, directory,
+                     directory_length, name);
+}
+
+/**
+ * Pushes the current path as a directory to read later.
+ * @param rules Ignore rules of its parent, for which it takes a reference
+ * @returns 0 on success, -1 with errno set on error
+ */
+static int push_directory(struct walk *walk, int base, int level, bool post,
+                          const struct stat *sb, struct ignore_rules *rules)
+{
+    const size_t length = strlen(walk->path) + 1;
+
+    if (reserve((void **)&walk->pending, &walk->pending_capacity,
+                walk->pending_count + 1, sizeof(struct pending)) == -1 ||
+        reserve((void **)&walk->pending_paths, &walk->pending_paths_size,
+                walk->pending_paths_length + length, 1) == -1)
+        return -1;
+
+    struct pending *pending = &walk->pending[walk->pending_count++];
+    pending->path = walk->pending_paths_length;
+    pending->base = base;
+    pending->level = level;
+    pending->post = post;
+    pending->sb = *sb;
+    pending->rules = ignore_retain(rules);
+
+    memcpy(walk->pending_paths + walk->pending_paths_length, walk->path,
+           length);
+    walk->pending_paths_length += length;
+    return 0;
+}
+
+// ------------------------------- throttling -------------------------------
+
+/**
+ * Waits for the throttle, if any, before an operation.
+ * @returns when the operation started, for throttle_end()
+ */
+static struct timespec throttle_begin(struct walk *walk)
+{
+    struct timespec start = {0, 0};
+
+    if (walk->throttle != NULL)
+    {
+        throttle_acquire(walk->throttle);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+    }
+    return start;
+}
+
+/**
+ * Reports the latency of an operation to the throttle, if any.
+ * Leaves errno as it was.
+ */
+static void throttle_end(struct walk *walk, struct timespec start)
+{
+    if (walk->throttle == NULL)
+        return;
+
+    const int saved_errno = errno;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    throttle_record(walk->throttle,
+                    (int64_t)(end.tv_sec - start.tv_sec) * 1000000000 +
+                        (end.tv_nsec - start.tv_nsec));
+    errno = saved_errno;
+}
+
+// -------------------------------- walking ---------------------------------
+
+int walk_directory_fd(struct FTW *ftwbuf)
+{
+    struct walk_ftw *info = (struct walk_ftw *)ftwbuf;
+
+    if (info->directory_fd == -1)
+    {
+        if (ftwbuf->base == 0)
+            return AT_FDCWD; // a root relative to the working directory
+
+        char *parent = strndup(info->path, ftwbuf->base);
+        if (parent == NULL)
+            return -1;
+        info->directory_fd = open(parent, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        info->opened = info->directory_fd != -1;
+        free(parent);
+    }
+
+    return info->directory_fd;
+}
+
+/**
+ * Calls the callback for an entry.
+ * @param directory_fd Open directory containing the entry, -1 if none is
+ * @returns the callback's return value
+ */
+static int report(struct walk *walk, const char *path,
+                  const struct stat *sb, int typeflag, int base, int level,
+                  int directory_fd)
+{
+    struct walk_ftw info = {{base, level}, path, directory_fd, false};
+
+    const int result = walk->fn(path, sb, typeflag, &info.ftw);
+
+    if (info.opened)
+        close(info.directory_fd);
+    return result;
+}
+
+static int compare_inodes(const void *a, const void *b)
+{
+    const ino_t first = ((const struct entry *)a)->inode;
+    const ino_t second = ((const struct entry *)b)->inode;
+    return (first > second) - (first < second);
+}
+
+/**
+ * Reads entries of an open directory into a listing, then sorts them by
+ * inode number.
+ * @param limit Most entries to read
+ * @returns 0 if the directory was read to its end, 1 if there are more
+ *          entries, -1 with errno set on error
+ */
+static int read_entries(struct listing *listing, DIR *directory,
+                        size_t limit)
+{
+    listing->count = 0;
+    listing->names_length = 0;
+
+    int result = 0;
+    while (true)
+    {
+        if (listing->count == limit)
+        {
+            result = 1;
+            break;
+        }
+
+        errno = 0;
+        const struct dirent *dirent = readdir(directory);
+        if (dirent == NULL)
+        {
+            if (errno != 0)
+                return -1;
+            break;
+        }
+
+        const char *name = dirent->d_name;
+        if (name[0] == '.' &&
+            (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+            continue;
+
+        const size_t length = strlen(name) + 1;
+        if (reserve((void **)&listing->entries, &listing->capacity,
+                    listing->count + 1, sizeof(struct entry)) == -1 ||
+            reserve((void **)&listing->names, &listing->names_size,
+                    listing->names_length + length, 1) == -1)
+            return -1;
+
+        struct entry *entry = &listing->entries[listing->count++];
+        entry->inode = dirent->d_ino;
+        entry->name = listing->names_length;
+        entry->type = dirent->d_type;
+        memcpy(listing->names + listing->names_length, name, length);
+        listing->names_length += length;
+    }
+
+    qsort(listing->entries, listing->count, sizeof(struct entry),
+          compare_inodes);
+    return result;
+}
+
+static void free_listing(struct listing *listing)
+{
+    free(listing->entries);
+    free(listing->names);
+    memset(listing, 0, sizeof(struct listing));
+}
+
+/**
+ * Stats a path, relative to a directory, following symbolic links unless
+ * FTW_PHYS.
+ * @returns the FTW_* type flag, or -1 with errno set if the entry vanished
+ *          or can't be stat'ed for another reason than permissions
+ */
+static int stat_entry(const struct walk *walk, int directory_fd,
+                      const char *name, struct stat *sb)
+{
+    const int stat_flags = (walk->flags & FTW_PHYS) ? AT_SYMLINK_NOFOLLOW : 0;
+
+    if (fstatat(directory_fd, name, sb, stat_flags) == -1)
+    {
+        if (errno == ENOENT && !(walk->flags & FTW_PHYS) &&
+            fstatat(directory_fd, name, sb, AT_SYMLINK_NOFOLLOW) == 0)
+            return FTW_SLN; // dangling symbolic link
+
+        if (errno != EACCES)
+            return -1;
+        memset(sb, 0, sizeof(struct stat));
+        return FTW_NS;
+    }
+
+    if (S_ISDIR(sb->st_mode))
+        return FTW_D;
+    if (S_ISLNK(sb->st_mode))
+        return FTW_SL;
+    return FTW_F;
+}
+
+/**
+ * Reads the ignore files of an open directory, on top of the rules it is
+ * under.
+ * @param rules Rules the directory is under, a reference the walk holds,
+ *              replaced by the directory's own rules if it has any
+ * @param listed Only read the files among the entries of walk->listing,
+ *               the whole directory, instead of trying them all
+ * @returns 0 on success, -1 with errno set on error
+ */
+static int read_ignore_files(struct walk *walk, int fd, const char *path,
+                             bool listed, struct ignore_rules **rules)
+{
+    const size_t length = strlen(path);
+    const size_t prefix_length =
+        length + (length > 0 && path[length - 1] != '/');
+    const struct listing *listing = &walk->listing;
+
+    for (int i = 0; i < IGNORE_FILE_COUNT; i++)
+    {
+        bool present = !listed;
+        for (size_t j = 0; j < listing->count && !present; j++)
+            present = 0 == strcmp(listing->names + listing->entries[j].name,
+                                  ignore_files[i]);
+
+        if (present &&
+            ignore_read(rules, fd, ignore_files[i], prefix_length) == -1)
+            return -1;
+    }
+    return 0;
+}
+
+/**
+ * Stats an entry of the directory being read, unless it is left out: an
+ * ignored entry, one on another file system with FTW_MOUNT, or one removed
+ * since the directory was read. Only reads the walk, so threads can
+ * examine entries at once.
+ * @param path Path of the entry
+ * @param base Offset of its name in path
+ * @param rules Ignore rules of the entries of the directory
+ * @returns the FTW_* type flag, SKIPPED to leave the entry out, or -1 with
+ *          errno set on error
+ */
+static int examine_entry(struct walk *walk, int fd, const char *path,
+                         int base, const struct entry *entry,
+                         const struct ignore_rules *rules, struct stat *sb)
+{
+    // pruned before any I/O when readdir(3) told the type
+    if (walk->ignore && entry->type != DT_UNKNOWN &&
+        ignore_match(rules, path, base, entry->type == DT_DIR))
+        return SKIPPED;
+
+    const struct timespec start = throttle_begin(walk);
+    const int typeflag = stat_entry(walk, fd, path + base, sb);
+    throttle_end(walk, start);
+    if (typeflag == -1)
+        return (errno == ENOENT) ? SKIPPED : -1;
+
+    if (walk->ignore && entry->type == DT_UNKNOWN &&
+        ignore_match(rules, path, base, typeflag == FTW_D))
+        return SKIPPED;
+
+    if ((walk->flags & FTW_MOUNT) && typeflag != FTW_NS &&
+        sb->st_dev != walk->device)
+        return SKIPPED; // another file system
+
+    return typeflag;
+}
+
+/**
+ * Reports an examined entry at the current path, or keeps it to push if it
+ * is a directory.
+ * @returns 0 to continue, the callback's non-zero return value, or -1 with
+ *          errno set on error
+ */
+static int take_entry(struct walk *walk, int fd, int base, int level,
+                      int typeflag, const struct stat *sb)
+{
+    if (typeflag != FTW_D)
+        return report(walk, walk->path, sb, typeflag, base, level, fd);
+
+    // reported when read
+    const char *name = walk->path + base;
+    const size_t length = strlen(name) + 1;
+    if (reserve((void **)&walk->subdirectories, &walk->subdirectory_capacity,
+                walk->subdirectory_count + 1,
+                sizeof(struct subdirectory)) == -1 ||
+        reserve((void **)&walk->subdirectory_names,
+                &walk->subdirectory_names_size,
+                walk->subdirectory_names_length + length, 1) == -1)
+        return -1;
+
+    struct subdirectory *subdirectory =
+        &walk->subdirectories[walk->subdirectory_count++];
+    subdirectory->name = walk->subdirectory_names_length;
+    subdirectory->sb = *sb;
+    memcpy(walk->subdirectory_names + walk->subdirectory_names_length, name,
+           length);
+    walk->subdirectory_names_length += length;
+    return 0;
+}
+
+// ---------------------------- large directories ---------------------------
+
+/**
+ * Stats the entries of the batches in the ring, a chunk at a time, until
+ * the pool is stopped.
+ */
+static void *stat_worker(void *argument)
+{
+    struct stat_pool *pool = argument;
+    char *path = NULL; // of the entry being stat'ed
+    size_t path_size = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    while (true)
+    {
+        struct batch *batch = NULL;
+        for (size_t i = 0; i < pool->count && batch == NULL; i++)
+        {
+            struct batch *candidate =
+                &pool->batches[(pool->first + i) % WALK_BATCHES];
+            if (candidate->claimed < candidate->listing.count)
+                batch = candidate;
+        }
+
+        if (batch == NULL)
+        {
+            if (pool->stop)
+                break;
+            pthread_cond_wait(&pool->work, &pool->lock);
+            continue;
+        }
+
+        const size_t begin = batch->claimed;
+        size_t end = begin + WALK_CHUNK;
+        if (end > batch->listing.count)
+            end = batch->listing.count;
+        batch->claimed = end;
+        pthread_mutex_unlock(&pool->lock);
+
+        int error = 0;
+        const size_t path_length = strlen(pool->path);
+        for (size_t i = begin; i < end; i++)
+        {
+            const struct entry *entry = &batch->listing.entries[i];
+            const int base =
+                join_path(&path, &path_size, pool->path, path_length,
+                          batch->listing.names + entry->name);
+
+            batch->typeflags[i] =
+                (base == -1) ? -1
+                             : examine_entry(pool->walk, pool->fd, path, base,
+                                             entry, pool->rules,
+                                             &batch->stats[i]);
+            if (batch->typeflags[i] == -1)
+                error = errno;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        if (error != 0)
+            batch->error = error;
+        batch->finished += end - begin;
+        if (batch->finished == batch->listing.count)
+            pthread_cond_broadcast(&pool->finished);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    free(path);
+    return NULL;
+}
+
+/**
+ * Stops the threads of a pool and frees it.
+ */
+static void stop_pool(struct stat_pool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->thread_count; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    for (int i = 0; i < WALK_BATCHES; i++)
+    {
+        free_listing(&pool->batches[i].listing);
+        free(pool->batches[i].stats);
+        free(pool->batches[i].typeflags);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work);
+    pthread_cond_destroy(&pool->finished);
+    free(pool->threads);
+    free(pool);
+}
+
+/**
+ * Starts the stat threads of a walk, if not started yet.
+ * @returns 0 on success, -1 with errno set on error
+ */
+static int start_pool(struct walk *walk)
+{
+    if (walk->pool != NULL)
+        return 0;
+
+    struct stat_pool *pool = calloc(1, sizeof(struct stat_pool));
+    if (pool == NULL)
+        return -1;
+    pool->threads = malloc(walk->threads * sizeof(pthread_t));
+    if (pool->threads == NULL)
+    {
+        free(pool);
+        return -1;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->finished, NULL);
+    pool->walk = walk;
+
+    for (int i = 0; i < walk->threads; i++)
+    {
+        const int error =
+            pthread_create(&pool->threads[i], NULL, stat_worker, pool);
+        if (error != 0)
+        {
+            stop_pool(pool);
+            errno = error;
+            return -1;
+        }
+        pool->thread_count++;
+    }
+
+    walk->pool = pool;
+    return 0;
+}
+
+/**
+ * Waits until the threads have stat'ed the oldest batch of the ring.
+ */
+static void wait_batch(struct stat_pool *pool)
+{
+    struct batch *batch = &pool->batches[pool->first];
+
+    pthread_mutex_lock(&pool->lock);
+    while (batch->finished < batch->listing.count)
+        pthread_cond_wait(&pool->finished, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * Removes the oldest batch from the ring, once stat'ed.
+ */
+static void drop_batch(struct stat_pool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->first = (pool->first + 1) % WALK_BATCHES;
+    pool->count--;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * Reads the next batch of a large directory into the ring, for the threads
+ * to stat. The first batch was read into walk->listing already.
+ * @returns 0 if the directory was read to its end, 1 if there are more
+ *          entries, -1 with errno set on error
+ */
+static int add_batch(struct walk *walk, DIR *directory, bool first)
+{
+    struct stat_pool *pool = walk->pool;
+    struct batch *batch =
+        &pool->batches[(pool->first + pool->count) % WALK_BATCHES];
+
+    int result = 1;
+    if (first)
+    { // swapped, so walk->listing keeps a buffer to reuse
+        const struct listing listing = batch->listing;
+        batch->listing = walk->listing;
+        walk->listing = listing;
+    }
+    else
+    { // each batch read is a throttled operation
+        const struct timespec start = throttle_begin(walk);
+        result = read_entries(&batch->listing, directory, WALK_BATCH_ENTRIES);
+        throttle_end(walk, start);
+        if (result == -1)
+            return -1;
+    }
+
+    if (batch->capacity < batch->listing.count)
+    {
+        struct stat *stats =
+            realloc(batch->stats, batch->listing.count * sizeof(struct stat));
+        if (stats == NULL)
+            return -1;
+        batch->stats = stats;
+
+        int *typeflags =
+            realloc(batch->typeflags, batch->listing.count * sizeof(int));
+        if (typeflags == NULL)
+            return -1;
+        batch->typeflags = typeflags;
+        batch->capacity = batch->listing.count;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    batch->claimed = 0;
+    batch->finished = 0;
+    batch->error = 0;
+    pool->count++;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+
+    return result;
+}
+
+/**
+ * Walks the entries of a directory too large to read in full, whose first
+ * batch is in walk->listing: the threads stat the entries of a batch while
+ * the next ones are read, and the walking thread reports them batch by
+ * batch.
+ * @param rules Ignore rules of the entries of the directory
+ * @returns 0 to continue, the callback's non-zero return value, or -1 with
+ *          errno set on error
+ */
+static int walk_large_directory(struct walk *walk, DIR *directory, int fd,
+                                const char *path, int level,
+                                struct ignore_rules *rules)
+{
+    if (start_pool(walk) == -1)
+        return -1;
+
+    struct stat_pool *pool = walk->pool;
+    pool->fd = fd;
+    pool->path = path;
+    pool->rules = rules;
+
+    const size_t path_length = strlen(path);
+    bool more = true; // entries left to read
+    bool first = true;
+    int result = 0;
+
+    while (result == 0 && (more || pool->count > 0))
+    {
+        if (more && pool->count < WALK_BATCHES)
+        {
+            const int read = add_batch(walk, directory, first);
+            first = false;
+            if (read == -1)
+                result = -1;
+            more = read == 1;
+            continue;
+        }
+
+        // the oldest batch, in order
+        wait_batch(pool);
+        const struct batch *batch = &pool->batches[pool->first];
+
+        for (size_t i = 0; i < batch->listing.count && result == 0; i++)
+        {
+            const int typeflag = batch->typeflags[i];
+            if (typeflag == SKIPPED)
+                continue;
+            if (typeflag == -1)
+            {
+                errno = batch->error;
+                result = -1;
+                break;
+            }
+
+            const char *name =
+                batch->listing.names + batch->listing.entries[i].name;
+            const int base = set_path(walk, path, path_length, name);
+            result = (base == -1) ? -1
+                                  : take_entry(walk, fd, base, level,
+                                               typeflag, &batch->stats[i]);
+        }
+        drop_batch(pool);
+    }
+
+    // the threads are done with the directory before it is closed
+    const int saved_errno = errno;
+    while (pool->count > 0)
+    {
+        wait_batch(pool);
+        drop_batch(pool);
+    }
+    errno = saved_errno;
+
+    return result;
+}
+
+static int compare_subdirectories(const void *a, const void *b)
+{
+    const ino_t first = ((const struct subdirectory *)a)->sb.st_ino;
+    const ino_t second = ((const struct subdirectory *)b)->sb.st_ino;
+    return (first > second) - (first < second);
+}
+
+// ------------------------------ directories -------------------------------
+
+/**
+ * Reports a pending directory, then its entries in inode order, pushing its
+ * subdirectories.
+ * @returns 0 to continue, the callback's non-zero return value, or -1 with
+ *          errno set on error
+ */
+static int walk_directory(struct walk *walk, const struct pending *pending,
+                          const char *path)
+{
+    if (pending->post)
+        return report(walk, path, &pending->sb, FTW_DP, pending->base,
+                      pending->level, -1);
+
+    // a directory read is one throttled operation, from open to the end
+    const struct timespec start = throttle_begin(walk);
+
+    const int fd =
+        open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC |
+                       ((walk->flags & FTW_PHYS) ? O_NOFOLLOW : 0));
+    if (fd == -1)
+    {
+        throttle_end(walk, start);
+        if (errno == ENOENT)
+            return 0; // removed since its parent was read
+        if (errno != EACCES)
+            return -1;
+
+        return report(walk, path, &pending->sb, FTW_DNR, pending->base,
+                      pending->level, -1);
+    }
+
+    DIR *directory = fdopendir(fd);
+    if (directory == NULL)
+    {
+        close(fd);
+        return -1;
+    }
+
+    // the rules for the entries, those of the directory's own files on top
+    struct ignore_rules *rules = ignore_retain(pending->rules);
+
+    // with threads, only the first batch, to see if the directory is large
+    const size_t limit = (walk->threads > 1) ? WALK_BATCH_ENTRIES : SIZE_MAX;
+    int result = read_entries(&walk->listing, directory, limit);
+    const bool large = result == 1;
+    if (result != -1 && walk->ignore)
+        result = read_ignore_files(walk, fd, path, !large, &rules);
+    throttle_end(walk, start);
+    if (result == -1)
+    {
+        const int saved_errno = errno;
+        closedir(directory);
+        ignore_release(rules);
+        errno = saved_errno;
+        return -1;
+    }
+
+    if (walk->flags & FTW_DEPTH)
+    { // reported when popped again, after everything pushed above it
+        result = set_path(walk, path, strlen(path), "");
+        if (result != -1)
+        {
+            walk->path[strlen(path)] = '\0';
+            result = push_directory(walk, pending->base, pending->level, true,
+                                    &pending->sb, NULL);
+        }
+    }
+    else
+        result = report(walk, path, &pending->sb, FTW_D, pending->base,
+                        pending->level, -1);
+
+    if (result != 0)
+    {
+        const int saved_errno = errno;
+        closedir(directory);
+        ignore_release(rules);
+        errno = saved_errno;
+        return result;
+    }
+
+    const size_t path_length = strlen(path);
+    const int level = pending->level + 1;
+    walk->subdirectory_count = 0;
+    walk->subdirectory_names_length = 0;
+
+    if (large)
+        result = walk_large_directory(walk, directory, fd, path, level,
+                                      rules);
+
+    struct stat sb;
+    for (size_t i = 0; !large && i < walk->listing.count && result == 0; i++)
+    {
+        const struct entry *entry = &walk->listing.entries[i];
+        const int base = set_path(walk, path, path_length,
+                                  walk->listing.names + entry->name);
+        if (base == -1)
+        {
+            result = -1;
+            break;
+        }
+
+        const int typeflag =
+            examine_entry(walk, fd, walk->path, base, entry, rules, &sb);
+        if (typeflag == SKIPPED)
+            continue;
+        result = (typeflag == -1)
+                     ? -1
+                     : take_entry(walk, fd, base, level, typeflag, &sb);
+    }
+
+    const int saved_errno = errno;
+    closedir(directory);
+    errno = saved_errno;
+
+    // batches are each in inode order, their subdirectories not
+    if (large)
+        qsort(walk->subdirectories, walk->subdirectory_count,
+              sizeof(struct subdirectory), compare_subdirectories);
+
+    // push in reverse, so the lowest inode is popped first
+    for (size_t i = walk->subdirectory_count; i > 0 && result == 0; i--)
+    {
+        const struct subdirectory *subdirectory =
+            &walk->subdirectories[i - 1];
+        const int base =
+            set_path(walk, path, path_length,
+                     walk->subdirectory_names + subdirectory->name);
+
+        if (base == -1 || push_directory(walk, base, level, false,
+                                         &subdirectory->sb, rules) == -1)
+            result = -1;
+    }
+
+    const int push_errno = errno;
+    ignore_release(rules);
+    errno = push_errno;
+    return result;
+}
+
+// -------------------------------- frontier --------------------------------
+
+void walk_save_frontier(const struct walk *walk, struct outbuf *output)
+{
+    const uint64_t device = walk->device;
+    const uint64_t count = walk->pending_count;
+    outbuf_write(output, &device, sizeof(device));
+    outbuf_write(output, &count, sizeof(count));
+
+    for (size_t i = 0; i < walk->pending_count; i++)
+    {
+        const struct pending *pending = &walk->pending[i];
+        const char *path = walk->pending_paths + pending->path;
+
+        struct frontier_entry entry = {pending->base, pending->level,
+                                       pending->post, strlen(path)};
+        outbuf_write(output, &entry, sizeof(entry));
+        outbuf_write(output, path, entry.length);
+    }
+}
+
+/**
+ * Length of a root without its trailing slashes, as nftw(3) reports it.
+ */
+static size_t root_length(const char *root)
+{
+    size_t length = strlen(root);
+    while (length > 1 && root[length - 1] == '/')
+        length--;
+    return length;
+}
+
+/**
+ * Reads the ignore files of the ancestors of the current path, from the
+ * root down to its parent. Ancestors that vanished or can't be read add
+ * no rules.
+ * @param root_length Length of the root, where the current path starts
+ * @param base Offset of the current path's name
+ * @param rules Set to a reference to the rules of the parent, NULL if none
+ * @returns 0 on success, -1 with errno set on error
+ */
+static int read_ancestor_rules(struct walk *walk, size_t root_length,
+                               int base, struct ignore_rules **rules)
+{
+    char *path = walk->path;
+    *rules = NULL;
+
+    for (size_t end = root_length; end < (size_t)base;)
+    {
+        // the ancestor ending at end, cut out of the path in place
+        const char saved = path[end];
+        path[end] = '\0';
+        const int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        const int result =
+            (fd == -1) ? -1 : read_ignore_files(walk, fd, path, false, rules);
+        const int saved_errno = errno;
+        if (fd != -1)
+            close(fd);
+        path[end] = saved;
+
+        if (result == -1 && (fd != -1 || (saved_errno != ENOENT &&
+                                          saved_errno != EACCES)))
+        {
+            ignore_release(*rules);
+            *rules = NULL;
+            errno = saved_errno;
+            return -1;
+        }
+
+        const char *slash = strchr(path + end + 1, '/');
+        if (slash == NULL)
+            break;
+        end = slash - path;
+    }
+    return 0;
+}
+
+/**
+ * Pushes the pending directories of a saved frontier, stat'ing them again.
+ * Those removed since are left out.
+ * @param root Root of the walk, the pending paths start with
+ * @returns 0 on success, -1 with errno set on error
+ */
+static int load_frontier(struct walk *walk, const char *root,
+                         const char *data, size_t length)
+{
+    uint64_t device;
+    uint64_t count;
+    if (length < sizeof(device) + sizeof(count))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    memcpy(&device, data, sizeof(device));
+    memcpy(&count, data + sizeof(device), sizeof(count));
+    walk->device = device;
+
+    size_t offset = sizeof(device) + sizeof(count);
+    for (uint64_t i = 0; i < count; i++)
+    {
+        struct frontier_entry entry;
+        if (length - offset < sizeof(entry))
+        {
+            errno = EINVAL;
+            return -1;
+        }
+        memcpy(&entry, data + offset, sizeof(entry));
+        offset += sizeof(entry);
+
+        if (length - offset < entry.length || entry.base < 0 ||
+            (uint32_t)entry.base > entry.length)
+        {
+            errno = EINVAL;
+            return -1;
+        }
+        if (set_path(walk, data + offset, entry.length, "") == -1)
+            return -1;
+        walk->path[entry.length] = '\0';
+        offset += entry.length;
+
+        struct stat sb;
+        const int typeflag = stat_entry(walk, AT_FDCWD, walk->path, &sb);
+        if (typeflag == -1 && errno == ENOENT)
+            continue;
+        if (typeflag == -1)
+            return -1;
+
+        struct ignore_rules *rules = NULL;
+        if (walk->ignore && !entry.post &&
+            read_ancestor_rules(walk, root_length(root), entry.base,
+                                &rules) == -1)
+            return -1;
+
+        const int result = push_directory(walk, entry.base, entry.level,
+                                          entry.post != 0, &sb, rules);
+        ignore_release(rules);
+        if (result == -1)
+            return -1;
+    }
+
+    if (offset != length)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+// ---------------------------------- walk ----------------------------------
+
+/**
+ * Reports the root, pushing it if it is a directory.
+ * @returns 0 to continue, the callback's non-zero return value, or -1 with
+ *          errno set on error
+ */
+static int start_walk(struct walk *walk, const char *root)
+{
+    struct stat sb;
+    int typeflag = stat_entry(walk, AT_FDCWD, root, &sb);
+    if (typeflag == -1)
+        return -1;
+    walk->device = sb.st_dev;
+
+    // like nftw(3), the root is reported without its trailing slashes
+    const size_t length = root_length(root);
+    int base = length;
+    while (base > 0 && root[base - 1] != '/')
+        base--;
+
+    if (set_path(walk, root, length, "") == -1)
+        return -1;
+    walk->path[length] = '\0';
+
+    if (typeflag == FTW_D)
+        return push_directory(walk, base, 0, false, &sb, NULL);
+    return report(walk, walk->path, &sb, typeflag, base, 0, -1);
+}
+
+int walk_tree(const char *root, walk_function fn, int flags)
+{
+    const struct walk_options options = {.flags = flags};
+    return walk_tree_options(root, fn, &options);
+}
+
+int walk_tree_options(const char *root, walk_function fn,
+                      const struct walk_options *options)
+{
+    struct walk walk = {0};
+    walk.fn = fn;
+    walk.flags = options->flags;
+    walk.throttle = options->throttle;
+    walk.ignore = options->ignore;
+    walk.threads = options->threads;
+
+    int result;
+    if (options->resume != NULL)
+        result = load_frontier(&walk, root, options->resume,
+                               options->resume_length);
+    else
+        result = start_walk(&walk, root);
+
+    char *path = NULL;
+    size_t path_size = 0;
+
+    while (result == 0 && walk.pending_count > 0)
+    {
+        if (options->checkpoint != NULL &&
+            0 != (result = options->checkpoint(&walk)))
+            break;
+
+        const struct pending pending = walk.pending[--walk.pending_count];
+
+        // copy the path out, pushes reuse its space in pending_paths
+        const char *pending_path = walk.pending_paths + pending.path;
+        const size_t length = strlen(pending_path) + 1;
+        if (reserve((void **)&path, &path_size, length, 1) == -1)
+        {
+            ignore_release(pending.rules);
+            result = -1;
+            break;
+        }
+        memcpy(path, pending_path, length);
+        walk.pending_paths_length = pending.path;
+
+        result = walk_directory(&walk, &pending, path);
+        ignore_release(pending.rules);
+    }
+
+    const int saved_errno = errno;
+    for (size_t i = 0; i < walk.pending_count; i++)
+        ignore_release(walk.pending[i].rules);
+    free(path);
+    free(walk.path);
+    if (walk.pool != NULL)
+        stop_pool(walk.pool);
+    free_listing(&walk.listing);
+    free(walk.subdirectories);
+    free(walk.subdirectory_names);
+    free(walk.pending);
+    free(walk.pending_paths);
+    errno = saved_errno;
+
+    return result;
+}
@@ -0,0 +1,142 @@
+/**
+ * Title:         walk.h
+ * Description:   Directory tree walk in inode order, a replacement for nftw
+ * Purpose:       Walks a directory hierarchy like nftw(3), with the same
+ *                callback, type flags and FTW_PHYS/FTW_MOUNT flags, but
+ *                orders the metadata reads for the disk: each directory is
+ *                read in full, its entries are sorted by inode number (the
+ *                d_ino of readdir(3)), and then stat'ed with fstatat(2)
+ *                relative to the open directory in that order. On ext4 and
+ *                XFS inode numbers follow the inode tables' layout, so on
+ *                spinning disks and cold caches the reads sweep across the
+ *                tables instead of seeking for every entry.
+ *                Subdirectories are walked in inode order too, after all
+ *                entries of their parent were reported. The walk keeps an
+ *                explicit stack of pending directories instead of
+ *                recursing, and holds one directory open at a time.
+ *                A directory is still reported before its contents, as
+ *                FTW_D, or with FTW_DEPTH after them, as FTW_DP, or as
+ *                FTW_DNR if it can't be read. Entries that vanish during
+ *                the walk are skipped. Without FTW_PHYS, symbolic link
+ *                loops are not detected.
+ *                Callbacks can act on an entry relative to its directory,
+ *                with walk_directory_fd() and the *at() calls, instead of
+ *                resolving its path again.
+ *                Between two directories, everything but the pending
+ *                directories (the frontier) has been reported, so a walk
+ *                can be checkpointed there with walk_save_frontier(), and
+ *                resumed from the saved frontier, without walking the
+ *                finished subtrees again.
+ *                A walk can skip what the .gitignore and .ignore files of
+ *                a source tree ignore (see ignore.h), pruning ignored
+ *                directories without opening them.
+ *                Directories too large to hold in memory at once, like
+ *                spools of millions of files, can be stat'ed by several
+ *                threads, batch by batch while the next batches are read.
+ *                The callback is still only called from the walking
+ *                thread, so it needs no locking.
+ * Usage:         int callback(const char *path, const struct stat *sb,
+ *                             int typeflag, struct FTW *ftwbuf) ...
+ *                if (walk_tree(".", callback, FTW_PHYS) == -1)
+ *                    perror("walk_tree()") ...
+ * Build with:    gcc -c walk.c -pthread
+ */
+
+#ifndef WALK_H
+#define WALK_H
+
+#include "outbuf.h"
+#include "throttle.h"
+
+#include <ftw.h> // FTW_* flags, struct FTW
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+#define WALK_BATCH_ENTRIES 4096 // entries read at a time from a directory
+                                // too large to read in full
+
+struct walk; // state of a walk in progress
+
+/**
+ * Called for each entry, like nftw(3)'s fn.
+ * @returns 0 to continue the walk, non-zero to end it
+ */
+typedef int (*walk_function)(const char *path, const struct stat *sb,
+                             int typeflag, struct FTW *ftwbuf);
+
+/**
+ * Walks the hierarchy under root, root included.
+ * @param flags FTW_PHYS to not follow symbolic links, FTW_MOUNT to stay on
+ *              the file system of root, FTW_DEPTH to report directories
+ *              after their contents
+ * @returns 0 after a full walk, the callback's non-zero return value if it
+ *          ended the walk, -1 with errno set on error
+ */
+int walk_tree(const char *root, walk_function fn, int flags);
+
+/**
+ * Called between two directories, where the walk can be checkpointed.
+ * @returns 0 to continue the walk, non-zero to end it
+ */
+typedef int (*walk_checkpoint_function)(const struct walk *walk);
+
+struct walk_options
+{
+    int flags; // as for walk_tree()
+
+    /**
+     * Takes a token before each directory read and each stat call, and is
+     * told their latency. Can be shared with other walks, NULL for none.
+     */
+    struct throttle *throttle;
+
+    /**
+     * Skip the entries that .gitignore and .ignore files in the walked
+     * directories ignore, and .git directories, see ignore.h.
+     */
+    bool ignore;
+
+    /**
+     * Threads stat'ing the entries of directories of more than
+     * WALK_BATCH_ENTRIES entries, 0 or 1 to stat them all in the walking
+     * thread. Such a directory's entries are then in inode order within
+     * each batch of WALK_BATCH_ENTRIES.
+     */
+    int threads;
+
+    walk_checkpoint_function checkpoint; // NULL for none
+
+    /**
+     * Frontier saved by walk_save_frontier() to resume the walk from,
+     * instead of starting at the root, NULL for none.
+     */
+    const void *resume;
+    size_t resume_length;
+};
+
+/**
+ * Like walk_tree(), with throttling and checkpoints.
+ * @returns like walk_tree(), or the checkpoint function's non-zero return
+ *          value if it ended the walk. A frontier that can't be parsed
+ *          fails with EINVAL.
+ */
+int walk_tree_options(const char *root, walk_function fn,
+                      const struct walk_options *options);
+
+/**
+ * Appends the frontier of a walk, the directories it still has to read,
+ * in a form only walk_tree_options() reads. Meant for a checkpoint
+ * function.
+ */
+void walk_save_frontier(const struct walk *walk, struct outbuf *output);
+
+/**
+ * The directory containing the entry a callback is called for, which
+ * path + ftwbuf->base is relative to. Only valid during the callback.
+ * @param ftwbuf As passed to the callback
+ * @returns an open descriptor or AT_FDCWD, -1 with errno set on error
+ */
+int walk_directory_fd(struct FTW *ftwbuf);
+
+#endif